@@ -0,0 +1,591 @@
+﻿/*
+	Микро-бенчмарки
+
+	Небольшой каркас для замеров производительности "горячих" функций
+	библиотеки. Время измеряется с помощью my::stopwatch. Т.к. точность
+	таймера - микросекунды, тест выполняется пачками (batch): размер
+	пачки подбирается автоматически во время разогрева так, чтобы одна
+	пачка выполнялась не менее min_time / repeats.
+
+	Порядок замера одного теста:
+		1) Разогрев (warmup) и калибровка размера пачки.
+		2) Замер repeats пачек. Из них - среднее, минимальное
+			и максимальное время одной итерации.
+
+	Пример:
+
+		int main(int argc, char *argv[])
+		{
+			my::bench::runner bench(argc, argv);
+
+			char buf[64];
+			int n = 12345;
+
+			for (my::bench::timer t(bench, "num", "put(int)"); t.next(); )
+			{
+				my::bench::do_not_optimize(n);
+				my::num::put(buf, sizeof(buf), n);
+				my::bench::clobber_memory();
+			}
+
+			return bench.report();
+		}
+
+	Параметры командной строки:
+		--filter=str     - только тесты, в полном названии (suite/name)
+		                   которых встречается str
+		--list           - вывести список тестов (без замеров)
+		--min-time=ms    - время замера одного теста (по умолчанию 200)
+		--warmup=ms      - время разогрева (по умолчанию 50)
+		--repeats=n      - кол-во замеряемых пачек (по умолчанию 10)
+		--format=fmt     - формат вывода: text (по умолчанию), csv, json
+		--out=file       - вывод в файл вместо std::cout
+		--baseline=file  - сравнение с сохранённым ранее результатом
+		                   (в формате csv: --format=csv --out=file)
+		--threshold=pct  - допустимое замедление относительно baseline,
+		                   в процентах (по умолчанию 10)
+
+	report() возвращает 0, если замедлений относительно baseline
+	нет, и 1 - если есть (удобно для скриптов).
+*/
+
+#ifndef MY_BENCH_H
+#define MY_BENCH_H
+
+#include "my_stopwatch.h"
+
+#include <cstddef> /* std::size_t */
+#include <cstdlib> /* std::atoi */
+#include <cstring> /* std::strncmp */
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+
+#if defined(_MSC_VER)
+#include <intrin.h> /* _ReadWriteBarrier */
+#endif
+
+namespace my { namespace bench {
+
+namespace detail {
+
+inline void use_char_pointer(const volatile char *ptr)
+{
+	static const volatile char * volatile sink;
+	sink = ptr;
+	(void)sink;
+}
+
+}
+
+/* Барьер для оптимизатора: значение value считается использованным,
+	поэтому его вычисление не может быть выброшено */
+template<class T>
+inline void do_not_optimize(const T &value)
+{
+#if defined(__GNUC__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	detail::use_char_pointer(
+		reinterpret_cast<const volatile char*>(&value));
+#endif
+}
+
+/* Барьер для оптимизатора: все записи в память считаются
+	выполненными, все чтения - необходимыми */
+inline void clobber_memory()
+{
+#if defined(__GNUC__)
+	asm volatile("" : : : "memory");
+#elif defined(_MSC_VER)
+	_ReadWriteBarrier();
+#endif
+}
+
+/* Простой и быстрый генератор псевдослучайных чисел (xorshift64*)
+	- для подготовки тестовых данных. Последовательность всегда
+	одна и та же, чтобы замеры были сравнимы */
+class random
+{
+private:
+	unsigned long long state_;
+
+public:
+	random(unsigned long long seed = 88172645463325252ULL)
+		: state_(seed ? seed : 1) {}
+
+	inline unsigned long long operator()()
+	{
+		state_ ^= state_ >> 12;
+		state_ ^= state_ << 25;
+		state_ ^= state_ >> 27;
+		return state_ * 2685821657736338717ULL;
+	}
+
+	/* Число в диапазоне [0, n) */
+	inline unsigned long long operator()(unsigned long long n)
+		{ return (*this)() % n; }
+};
+
+/* Результат одного теста */
+struct result
+{
+	std::string suite;
+	std::string name;
+	unsigned long long iterations; /* Кол-во замеренных итераций */
+	double ns; /* Среднее время одной итерации, нс */
+	double min_ns; /* Время итерации в самой быстрой пачке */
+	double max_ns; /* Время итерации в самой медленной пачке */
+	double base_ns; /* Значение из baseline (0 - нет данных) */
+
+	result()
+		: iterations(0), ns(0.0), min_ns(0.0), max_ns(0.0), base_ns(0.0) {}
+
+	std::string full_name() const
+		{ return suite + "/" + name; }
+
+	/* Изменение относительно baseline, в процентах */
+	double delta() const
+		{ return base_ns > 0.0 ? (ns - base_ns) * 100.0 / base_ns : 0.0; }
+};
+
+class timer;
+
+class runner
+{
+friend class timer;
+public:
+	typedef std::vector<result> results_list;
+
+private:
+	std::string filter_;
+	std::string format_;
+	std::string out_;
+	std::string baseline_;
+	bool list_;
+	long min_time_ms_;
+	long warmup_ms_;
+	int repeats_;
+	double threshold_;
+
+	results_list results_;
+	std::map<std::string, double> base_;
+
+	static bool option(const char *arg, const char *name, std::string &value)
+	{
+		std::size_t len = std::strlen(name);
+		if (std::strncmp(arg, name, len) != 0 || arg[len] != '=')
+			return false;
+		value = arg + len + 1;
+		return true;
+	}
+
+	/* Разбор строки csv с учётом кавычек */
+	static std::vector<std::string> split_csv(const std::string &line)
+	{
+		std::vector<std::string> fields(1);
+		bool quoted = false;
+
+		for (std::size_t i = 0; i < line.size(); i++)
+		{
+			char ch = line[i];
+
+			if (quoted)
+			{
+				if (ch != '\"')
+					fields.back() += ch;
+				else if (i + 1 < line.size() && line[i + 1] == '\"')
+					fields.back() += line[++i];
+				else
+					quoted = false;
+			}
+			else if (ch == '\"')
+				quoted = true;
+			else if (ch == ',')
+				fields.push_back(std::string());
+			else if (ch != '\r')
+				fields.back() += ch;
+		}
+
+		return fields;
+	}
+
+	static std::string csv_field(const std::string &str)
+	{
+		if (str.find_first_of(",\"") == std::string::npos)
+			return str;
+
+		std::string out(1, '\"');
+		for (std::size_t i = 0; i < str.size(); i++)
+		{
+			if (str[i] == '\"')
+				out += '\"';
+			out += str[i];
+		}
+
+		return out + '\"';
+	}
+
+	static std::string json_string(const std::string &str)
+	{
+		std::string out(1, '\"');
+		for (std::size_t i = 0; i < str.size(); i++)
+		{
+			if (str[i] == '\"' || str[i] == '\\')
+				out += '\\';
+			out += str[i];
+		}
+
+		return out + '\"';
+	}
+
+	void load_baseline()
+	{
+		std::ifstream in(baseline_.c_str());
+		if (!in)
+		{
+			std::cerr << "bench: can't open baseline " << baseline_ << std::endl;
+			return;
+		}
+
+		std::string line;
+		std::getline(in, line); /* Заголовок */
+
+		while (std::getline(in, line))
+		{
+			std::vector<std::string> f = split_csv(line);
+			if (f.size() >= 3)
+				base_[f[0] + "/" + f[1]] = std::atof(f[2].c_str());
+		}
+	}
+
+	/* Выполняется ли тест (фильтр) */
+	bool enabled(const char *suite, const char *name) const
+	{
+		if (filter_.empty())
+			return true;
+
+		std::string full_name = std::string(suite) + "/" + name;
+		return full_name.find(filter_) != std::string::npos;
+	}
+
+	void add(const result &res)
+	{
+		results_.push_back(res);
+
+		std::map<std::string, double>::const_iterator iter
+			= base_.find(res.full_name());
+		if (iter != base_.end())
+			results_.back().base_ns = iter->second;
+
+		/* Чтобы было видно, что процесс идёт */
+		if (format_ == "text" && out_.empty())
+			print_text(std::cout, results_.back(), results_.size() == 1);
+	}
+
+	bool regression(const result &res) const
+		{ return res.base_ns > 0.0 && res.delta() > threshold_; }
+
+	/* Столбцы разделены пробелом - большие значения и длинные имена
+		не сливаются с соседними, даже если не влезли в ширину */
+	void print_text(std::ostream &out, const result &res, bool header) const
+	{
+		if (header)
+		{
+			out << std::left << std::setw(40) << "benchmark"
+				<< std::right << ' ' << std::setw(14) << "ns/op"
+				<< ' ' << std::setw(14) << "min"
+				<< ' ' << std::setw(14) << "max"
+				<< ' ' << std::setw(12) << "iterations";
+			if (!base_.empty())
+				out << ' ' << std::setw(14) << "baseline"
+					<< ' ' << std::setw(9) << "delta";
+			out << std::endl;
+		}
+
+		out << std::left << std::setw(40) << res.full_name()
+			<< std::right << std::fixed << std::setprecision(2)
+			<< ' ' << std::setw(14) << res.ns
+			<< ' ' << std::setw(14) << res.min_ns
+			<< ' ' << std::setw(14) << res.max_ns
+			<< ' ' << std::setw(12) << res.iterations;
+
+		if (res.base_ns > 0.0)
+		{
+			out << ' ' << std::setw(14) << res.base_ns
+				<< ' ' << std::setw(8) << std::showpos << res.delta()
+				<< std::noshowpos << '%';
+			if (regression(res))
+				out << " REGRESSION";
+		}
+
+		out << std::endl;
+	}
+
+	void print(std::ostream &out) const
+	{
+		if (format_ == "csv")
+		{
+			out << "suite,name,ns,min_ns,max_ns,iterations" << std::endl;
+
+			for (results_list::const_iterator iter = results_.begin();
+				iter != results_.end(); ++iter)
+			{
+				out << csv_field(iter->suite) << ','
+					<< csv_field(iter->name) << ','
+					<< std::fixed << std::setprecision(3)
+					<< iter->ns << ','
+					<< iter->min_ns << ','
+					<< iter->max_ns << ','
+					<< iter->iterations << std::endl;
+			}
+		}
+		else if (format_ == "json")
+		{
+			out << "[";
+
+			for (results_list::const_iterator iter = results_.begin();
+				iter != results_.end(); ++iter)
+			{
+				out << (iter == results_.begin() ? "\n" : ",\n")
+					<< "  {\"suite\": " << json_string(iter->suite)
+					<< ", \"name\": " << json_string(iter->name)
+					<< std::fixed << std::setprecision(3)
+					<< ", \"ns\": " << iter->ns
+					<< ", \"min_ns\": " << iter->min_ns
+					<< ", \"max_ns\": " << iter->max_ns
+					<< ", \"iterations\": " << iter->iterations;
+				if (iter->base_ns > 0.0)
+					out << ", \"baseline_ns\": " << iter->base_ns
+						<< ", \"delta_pct\": " << iter->delta()
+						<< ", \"regression\": "
+						<< (regression(*iter) ? "true" : "false");
+				out << "}";
+			}
+
+			out << "\n]" << std::endl;
+		}
+		else
+		{
+			for (results_list::const_iterator iter = results_.begin();
+				iter != results_.end(); ++iter)
+			{
+				print_text(out, *iter, iter == results_.begin());
+			}
+		}
+	}
+
+public:
+	runner(int argc = 0, char *argv[] = 0)
+		: format_("text")
+		, list_(false)
+		, min_time_ms_(200)
+		, warmup_ms_(50)
+		, repeats_(10)
+		, threshold_(10.0)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string value;
+
+			if (std::strcmp(argv[i], "--list") == 0)
+				list_ = true;
+			else if (option(argv[i], "--filter", value))
+				filter_ = value;
+			else if (option(argv[i], "--min-time", value))
+				min_time_ms_ = std::atol(value.c_str());
+			else if (option(argv[i], "--warmup", value))
+				warmup_ms_ = std::atol(value.c_str());
+			else if (option(argv[i], "--repeats", value))
+				repeats_ = std::atoi(value.c_str());
+			else if (option(argv[i], "--format", value))
+				format_ = value;
+			else if (option(argv[i], "--out", value))
+				out_ = value;
+			else if (option(argv[i], "--baseline", value))
+				baseline_ = value;
+			else if (option(argv[i], "--threshold", value))
+				threshold_ = std::atof(value.c_str());
+			else
+				std::cerr << "bench: unknown option " << argv[i] << std::endl;
+		}
+
+		if (min_time_ms_ <= 0)
+			min_time_ms_ = 1;
+		if (repeats_ <= 0)
+			repeats_ = 1;
+
+		if (!baseline_.empty())
+			load_baseline();
+	}
+
+	inline const results_list& results() const
+		{ return results_; }
+
+	/* Вывод результатов. Возврат: 0 - всё в порядке,
+		1 - есть замедления относительно baseline */
+	int report()
+	{
+		if (list_)
+			return 0;
+
+		if (!out_.empty())
+		{
+			std::ofstream out(out_.c_str());
+			print(out);
+		}
+		else if (format_ != "text")
+			print(std::cout);
+
+		int regressions = 0;
+		for (results_list::const_iterator iter = results_.begin();
+			iter != results_.end(); ++iter)
+		{
+			if (regression(*iter))
+				regressions++;
+		}
+
+		if (regressions)
+			std::cerr << "bench: " << regressions
+				<< " regression(s) over " << threshold_ << "%" << std::endl;
+
+		return regressions ? 1 : 0;
+	}
+};
+
+/*
+	Замер одного теста. Тело цикла
+
+		for (my::bench::timer t(bench, suite, name); t.next(); ) { ... }
+
+	выполняется столько раз, сколько необходимо для замера. Лишних
+	действий на каждой итерации - только декремент и сравнение.
+*/
+class timer
+{
+private:
+	enum { warmup, measure, done };
+
+	runner &runner_;
+	result res_;
+	int phase_;
+	bool started_;
+	unsigned long long batch_; /* Итераций в пачке */
+	unsigned long long left_; /* Осталось итераций в текущей пачке */
+	posix_time::time_duration batch_time_; /* Целевое время пачки */
+	posix_time::time_duration warmup_time_;
+	stopwatch sw_;
+
+	static double to_ns(const posix_time::time_duration &time)
+	{
+		return (double)time.ticks() * 1000000000.0
+			/ (double)posix_time::time_duration::ticks_per_second();
+	}
+
+	/* Окончание пачки (и начало следующей) */
+	bool step()
+	{
+		if (phase_ == done)
+			return false;
+
+		if (!started_)
+			started_ = true;
+
+		else if (phase_ == warmup)
+		{
+			sw_.finish();
+
+			posix_time::time_duration last = sw_.total();
+
+			/* Калибровка: увеличиваем пачку, пока она выполняется
+				быстрее, чем нужно. Рост - не более чем в 10 раз */
+			if (last < batch_time_)
+			{
+				unsigned long long k = last.ticks() > 0
+					? (unsigned long long)(batch_time_.ticks() / last.ticks()) + 1
+					: 10;
+				batch_ *= (k > 10 ? 10 : k);
+			}
+
+			/* Прошедшие пачки разогрева сохраняем в очереди
+				секундомера - нужно только их общее время */
+			if (sw_.full_total() >= warmup_time_ && last >= batch_time_)
+			{
+				phase_ = measure;
+				sw_.reset();
+			}
+			else
+				sw_.push();
+		}
+
+		else
+		{
+			sw_.finish();
+
+			if (sw_.count() >= runner_.repeats_)
+			{
+				res_.iterations = batch_ * sw_.count();
+				res_.ns = to_ns(sw_.total()) / (double)res_.iterations;
+				res_.min_ns = to_ns(sw_.min()) / (double)batch_;
+				res_.max_ns = to_ns(sw_.max()) / (double)batch_;
+
+				phase_ = done;
+				runner_.add(res_);
+				return false;
+			}
+		}
+
+		left_ = batch_ - 1;
+		sw_.start();
+		return true;
+	}
+
+public:
+	timer(runner &r, const char *suite, const char *name)
+		: runner_(r)
+		, phase_(warmup)
+		, started_(false)
+		, batch_(1)
+		, left_(0)
+		, batch_time_(posix_time::milliseconds(r.min_time_ms_) / r.repeats_)
+		, warmup_time_(posix_time::milliseconds(r.warmup_ms_))
+		, sw_(stopwatch::show_all)
+	{
+		res_.suite = suite;
+		res_.name = name;
+
+		if (!runner_.enabled(suite, name))
+			phase_ = done;
+		else if (runner_.list_)
+		{
+			std::cout << res_.full_name() << std::endl;
+			phase_ = done;
+		}
+
+		if (batch_time_ <= posix_time::time_duration())
+			batch_time_ = posix_time::microseconds(100);
+	}
+
+	/* Следующая итерация */
+	inline bool next()
+	{
+		if (left_)
+		{
+			--left_;
+			return true;
+		}
+
+		return step();
+	}
+
+	inline const result& get_result() const
+		{ return res_; }
+};
+
+} }
+
+#endif
@@ -1,291 +1,2497 @@
 ﻿#include <boost/config/warning_disable.hpp> /* против unsafe */
 
 #include "my_http.h"
+#include "my_num.h"
 #include "my_utf8.h"
 #include "my_str.h"
-#include "my_qi.h"
 #include "my_fs.h"
 #include "my_exception.h"
 
 #include <cstddef> /* std::size_t */
+#include <cstring> /* std::memcmp, std::strlen */
 #include <errno.h>
+#include <algorithm> /* std::min */
 #include <iterator>
 
-#include <boost/regex.hpp>
+#include <boost/array.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/algorithm/string/predicate.hpp> /* iequals */
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+/* Перенос тела из сокета в файл без копирования в память процесса */
+#if defined(__linux__)
+#include <fcntl.h> /* open, splice */
+#include <poll.h>
+#include <unistd.h>
+#define MY_HTTP_SPLICE 1
+#else
+#define MY_HTTP_SPLICE 0
+#endif
 
 namespace my { namespace http {
 
-void parse_request(const std::string &line,
-	std::string &url, params_type &params)
+std::size_t find_header_end(const char *data, std::size_t size,
+	std::size_t &scanned)
 {
-	qi::rule<std::string::const_iterator, std::string()> url_r
-		= +(qi::char_ - ' ' - '?' - '&');
-	qi::rule<std::string::const_iterator, std::string()> key_r
-		= +(qi::char_ - ' ' - '&' - '=');
-	qi::rule<std::string::const_iterator, std::string()> value_r
-		= +(qi::char_ - ' ' - '&');
-	qi::rule<std::string::const_iterator, param_type()> pair_r
-		= key_r >> -('=' >> value_r);
-	qi::rule<std::string::const_iterator, params_type()> params_r
-		= qi::lit('?') >> pair_r >> *(qi::lit('&') >> pair_r);
-
-	std::string::const_iterator iter = line.begin();
-
-	bool res = qi::parse( iter, line.end(),
-		qi::lit("GET ")
-		>> url_r[phoenix::ref(url) = qi::_1]
-		>> -params_r[phoenix::ref(params) = qi::_1]
-		>> " HTTP/1.1\r\n"
-		>> qi::eoi);
+	const char *end = data + size;
+	const char *ptr = data + scanned;
 
-	if (!res)
+	/* Заголовок может быть и пустым. Проверяем при каждом вызове:
+		"\r" и "\n" могут прийти по отдельности */
+	if (size && data[0] == '\n')
+		return 1;
+	if (size >= 2 && data[0] == '\r' && data[1] == '\n')
+		return 2;
+
+	/* Ищем '\n', за которым сразу идёт пустая строка. '\n' ищется
+		сразу в 16/32 байтах (см. my::num::find_delim) */
+	while (true)
+	{
+		ptr = my::num::find_delim(ptr, end, '\n');
+		if (ptr == end)
+			break;
+
+		const char *next = ptr + 1;
+
+		if (next != end && *next == '\n')
+			return next + 1 - data;
+
+		if (next != end && *next == '\r')
+		{
+			if (next + 1 == end)
+				break;
+			if (next[1] == '\n')
+				return next + 2 - data;
+		}
+		else if (next == end)
+			break;
+
+		ptr = next;
+	}
+
+	/* В следующий раз начнём с '\n', после которого данных пока
+		не хватает, или с конца - если такого '\n' нет */
+	scanned = ptr - data;
+
+	return 0;
+}
+
+static void throw_header_error(const char *begin, const char *ptr)
+{
+	/* Считаем, в какой строке ошибка */
+	int line = 1;
+	const char *line_begin = begin;
+
+	for (const char *it = begin; it != ptr; it++)
+	{
+		if (*it == '\n')
+		{
+			line++;
+			line_begin = it + 1;
+		}
+	}
+
+	throw my::exception(L"Не удалось разобрать HTTP-заголовок")
+		<< my::param(L"http-header",
+			my::str::to_wstring(std::string(begin, ptr)))
+		<< my::param(L"line", line)
+		<< my::param(L"position", ptr - line_begin);
+}
+
+const char* parse_fields(const char *ptr, const char *end,
+	std::vector<header_field> &fields)
+{
+	const char *begin = ptr;
+
+	while (true)
+	{
+		const char *eol = my::num::find_delim(ptr, end, '\n');
+		if (eol == end)
+			throw_header_error(begin, eol);
+
+		const char *line_end = (eol != ptr && eol[-1] == '\r' ? eol - 1 : eol);
+
+		/* Пустая строка - конец заголовка */
+		if (line_end == ptr)
+			return eol + 1;
+
+		/* Имя - до ':', без пробелов и управляющих символов (строки
+			продолжения, начинающиеся с пробела, не поддерживаются) */
+		const char *colon = ptr;
+		while (colon != line_end && *colon != ':'
+			&& (unsigned char)*colon > ' ')
+			++colon;
+
+		if (colon == ptr || colon == line_end || *colon != ':')
+			throw_header_error(begin, colon);
+
+		/* Значение - без пробелов в начале и в конце */
+		const char *value = colon + 1;
+		while (value != line_end && (*value == ' ' || *value == '\t'))
+			++value;
+
+		const char *value_end = line_end;
+		while (value_end != value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+			--value_end;
+
+		header_field field;
+		field.name = boost::string_ref(ptr, colon - ptr);
+		field.value = boost::string_ref(value, value_end - value);
+		fields.push_back(field);
+
+		ptr = eol + 1;
+	}
+}
+
+void parser::reset()
+{
+	method = url = status_message = boost::string_ref();
+	status_code = 0;
+	minor_version = 0;
+	scanned_ = 0;
+	fields_.clear();
+}
+
+/* "HTTP/1.x" */
+const char* parser::parse_version(const char *ptr, const char *end)
+{
+	if (end - ptr < 8 || std::memcmp(ptr, "HTTP/1.", 7) != 0
+		|| (unsigned int)(ptr[7] - '0') > 9)
+		return 0;
+
+	minor_version = ptr[7] - '0';
+
+	return ptr + 8;
+}
+
+/* Конец строки: "\r\n" или '\n' */
+static const char* skip_eol(const char *ptr, const char *end)
+{
+	if (ptr != end && *ptr == '\r')
+		++ptr;
+	return (ptr != end && *ptr == '\n' ? ptr + 1 : 0);
+}
+
+std::size_t parser::parse_request(const char *data, std::size_t size)
+{
+	std::size_t n = find_header_end(data, size, scanned_);
+	if (!n)
+		return 0;
+
+	const char *end = data + n;
+	const char *ptr = data;
+
+	/* GET /path?a=b HTTP/1.1\r\n */
+	const char *sp = ptr;
+	while (sp != end && (unsigned char)*sp > ' ')
+		++sp;
+
+	const char *url_begin = sp;
+	const char *url_end = sp;
+
+	if (sp != ptr && sp != end && *sp == ' ')
+	{
+		url_begin = url_end = sp + 1;
+		while (url_end != end && (unsigned char)*url_end > ' ')
+			++url_end;
+	}
+
+	const char *next = (url_end != url_begin && url_end != end && *url_end == ' '
+		? parse_version(url_end + 1, end) : 0);
+	if (next)
+		next = skip_eol(next, end);
+
+	if (!next)
 		throw my::exception(L"Не удалось разобрать HTTP-запрос")
-			<< my::param(L"http-request", my::str::to_wstring(line))
-			<< my::param(L"position", iter - line.begin());
+			<< my::param(L"http-request",
+				my::str::to_wstring(std::string(data,
+					my::num::find_delim(data, end, '\n'))));
+
+	method = boost::string_ref(ptr, sp - ptr);
+	url = boost::string_ref(url_begin, url_end - url_begin);
+
+	fields_.clear();
+	parse_fields(next, end, fields_);
+	scanned_ = 0;
+
+	return n;
 }
 
-unsigned int parse_reply(const std::string &line,
-	std::string &status_message)
+std::size_t parser::parse_reply(const char *data, std::size_t size)
 {
-	unsigned int status_code;
+	std::size_t n = find_header_end(data, size, scanned_);
+	if (!n)
+		return 0;
 
-	std::string::const_iterator iter = line.begin();
+	const char *end = data + n;
 
-	bool res = qi::parse( iter, line.end(),
-		qi::lit("HTTP/1.1 ")
-		>> qi::uint_
-		>> ' '
-		>> +(qi::char_ - '\r' - '\n')
-		>> "\r\n"
-		>> qi::eoi,
-		status_code, status_message);
+	/* HTTP/1.1 200 OK\r\n */
+	const char *ptr = parse_version(data, end);
+	const char *next = 0;
 
-	if (!res)
+	if (ptr && end - ptr > 4 && *ptr == ' '
+		&& my::num::get(ptr + 1, 3, status_code) == 3)
+	{
+		ptr += 4;
+		if (*ptr == ' ')
+			++ptr;
+
+		const char *eol = my::num::find_delim(ptr, end, '\n');
+		const char *message_end = (eol != ptr && eol[-1] == '\r' ? eol - 1 : eol);
+
+		status_message = boost::string_ref(ptr, message_end - ptr);
+		next = skip_eol(message_end, end);
+	}
+
+	if (!next)
 		throw my::exception(L"Не удалось разобрать HTTP-ответ")
-			<< my::param(L"http-reply", my::str::to_wstring(line))
-			<< my::param(L"position", iter - line.begin());
+			<< my::param(L"http-reply",
+				my::str::to_wstring(std::string(data,
+					my::num::find_delim(data, end, '\n'))));
 
-	return status_code;
+	fields_.clear();
+	parse_fields(next, end, fields_);
+	scanned_ = 0;
+
+	return n;
 }
 
-void parse_header(const std::string &lines, params_type &params)
+const boost::string_ref* parser::find(const char *name) const
 {
-	qi::rule<std::string::const_iterator, std::string()> key_r
-		= +(qi::char_ - ' ' - ':' - '\r' - '\n');
-	qi::rule<std::string::const_iterator, std::string()> value_r
-		= *(qi::char_ - '\r' - '\n');
-	qi::rule<std::string::const_iterator, param_type()> pair_r
-		= key_r >> ": " >> value_r >> "\r\n";
-	qi::rule<std::string::const_iterator, params_type()> params_r
-		= *pair_r;
+	const boost::string_ref key(name);
 
-	std::string::const_iterator iter = lines.begin();
+	for (std::vector<header_field>::const_iterator iter = fields_.begin();
+		iter != fields_.end(); iter++)
+		if (my::str::iequals(iter->name, key))
+			return &iter->value;
 
-	bool res = qi::parse( iter, lines.end(),
-		params_r >> "\r\n" >> qi::eoi,
-		params);
+	return 0;
+}
 
-	if (!res)
+/* Способ определения конца тела по значениям Transfer-Encoding
+	и Content-Length (0 - нет поля). Возврат: false - неверное
+	значение Content-Length */
+template<class Char>
+static bool get_framing(const Char *te, std::size_t te_size,
+	const Char *cl, std::size_t cl_size,
+	body_reader::framing_type &framing, unsigned long long &length)
+{
+	static const char chunked[] = "chunked";
+
+	/* Transfer-Encoding важнее Content-Length; chunked - всегда
+		последний в списке */
+	if (te && te_size >= 7)
 	{
-		/* Считаем, в какой строке ошибка */
-		int line = 1;
-		int pos = iter - lines.begin();
-		int bytes_in_line = 0;
+		const Char *ptr = te + te_size - 7;
+		int i = 0;
+		while (i < 7 && (ptr[i] | 0x20) == chunked[i])
+			i++;
 
-		for (std::string::const_iterator it = lines.begin();
-			it != iter; it++)
+		if (i == 7)
 		{
-			if (*it == '\n')
-			{
-				pos -= bytes_in_line;
-				line++;
-				bytes_in_line = 0;
-			}
+			framing = body_reader::chunked;
+			return true;
 		}
+	}
 
-		throw my::exception(L"Не удалось разобрать HTTP-заголовок")
-			<< my::param(L"http-header", my::str::to_wstring(lines))
-			<< my::param(L"line", line)
-			<< my::param(L"position", pos);
+	if (cl)
+	{
+		framing = body_reader::content_length;
+		return cl_size && my::num::get(cl, cl_size, length) == cl_size;
 	}
+
+	framing = body_reader::until_eof;
+	return true;
 }
 
-std::string percent_decode(const char *str, int len)
+body_reader::framing_type parser::body_framing(
+	unsigned long long &length, bool is_request) const
 {
-	std::string out;
+	const boost::string_ref *te = find("Transfer-Encoding");
+	const boost::string_ref *cl = find("Content-Length");
+	body_reader::framing_type framing;
 
-	/* Для нормального преобразования символов с кодами выше 127
-		необходимо использовать unsigned char, поэтому оформляем
-		это дело отдельным правилом */
-	qi::rule<const char *, unsigned char()> char_r
-		= (qi::char_ - '%')
-			| ('%' >> qi::uint_parser<unsigned char, 16, 2, 2>());
+	if (!get_framing(te ? te->data() : 0, te ? te->size() : 0,
+		cl ? cl->data() : 0, cl ? cl->size() : 0, framing, length))
+		throw my::exception(L"Неверное значение Content-Length")
+			<< my::param(L"Content-Length", my::str::to_wstring(cl->to_string()));
 
-	if (len < 0)
-		len = my::str::length(str);
+	if (is_request && framing == body_reader::until_eof)
+	{
+		length = 0;
+		framing = body_reader::content_length;
+	}
+
+	return framing;
+}
 
-	qi::parse(str, str + len,
-		*char_r >> qi::eoi, out); /* eoi - указатель конца строки */
+/* Добавление пары в map с percent- и utf8-декодированием. Значение
+	декодируется прямо на место, key - общий буфер для имён */
+static void decode_pair(std::map<std::wstring, std::wstring> &map,
+	std::wstring &key, const char *name, std::size_t name_size,
+	const char *value, std::size_t value_size)
+{
+	key.clear();
+	percent_decode_append(name, name_size, key);
 
-	return out;
+	std::wstring &dest = map[key];
+	dest.clear();
+	percent_decode_append(value, value_size, dest);
 }
 
-std::string percent_encode(const char *str,
-	const char *escape_symbols, int len)
+static void fields_to_map(const std::vector<header_field> &fields,
+	std::map<std::wstring, std::wstring> &map)
 {
-	static const char hex[16] =
-	{
-		'0', '1', '2', '3', '4', '5', '6', '7',
-		'8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
-	};
+	std::wstring key;
 
-	if (len < 0)
-		len = my::str::length(str);
+	for (std::vector<header_field>::const_iterator iter = fields.begin();
+		iter != fields.end(); iter++)
+	{
+		decode_pair(map, key, iter->name.data(), iter->name.size(),
+			iter->value.data(), iter->value.size());
+	}
+}
 
-	const char *ptr_in = str;
-	/* Строка может содержать нулевой символ, поэтому
-		пользуемся размером исходной строки */
-	const char *end_in = ptr_in + len;
+void parser::to_map(std::map<std::wstring, std::wstring> &map) const
+{
+	fields_to_map(fields_, map);
+}
 
-	/* Сразу готовим буфер */
-	std::string out(len * 3, ' ');
-	char *begin_out = (char*)out.c_str();
-	char *ptr_out = begin_out;
+static void fields_to_list(const std::vector<header_field> &fields,
+	field_list &list)
+{
+	list.clear();
+	list.reserve(fields.size());
 
-	while (ptr_in != end_in)
+	for (std::vector<header_field>::const_iterator iter = fields.begin();
+		iter != fields.end(); iter++)
 	{
-		char ch = *ptr_in++;
-        /* Кодируются все специальные символы, все не ascii-символы (>127),
-        	пробел и заказанные пользователем */
-		if ( ch <= 32 || ch > 127 ||
-			(escape_symbols && strchr(escape_symbols, ch)) )
-		{
-			*ptr_out++ = '%';
-			*ptr_out++ = hex[ ((unsigned char)ch) >> 4];
-			*ptr_out++ = hex[ ch & 0xf ];
-		}
-		else
-			*ptr_out++ = ch;
+		list.add_decoded(iter->name.data(), iter->name.size(),
+			iter->value.data(), iter->value.size());
 	}
+}
 
-	out.resize(ptr_out - begin_out);
+void parser::to_fields(field_list &fields) const
+{
+	fields_to_list(fields_, fields);
+}
 
-	return out;
+/* Хэш имени поля без учёта регистра (FNV-1a от символов с 0x20):
+	у имён, равных по iequals, хэши тоже равны */
+static inline unsigned int name_hash(const char *ptr, std::size_t size)
+{
+	unsigned int hash = 2166136261u;
+
+	for (std::size_t i = 0; i < size; i++)
+		hash = (hash ^ (unsigned char)(ptr[i] | 0x20)) * 16777619u;
+
+	return hash;
 }
 
+void field_list::add(const char *name, std::size_t name_size,
+	const char *value, std::size_t value_size)
+{
+	entry e;
+
+	e.name = (unsigned int)arena_.size();
+	e.name_size = (unsigned int)name_size;
+	e.hash = name_hash(name, name_size);
+	arena_.append(name, name_size);
 
-void message::read_header(tcp::socket &socket)
+	e.value = (unsigned int)arena_.size();
+	e.value_size = (unsigned int)value_size;
+	arena_.append(value, value_size);
+
+	entries_.push_back(e);
+}
+
+void field_list::add_decoded(const char *name, std::size_t name_size,
+	const char *value, std::size_t value_size)
 {
-	std::size_t n = asio::read_until(socket, buf_, boost::regex("^\r\n"));
+	entry e;
 
-	header_.resize(n);
-	buf_.sgetn((char*)header_.c_str(), n);
+	e.name = (unsigned int)arena_.size();
+	percent_decode_append(name, name_size, arena_);
+	e.name_size = (unsigned int)arena_.size() - e.name;
+	e.hash = name_hash(arena_.data() + e.name, e.name_size);
 
-	params_type header_s;
-	parse_header(header_, header_s);
+	e.value = (unsigned int)arena_.size();
+	percent_decode_append(value, value_size, arena_);
+	e.value_size = (unsigned int)arena_.size() - e.value;
 
-	for (params_type::iterator iter = header_s.begin();
-		iter != header_s.end(); iter++)
-	{
-		header[ my::utf8::decode( percent_decode(iter->first) ) ]
-			= my::utf8::decode( percent_decode(iter->second) );
-	}
+	entries_.push_back(e);
 }
 
-void message::read_body(tcp::socket &socket)
+bool field_list::find(const char *name, boost::string_ref &value) const
 {
-	/* Чтение здесь всегда заканчивается ошибкой! */
-	boost::system::error_code ec;
-	asio::read(socket, buf_, boost::asio::transfer_all(), ec);
+	/* Сначала - по хэшу и длине: до посимвольного сравнения
+		доходит, как правило, только нужное поле */
+	const boost::string_ref key(name);
+	const unsigned int hash = name_hash(key.data(), key.size());
+
+	for (std::size_t i = 0; i < entries_.size(); i++)
+		if (entries_[i].hash == hash && entries_[i].name_size == key.size()
+			&& my::str::iequals(this->name(i), key))
+		{
+			value = this->value(i);
+			return true;
+		}
 
-	std::size_t n = buf_.size();
-	body.resize(n);
-	buf_.sgetn((char*)body.c_str(), n);
+	return false;
 }
 
-std::wstring message::content_type()
+bool field_list::find(const std::wstring &name, boost::string_ref &value) const
 {
-	std::wstring value = header[L"Content-Type"];
+	/* Имена полей почти всегда - короткие ascii-строки:
+		переводим без выделения памяти */
+	char buf[64];
+	std::size_t i = 0;
 
-	value = value.substr(0, value.find_first_of(L';'));
+	for (; i < name.size() && i < sizeof(buf) - 1; i++)
+	{
+		if ((unsigned int)name[i] >= 0x80)
+			break;
+		buf[i] = (char)name[i];
+	}
 
-	if (value.empty())
-		value = L"text/plain"; /* Так требует RFC! */
+	if (i == name.size())
+	{
+		buf[i] = 0;
+		return find(buf, value);
+	}
 
-	return value;
+	return find(my::utf8::encode(name).c_str(), value);
 }
 
-void message::to_xml(::xml::ptree &pt)
+void field_list::to_map(std::map<std::wstring, std::wstring> &map) const
 {
-	std::istringstream ss(body);
-	my::xml::parse(ss, pt);
+	for (std::size_t i = 0; i < entries_.size(); i++)
+	{
+		boost::string_ref n = name(i);
+		boost::string_ref v = value(i);
+		map[ my::utf8::decode(n.data(), n.size()) ] = my::utf8::decode(v.data(), v.size());
+	}
 }
 
-void message::to_xml(::xml::wptree &pt)
+/* Есть ли в списке через запятую значение token (без учёта регистра) */
+static bool has_token(const boost::string_ref &list, const char *token)
 {
-	std::wistringstream ss( my::utf8::decode(body) );
-	my::xml::parse(ss, pt);
+	const boost::string_ref key(token);
+	const char *ptr = list.data();
+	const char *end = ptr + list.size();
+
+	while (ptr != end)
+	{
+		while (ptr != end && (*ptr == ' ' || *ptr == '\t' || *ptr == ','))
+			++ptr;
+
+		const char *item = ptr;
+		while (ptr != end && *ptr != ',')
+			++ptr;
+
+		const char *item_end = ptr;
+		while (item_end != item && (item_end[-1] == ' ' || item_end[-1] == '\t'))
+			--item_end;
+
+		if (item != item_end
+			&& my::str::iequals(boost::string_ref(item, item_end - item), key))
+			return true;
+	}
+
+	return false;
 }
 
-void message::save(const std::wstring &filename)
+bool parser::keep_alive() const
 {
-	fs::create_directories( fs::wpath(filename).parent_path() );
+	const boost::string_ref *value = find("Connection");
 
-	fs::ofstream fs(filename, std::ios::binary);
-	if (fs)
-		fs << body << std::flush;
+	if (value)
+	{
+		if (has_token(*value, "close"))
+			return false;
+		if (has_token(*value, "keep-alive"))
+			return true;
+	}
 
-	if (!fs)
-		throw my::exception(L"Не удалось сохранить данные в файл")
-			<< my::param(L"file", filename)
-			<< my::param(L"error", strerror(errno));
+	return minor_version >= 1;
 }
 
-void reply::read_reply(tcp::socket &socket)
+/* Разбор url[?key[=value]&...] - до пробела или конца строки.
+	ptr - на символе, на котором остановился разбор */
+static bool parse_url(const char *&ptr, const char *end,
+	std::string &url, params_type &params)
 {
-	std::size_t n = asio::read_until(socket, buf_, "\r\n");
+	const char *url_end = ptr;
+	while (url_end != end && *url_end != ' '
+		&& *url_end != '?' && *url_end != '&')
+		++url_end;
 
-	reply_.resize(n);
-	buf_.sgetn((char*)reply_.c_str(), n);
+	if (url_end == ptr)
+		return false;
 
-	std::string status_message_s;
-	status_code = parse_reply(reply_, status_message_s);
+	url.assign(ptr, url_end);
+	ptr = url_end;
+
+	bool res = true;
+
+	if (ptr != end && *ptr == '?')
+	{
+		params_type params_s;
+
+		do
+		{
+			const char *key = ++ptr;
+			while (ptr != end && *ptr != ' ' && *ptr != '&' && *ptr != '=')
+				++ptr;
+
+			const char *key_end = ptr;
+			const char *value = ptr;
+
+			if (ptr != end && *ptr == '=')
+			{
+				value = ++ptr;
+				while (ptr != end && *ptr != ' ' && *ptr != '&')
+					++ptr;
+			}
 
-	status_message = my::utf8::decode( percent_decode(status_message_s) );
+			/* Ключ - обязательно, значение после '=' - тоже */
+			res = (key != key_end && (value == key_end || value != ptr));
+			params_s.push_back( param_type(std::string(key, key_end),
+				std::string(value, ptr)) );
+		}
+		while (res && ptr != end && *ptr == '&');
+
+		if (res)
+			params.swap(params_s);
+	}
+
+	return res;
 }
 
-void reply::get(tcp::socket &socket,
-	const std::string &request, bool do_read_body)
+void parse_request(const std::string &line,
+	std::string &url, params_type &params)
 {
-	asio::write(socket, asio::buffer(request), asio::transfer_all());
+	const char *begin = line.c_str();
+	const char *end = begin + line.size();
+	const char *ptr = begin;
+	bool res = false;
 
-	read_reply(socket);
-	read_header(socket);
+	/* GET url[?key[=value]&...] HTTP/1.1\r\n */
+	if (line.compare(0, 4, "GET ") == 0)
+	{
+		ptr += 4;
 
-	if (do_read_body)
-		read_body(socket);
+		res = parse_url(ptr, end, url, params)
+			&& end - ptr == 11
+			&& std::memcmp(ptr, " HTTP/1.1\r\n", 11) == 0;
+	}
+
+	if (!res)
+		throw my::exception(L"Не удалось разобрать HTTP-запрос")
+			<< my::param(L"http-request", my::str::to_wstring(line))
+			<< my::param(L"position", ptr - begin);
 }
 
-void request::read_request(tcp::socket &socket)
+unsigned int parse_reply(const std::string &line,
+	std::string &status_message)
 {
-	std::size_t n = asio::read_until(socket, buf_, "\r\n");
+	const char *begin = line.c_str();
+	const char *end = begin + line.size();
+	const char *ptr = begin;
+	unsigned int status_code = 0;
+	bool res = false;
 
-	request_.resize(n);
-	buf_.sgetn((char*)request_.c_str(), n);
+	/* HTTP/1.1 код сообщение\r\n */
+	if (line.compare(0, 9, "HTTP/1.1 ") == 0)
+	{
+		ptr += 9;
+		ptr += my::num::get(ptr, end - ptr, status_code);
 
-	std::string url_s;
-	params_type params_s;
+		if (ptr != begin + 9 && ptr != end && *ptr == ' ')
+		{
+			const char *message = ++ptr;
+			while (ptr != end && *ptr != '\r' && *ptr != '\n')
+				++ptr;
 
-	parse_request(request_, url_s, params_s);
+			res = (message != ptr && end - ptr == 2 && ptr[0] == '\r'
+				&& ptr[1] == '\n');
 
-	url = my::utf8::decode( percent_decode(url_s) );
+			if (res)
+				status_message.assign(message, ptr);
+		}
+	}
 
-	for (params_type::iterator iter = params_s.begin();
-		iter != params_s.end(); iter++)
+	if (!res)
+		throw my::exception(L"Не удалось разобрать HTTP-ответ")
+			<< my::param(L"http-reply", my::str::to_wstring(line))
+			<< my::param(L"position", ptr - begin);
+
+	return status_code;
+}
+
+void parse_header(const std::string &lines, params_type &params)
+{
+	const char *begin = lines.c_str();
+	const char *end = begin + lines.size();
+
+	std::vector<header_field> fields;
+	const char *ptr = parse_fields(begin, end, fields);
+
+	/* После заголовка ничего быть не должно */
+	if (ptr != end)
+		throw_header_error(begin, ptr);
+
+	for (std::vector<header_field>::const_iterator iter = fields.begin();
+		iter != fields.end(); iter++)
+		params.push_back( param_type(iter->name.to_string(), iter->value.to_string()) );
+}
+
+#if MY_NUM_SIMD
+/* Обёртки над векторными инструкциями - одинаковый код для SSE2/AVX2 */
+#if MY_NUM_SIMD == 32
+typedef __m256i simd_vector;
+static const unsigned int simd_all = 0xFFFFFFFFu;
+
+inline simd_vector simd_load(const char *ptr)
+	{ return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr)); }
+inline void simd_store(char *ptr, simd_vector x)
+	{ _mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr), x); }
+inline simd_vector simd_set1(char ch)
+	{ return _mm256_set1_epi8(ch); }
+inline simd_vector simd_gt(simd_vector a, simd_vector b)
+	{ return _mm256_cmpgt_epi8(a, b); }
+inline simd_vector simd_eq(simd_vector a, simd_vector b)
+	{ return _mm256_cmpeq_epi8(a, b); }
+inline unsigned int simd_mask(simd_vector x)
+	{ return static_cast<unsigned int>(_mm256_movemask_epi8(x)); }
+#else
+typedef __m128i simd_vector;
+static const unsigned int simd_all = 0xFFFFu;
+
+inline simd_vector simd_load(const char *ptr)
+	{ return _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)); }
+inline void simd_store(char *ptr, simd_vector x)
+	{ _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr), x); }
+inline simd_vector simd_set1(char ch)
+	{ return _mm_set1_epi8(ch); }
+inline simd_vector simd_gt(simd_vector a, simd_vector b)
+	{ return _mm_cmpgt_epi8(a, b); }
+inline simd_vector simd_eq(simd_vector a, simd_vector b)
+	{ return _mm_cmpeq_epi8(a, b); }
+inline unsigned int simd_mask(simd_vector x)
+	{ return static_cast<unsigned int>(_mm_movemask_epi8(x)); }
+#endif
+#endif /* MY_NUM_SIMD */
+
+/* Значения hex-цифр (X - не цифра) */
+#define X 0xFF
+static const unsigned char hex_values[256] =
+{
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, X, X, X, X, X, X,
+	X, 10, 11, 12, 13, 14, 15, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, 10, 11, 12, 13, 14, 15, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X
+};
+#undef X
+
+/* Декодирование [ptr, end) в out. out может совпадать с ptr (на месте):
+	запись никогда не обгоняет чтение. Возврат: конец результата */
+static char* percent_decode_to(char *out, const char *ptr, const char *end)
+{
+	while (ptr != end)
 	{
-		params[ my::utf8::decode( percent_decode(iter->first) ) ]
-			= my::utf8::decode( percent_decode(iter->second) );
+		/* Символы до '%' - копируем целиком (поиск - векторный) */
+		const char *pct = my::num::find_delim(ptr, end, '%');
+
+		if (out != ptr)
+			std::memmove(out, ptr, pct - ptr);
+		out += pct - ptr;
+		ptr = pct;
+
+		if (end - ptr < 3)
+			break;
+
+		unsigned char hi = hex_values[ (unsigned char)ptr[1] ];
+		unsigned char lo = hex_values[ (unsigned char)ptr[2] ];
+
+		/* Неверная последовательность - конец разбора */
+		if ((hi | lo) & 0xF0)
+			break;
+
+		*out++ = (char)((hi << 4) | lo);
+		ptr += 3;
 	}
+
+	return out;
+}
+
+std::string percent_decode(const char *str, int len)
+{
+	if (len < 0)
+		len = my::str::length(str);
+
+	std::string out;
+	percent_decode_append(str, len, out);
+
+	return out;
+}
+
+void percent_decode_append(const char *str, std::size_t len,
+	std::string &out)
+{
+	/* Декодированная строка никогда не длиннее исходной */
+	std::size_t size = out.size();
+	out.resize(size + len);
+
+	char *begin_out = (char*)out.c_str();
+	char *end_out = percent_decode_to(begin_out + size, str, str + len);
+
+	out.resize(end_out - begin_out);
+}
+
+std::size_t percent_decode_inplace(char *str, std::size_t len)
+{
+	return percent_decode_to(str, str, str + len) - str;
+}
+
+/* Очередной байт с учётом %XX. Возврат: false - конец строки
+	или неверная последовательность */
+inline bool next_decoded(const char *&ptr, const char *end,
+	unsigned char &ch)
+{
+	if (ptr == end)
+		return false;
+
+	if (*ptr != '%')
+	{
+		ch = (unsigned char)*ptr++;
+		return true;
+	}
+
+	if (end - ptr < 3)
+		return false;
+
+	unsigned char hi = hex_values[ (unsigned char)ptr[1] ];
+	unsigned char lo = hex_values[ (unsigned char)ptr[2] ];
+
+	if ((hi | lo) & 0xF0)
+		return false;
+
+	ch = (unsigned char)((hi << 4) | lo);
+	ptr += 3;
+
+	return true;
+}
+
+void percent_decode_append(const char *str, std::size_t len,
+	std::wstring &out)
+{
+	/* Первый байт UTF-8: поправка по кол-ву продолжающих байт */
+	static const wchar_t lead_modifier[6] =
+		{ 0x00, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC };
+
+	const char *ptr = str;
+	const char *end = str + len;
+
+	/* Символов никогда не больше, чем байт */
+	std::size_t size = out.size();
+	out.resize(size + len);
+
+	wchar_t *begin_out = (wchar_t*)out.c_str();
+	wchar_t *ptr_out = begin_out + size;
+	unsigned char ch;
+
+	/* Правила разбора UTF-8 - те же, что и в my::utf8 (boost
+		utf8_codecvt_facet): на первой ошибке или неполном символе
+		в конце разбор прекращается */
+	while (next_decoded(ptr, end, ch))
+	{
+		if (ch < 0x80)
+		{
+			*ptr_out++ = ch;
+			continue;
+		}
+
+		if (ch < 0xC0 || ch > 0xFD)
+			break;
+
+		int count = (ch < 0xE0 ? 1 : ch < 0xF0 ? 2 : ch < 0xF8 ? 3
+			: ch < 0xFC ? 4 : 5);
+		wchar_t wch = ch - lead_modifier[count];
+		int i = 0;
+
+		for (; i < count; i++)
+		{
+			if (!next_decoded(ptr, end, ch) || (ch & 0xC0) != 0x80)
+				break;
+
+			wch = wch * (1 << 6) + (ch - 0x80);
+		}
+
+		if (i != count)
+			break;
+
+		*ptr_out++ = wch;
+	}
+
+	out.resize(ptr_out - begin_out);
+}
+
+escape_set::escape_set(const char *escape_symbols)
+	: symbols_count_(0)
+{
+	/* Управляющие символы, пробел и не ascii-символы (>127) */
+	for (unsigned int ch = 0; ch < 256; ch++)
+		table_[ch] = (ch <= 32 || ch > 127);
+
+	if (!escape_symbols)
+		return;
+
+	for (; *escape_symbols; escape_symbols++)
+	{
+		unsigned char ch = (unsigned char)*escape_symbols;
+
+		if (table_[ch])
+			continue;
+
+		table_[ch] = 1;
+
+		if (symbols_count_ < max_symbols)
+			symbols_[symbols_count_] = (char)ch;
+		symbols_count_++;
+	}
+}
+
+/* Кодирование по умолчанию - без заказанных символов */
+static const escape_set default_escape;
+
+/* Вывод символа - как есть или %xx */
+inline char* put_escaped(char *out, char ch, const escape_set &escape)
+{
+	static const char hex[16] =
+	{
+		'0', '1', '2', '3', '4', '5', '6', '7',
+		'8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+	};
+
+	unsigned char uch = (unsigned char)ch;
+
+	if (!escape(uch))
+	{
+		*out = ch;
+		return out + 1;
+	}
+
+	out[0] = '%';
+	out[1] = hex[uch >> 4];
+	out[2] = hex[uch & 0xf];
+
+	return out + 3;
+}
+
+std::string percent_encode(const char *str, std::size_t len,
+	const escape_set &escape)
+{
+	const char *ptr_in = str;
+	/* Строка может содержать нулевой символ, поэтому
+		пользуемся размером исходной строки */
+	const char *end_in = ptr_in + len;
+
+	/* Сразу готовим буфер */
+	std::string out(len * 3, ' ');
+	char *begin_out = (char*)out.c_str();
+	char *ptr_out = begin_out;
+
+#if MY_NUM_SIMD
+	/* Векторный путь: "безопасные" символы (33..127, кроме заказанных)
+		копируются сразу по 16/32. Места в буфере хватает всегда:
+		на каждый оставшийся символ - по 3 байта */
+	const std::size_t symbols_count = escape.symbols_count();
+
+	if (symbols_count <= escape_set::max_symbols)
+	{
+		const std::size_t width = sizeof(simd_vector);
+
+		/* Сравнение со знаком: 33..127 - больше 32, >127 - отрицательные */
+		const simd_vector space = simd_set1(32);
+		simd_vector symbols[escape_set::max_symbols];
+
+		for (std::size_t i = 0; i < symbols_count; i++)
+			symbols[i] = simd_set1(escape.symbols()[i]);
+
+		while ((std::size_t)(end_in - ptr_in) >= width)
+		{
+			simd_vector x = simd_load(ptr_in);
+			unsigned int mask = simd_mask( simd_gt(x, space) );
+
+			for (std::size_t i = 0; i < symbols_count; i++)
+				mask &= ~simd_mask( simd_eq(x, symbols[i]) );
+
+			simd_store(ptr_out, x);
+
+			if (mask == simd_all)
+			{
+				ptr_in += width;
+				ptr_out += width;
+				continue;
+			}
+
+			/* Безопасное начало уже скопировано, остаток блока - по
+				таблице (иначе на данных, где кодировать нужно почти всё,
+				векторная проверка была бы на каждый символ) */
+			const char *block_end = ptr_in + width;
+			std::size_t n = my::num::lowest_bit(~mask);
+			ptr_in += n;
+			ptr_out += n;
+
+			while (ptr_in != block_end)
+			{
+				ptr_out = put_escaped(ptr_out, *ptr_in++, escape);
+			}
+		}
+	}
+#endif
+
+	while (ptr_in != end_in)
+	{
+		ptr_out = put_escaped(ptr_out, *ptr_in++, escape);
+	}
+
+	out.resize(ptr_out - begin_out);
+
+	return out;
+}
+
+std::string percent_encode(const char *str,
+	const char *escape_symbols, int len)
+{
+	if (len < 0)
+		len = my::str::length(str);
+
+	if (!escape_symbols)
+		return percent_encode(str, len, default_escape);
+
+	return percent_encode(str, len, escape_set(escape_symbols));
+}
+
+
+void body_reader::reset(framing_type framing, unsigned long long length)
+{
+	framing_ = framing;
+	left_ = (framing == content_length ? length : 0);
+	has_digits_ = false;
+
+	switch (framing)
+	{
+		case content_length:
+			state_ = (length ? data_state : done_state);
+			break;
+
+		case chunked:
+			state_ = size_state;
+			break;
+
+		default:
+			state_ = data_state;
+	}
+}
+
+void body_reader::throw_error(const char *ptr, const char *data)
+{
+	throw my::exception(L"Ошибка в теле HTTP-сообщения (chunked)")
+		<< my::param(L"position", ptr - data);
+}
+
+std::size_t body_reader::parse(const char *data, std::size_t size,
+	const body_handler &handler)
+{
+	const char *ptr = data;
+	const char *end = data + size;
+
+	while (ptr != end && state_ != done_state)
+	{
+		/* Данные - сразу всем куском */
+		if (state_ == data_state)
+		{
+			std::size_t n = end - ptr;
+			if (framing_ != until_eof && n > left_)
+				n = static_cast<std::size_t>(left_);
+
+			if (handler)
+				handler(ptr, n);
+			ptr += n;
+
+			if (framing_ != until_eof && (left_ -= n) == 0)
+				state_ = (framing_ == chunked ? data_cr_state : done_state);
+
+			continue;
+		}
+
+		/* Служебные данные chunked - по одному символу */
+		char ch = *ptr++;
+
+		switch (state_)
+		{
+			case size_state:
+			{
+				unsigned int d;
+				if (ch >= '0' && ch <= '9')
+					d = ch - '0';
+				else if ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'f')
+					d = (ch | 0x20) - 'a' + 10;
+				else if (has_digits_)
+				{
+					/* Расширения (";name=value") и пробелы - пропускаем */
+					state_ = ext_state;
+					--ptr;
+					break;
+				}
+				else
+					throw_error(ptr - 1, data);
+
+				if (left_ >> 60)
+					throw_error(ptr - 1, data);
+
+				left_ = (left_ << 4) | d;
+				has_digits_ = true;
+				break;
+			}
+
+			case ext_state:
+				if (ch == '\n')
+				{
+					has_digits_ = false;
+					state_ = (left_ ? data_state : trailer_state);
+				}
+				break;
+
+			case data_cr_state:
+				if (ch == '\r')
+				{
+					state_ = data_lf_state;
+					break;
+				}
+				/* Допускаем и одиночный '\n' */
+
+			case data_lf_state:
+				if (ch != '\n')
+					throw_error(ptr - 1, data);
+				state_ = size_state;
+				break;
+
+			case trailer_state:
+				if (ch == '\n')
+					state_ = done_state;
+				else
+					state_ = (ch == '\r' ? trailer_lf_state : trailer_line_state);
+				break;
+
+			case trailer_line_state:
+				if (ch == '\n')
+					state_ = trailer_state;
+				break;
+
+			case trailer_lf_state:
+				if (ch != '\n')
+					throw_error(ptr - 1, data);
+				state_ = done_state;
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return ptr - data;
+}
+
+void body_reader::eof()
+{
+	if (framing_ == until_eof)
+		state_ = done_state;
+	else if (state_ != done_state)
+		throw my::exception(L"Соединение закрыто до окончания тела HTTP-сообщения")
+			<< my::param(L"left", left_);
+}
+
+void message::read_header(tcp::socket &socket)
+{
+	/* Дочитываем, пока не получим заголовок целиком - поиск конца
+		каждый раз продолжается с того же места */
+	const std::size_t max_header_size = 65536;
+	std::size_t scanned = 0;
+	std::size_t n;
+
+	while ( !(n = find_header_end(asio::buffer_cast<const char*>(buf_.data()),
+		buf_.size(), scanned)) )
+	{
+		if (buf_.size() > max_header_size)
+			throw my::exception(L"Слишком большой HTTP-заголовок")
+				<< my::param(L"size", buf_.size());
+
+		buf_.commit( socket.read_some(buf_.prepare(4096)) );
+	}
+
+	header_.resize(n);
+	buf_.sgetn((char*)header_.c_str(), n);
+
+	std::vector<header_field> fields_s;
+	parse_fields(header_.c_str(), header_.c_str() + n, fields_s);
+	fields_to_list(fields_s, fields);
+
+	if (fill_maps)
+		fields_to_map(fields_s, header);
+}
+
+/* Добавление порции тела к строке */
+static void append_body(std::string *body, const char *data, std::size_t size)
+{
+	body->append(data, size);
+}
+
+void message::read_body(tcp::socket &socket)
+{
+	unsigned long long length = 0;
+
+	body.clear();
+
+	/* Память - сразу, но не верим длине больше 16 Мб */
+	if (body_framing(length) == body_reader::content_length
+		&& length <= 0x1000000)
+		body.reserve(static_cast<std::size_t>(length));
+
+	read_body(socket, boost::bind(append_body, &body, _1, _2));
+}
+
+/* Чтение тела: сначала из буфера, затем, если нужно, из сокета */
+static void read_body(tcp::socket &socket, asio::streambuf &buf,
+	body_reader &reader, const body_handler &handler)
+{
+	/* Размер порции чтения из сокета */
+	const std::size_t read_size = 65536;
+
+	while (true)
+	{
+		/* Сначала - то, что уже прочитано вместе с заголовком */
+		if (buf.size())
+			buf.consume( reader.parse(
+				asio::buffer_cast<const char*>(buf.data()),
+				buf.size(), handler) );
+
+		if (reader.done())
+			break;
+
+		boost::system::error_code ec;
+		std::size_t n = socket.read_some(buf.prepare(read_size), ec);
+		buf.commit(n);
+
+		if (ec)
+		{
+			/* Тело без длины заканчивается вместе с соединением -
+				здесь чтение всегда заканчивается ошибкой */
+			if (reader.framing() == body_reader::until_eof)
+			{
+				reader.eof();
+				break;
+			}
+
+			if (ec == asio::error::eof)
+				reader.eof(); /* Исключение */
+
+			throw boost::system::system_error(ec);
+		}
+	}
+}
+
+void message::read_body(tcp::socket &socket, const body_handler &handler)
+{
+	unsigned long long length = 0;
+	body_reader::framing_type framing = body_framing(length);
+
+	body_reader reader;
+	reader.reset(framing, length);
+
+	my::http::read_body(socket, buf_, reader, handler);
+}
+
+/* Файл для save_body. Под Linux - запись без буферизации (данные
+	и так приходят большими порциями), в остальных случаях - ofstream */
+class body_file : boost::noncopyable
+{
+public:
+	explicit body_file(const std::wstring &filename)
+		: filename_(filename)
+	{
+		fs::create_directories( fs::path(filename).parent_path() );
+
+#if MY_HTTP_SPLICE
+		fd_ = ::open(fs::path(filename).c_str(),
+			O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd_ < 0)
+#else
+		fs_.open(fs::path(filename), std::ios::binary);
+		if (!fs_)
+#endif
+			throw_error();
+	}
+
+	~body_file()
+	{
+#if MY_HTTP_SPLICE
+		::close(fd_);
+#endif
+	}
+
+	void write(const char *data, std::size_t size)
+	{
+#if MY_HTTP_SPLICE
+		while (size)
+		{
+			ssize_t n = ::write(fd_, data, size);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				throw_error();
+
+			data += n;
+			size -= n;
+		}
+#else
+		if (!fs_.write(data, size))
+			throw_error();
+#endif
+	}
+
+#if MY_HTTP_SPLICE
+	int fd() const
+		{ return fd_; }
+#else
+	void flush()
+	{
+		if (!fs_.flush())
+			throw_error();
+	}
+#endif
+
+	void throw_error()
+	{
+		throw my::exception(L"Не удалось сохранить данные в файл")
+			<< my::param(L"file", filename_)
+			<< my::param(L"error", strerror(errno));
+	}
+
+private:
+	std::wstring filename_;
+#if MY_HTTP_SPLICE
+	int fd_;
+#else
+	fs::ofstream fs_;
+#endif
+};
+
+#if MY_HTTP_SPLICE
+/* Канал для splice */
+struct splice_pipe : boost::noncopyable
+{
+	int fd[2];
+
+	splice_pipe()
+	{
+		if (::pipe(fd) != 0)
+			throw boost::system::system_error(errno,
+				boost::system::system_category());
+	}
+
+	~splice_pipe()
+	{
+		::close(fd[0]);
+		::close(fd[1]);
+	}
+};
+
+/* Перенос length байт из сокета в файл: сокет -> канал -> файл.
+	Возврат: false - splice для этой пары не поддерживается (ещё
+	ничего не перенесено, можно читать обычным образом) */
+static bool splice_body(tcp::socket &socket, body_file &file,
+	unsigned long long length)
+{
+	const std::size_t max_size = 65536;
+	const int fd = socket.native_handle();
+	splice_pipe pipe;
+	bool first = true;
+
+	while (length)
+	{
+		ssize_t n = ::splice(fd, 0, pipe.fd[1], 0,
+			static_cast<std::size_t>(std::min<unsigned long long>(length, max_size)),
+			SPLICE_F_MOVE | SPLICE_F_MORE);
+
+		if (n == 0)
+			throw my::exception(L"Соединение закрыто до окончания тела HTTP-сообщения")
+				<< my::param(L"left", length);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			/* После асинхронных операций сокет - неблокирующий */
+			if (errno == EAGAIN)
+			{
+				pollfd pfd = { fd, POLLIN, 0 };
+				::poll(&pfd, 1, -1);
+				continue;
+			}
+
+			if (first && (errno == EINVAL || errno == ENOSYS))
+				return false;
+
+			throw boost::system::system_error(errno,
+				boost::system::system_category());
+		}
+
+		first = false;
+		length -= n;
+
+		while (n)
+		{
+			ssize_t m = ::splice(pipe.fd[0], 0, file.fd(), 0, n,
+				SPLICE_F_MOVE | SPLICE_F_MORE);
+
+			if (m < 0 && errno == EINTR)
+				continue;
+			if (m <= 0)
+				file.throw_error();
+
+			n -= m;
+		}
+	}
+
+	return true;
+}
+#endif
+
+void message::save_body(tcp::socket &socket, const std::wstring &filename)
+{
+	unsigned long long length = 0;
+	body_reader::framing_type framing = body_framing(length);
+
+	body_file file(filename);
+
+#if MY_HTTP_SPLICE
+	if (framing == body_reader::content_length)
+	{
+		/* То, что уже прочитано вместе с заголовком */
+		std::size_t n = static_cast<std::size_t>(
+			std::min<unsigned long long>(buf_.size(), length));
+
+		file.write(asio::buffer_cast<const char*>(buf_.data()), n);
+		buf_.consume(n);
+		length -= n;
+
+		if (splice_body(socket, file, length))
+			return;
+	}
+#endif
+
+	body_reader reader;
+	reader.reset(framing, length);
+
+	my::http::read_body(socket, buf_, reader,
+		boost::bind(&body_file::write, &file, _1, _2));
+
+#if !MY_HTTP_SPLICE
+	file.flush();
+#endif
+}
+
+const std::wstring* message::find_header(const std::wstring &name) const
+{
+	std::map<std::wstring, std::wstring>::const_iterator iter
+		= header.find(name);
+
+	if (iter != header.end())
+		return &iter->second;
+
+	for (iter = header.begin(); iter != header.end(); iter++)
+		if (boost::algorithm::iequals(iter->first, name))
+			return &iter->second;
+
+	return 0;
+}
+
+body_reader::framing_type message::body_framing(
+	unsigned long long &length) const
+{
+	body_reader::framing_type framing;
+
+	/* Прочитанное сообщение - по fields, собранное вручную - по header */
+	if (!fields.empty())
+	{
+		boost::string_ref te, cl;
+		bool has_te = fields.find("Transfer-Encoding", te);
+		bool has_cl = fields.find("Content-Length", cl);
+
+		if (!get_framing(has_te ? te.data() : 0, te.size(),
+			has_cl ? cl.data() : 0, cl.size(), framing, length))
+			throw my::exception(L"Неверное значение Content-Length")
+				<< my::param(L"Content-Length", my::str::to_wstring(cl.to_string()));
+
+		return framing;
+	}
+
+	const std::wstring *te = find_header(L"Transfer-Encoding");
+	const std::wstring *cl = find_header(L"Content-Length");
+
+	if (!get_framing(te ? te->c_str() : 0, te ? te->size() : 0,
+		cl ? cl->c_str() : 0, cl ? cl->size() : 0, framing, length))
+		throw my::exception(L"Неверное значение Content-Length")
+			<< my::param(L"Content-Length", *cl);
+
+	return framing;
+}
+
+std::wstring message::content_type() const
+{
+	std::wstring value;
+	boost::string_ref field;
+
+	/* Без вставки пустого поля в header */
+	if (fields.find("Content-Type", field))
+		value = my::utf8::decode(field.data(), field.size());
+	else if (const std::wstring *ptr = find_header(L"Content-Type"))
+		value = *ptr;
+
+	value = value.substr(0, value.find_first_of(L';'));
+
+	if (value.empty())
+		value = L"text/plain"; /* Так требует RFC! */
+
+	return value;
+}
+
+/* Прямо из body - без копий тела и потоков */
+void message::to_xml(::xml::ptree &pt)
+{
+	my::xml::parse_utf8(body, pt);
+}
+
+void message::to_xml(::xml::wptree &pt)
+{
+	my::xml::parse_utf8(body, pt);
+}
+
+void message::save(const std::wstring &filename)
+{
+	fs::create_directories( fs::wpath(filename).parent_path() );
+
+	fs::ofstream fs(filename, std::ios::binary);
+	if (fs)
+		fs << body << std::flush;
+
+	if (!fs)
+		throw my::exception(L"Не удалось сохранить данные в файл")
+			<< my::param(L"file", filename)
+			<< my::param(L"error", strerror(errno));
+}
+
+void reply::read_reply(tcp::socket &socket)
+{
+	std::size_t n = asio::read_until(socket, buf_, "\r\n");
+
+	reply_.resize(n);
+	buf_.sgetn((char*)reply_.c_str(), n);
+
+	std::string status_message_s;
+	status_code = parse_reply(reply_, status_message_s);
+
+	status_message.clear();
+	percent_decode_append(status_message_s.c_str(), status_message_s.size(),
+		status_message);
+}
+
+void reply::get(tcp::socket &socket,
+	const std::string &request, bool do_read_body)
+{
+	asio::write(socket, asio::buffer(request), asio::transfer_all());
+
+	read_reply(socket);
+	read_header(socket);
+
+	/* У ответов 1xx, 204 и 304 тела нет */
+	if (do_read_body && status_code / 100 != 1
+		&& status_code != 204 && status_code != 304)
+		read_body(socket);
+}
+
+struct reply::mapped_file
+{
+	boost::interprocess::file_mapping file;
+	boost::interprocess::mapped_region region;
+};
+
+void reply::send_file(const std::wstring &filename)
+{
+	body.clear();
+	body_file_.reset();
+
+	try
+	{
+		/* Пустой файл отобразить нельзя - да и незачем */
+		if (fs::file_size(filename) == 0)
+			return;
+
+		boost::shared_ptr<mapped_file> file(new mapped_file);
+
+		boost::interprocess::file_mapping(fs::path(filename).string().c_str(),
+			boost::interprocess::read_only).swap(file->file);
+		boost::interprocess::mapped_region(file->file,
+			boost::interprocess::read_only).swap(file->region);
+
+		body_file_ = file;
+	}
+	catch (std::exception &e)
+	{
+		throw my::exception(L"Не удалось открыть файл")
+			<< my::param(L"file", filename)
+			<< e;
+	}
+}
+
+boost::string_ref reply::body_ref() const
+{
+	if (body_file_)
+		return boost::string_ref(
+			static_cast<const char*>(body_file_->region.get_address()),
+			body_file_->region.get_size());
+
+	return boost::string_ref(body.c_str(), body.size());
+}
+
+/* Декодирование url и params запроса */
+static void set_url(request &req, const std::string &url_s,
+	const params_type &params_s)
+{
+	req.url.clear();
+	percent_decode_append(url_s.c_str(), url_s.size(), req.url);
+	req.params.clear();
+	req.query.clear();
+
+	std::wstring key;
+
+	for (params_type::const_iterator iter = params_s.begin();
+		iter != params_s.end(); iter++)
+	{
+		req.query.add_decoded(iter->first.c_str(), iter->first.size(),
+			iter->second.c_str(), iter->second.size());
+
+		if (req.fill_maps)
+			decode_pair(req.params, key, iter->first.c_str(), iter->first.size(),
+				iter->second.c_str(), iter->second.size());
+	}
+}
+
+/* Разбор url[?key[=value]&...] (как parse_request) с декодированием
+	прямо из буфера - без промежуточных строк */
+static bool decode_url(const char *ptr, const char *end, request &req)
+{
+	const char *url_end = ptr;
+	while (url_end != end && *url_end != '?' && *url_end != '&')
+		++url_end;
+
+	if (url_end == ptr)
+		return false;
+
+	req.url.clear();
+	percent_decode_append(ptr, url_end - ptr, req.url);
+	req.params.clear();
+	req.query.clear();
+
+	ptr = url_end;
+	if (ptr == end)
+		return true;
+
+	if (*ptr != '?')
+		return false;
+
+	std::wstring key;
+
+	do
+	{
+		const char *key_begin = ++ptr;
+		while (ptr != end && *ptr != '&' && *ptr != '=')
+			++ptr;
+
+		const char *key_end = ptr;
+		const char *value = ptr;
+
+		if (ptr != end && *ptr == '=')
+		{
+			value = ++ptr;
+			while (ptr != end && *ptr != '&')
+				++ptr;
+		}
+
+		/* Ключ - обязательно, значение после '=' - тоже */
+		if (key_begin == key_end || (value != key_end && value == ptr))
+			return false;
+
+		req.query.add_decoded(key_begin, key_end - key_begin,
+			value, ptr - value);
+
+		if (req.fill_maps)
+			decode_pair(req.params, key, key_begin, key_end - key_begin,
+				value, ptr - value);
+	}
+	while (ptr != end && *ptr == '&');
+
+	return ptr == end;
+}
+
+void request::read_request(tcp::socket &socket)
+{
+	std::size_t n = asio::read_until(socket, buf_, "\r\n");
+
+	request_.resize(n);
+	buf_.sgetn((char*)request_.c_str(), n);
+
+	std::string url_s;
+	params_type params_s;
+
+	parse_request(request_, url_s, params_s);
+	set_url(*this, url_s, params_s);
+}
+
+body_reader::framing_type request::body_framing(
+	unsigned long long &length) const
+{
+	body_reader::framing_type framing = message::body_framing(length);
+
+	if (framing == body_reader::until_eof)
+	{
+		length = 0;
+		framing = body_reader::content_length;
+	}
+
+	return framing;
+}
+
+/* Заполнение ответа по разобранному заголовку (data, n) - так же,
+	как reply::read_reply и read_header */
+static void fill_reply(reply &rep, const parser &p,
+	const char *data, std::size_t n)
+{
+	const char *line_end = my::num::find_delim(data, data + n, '\n') + 1;
+
+	rep.reply_.assign(data, line_end);
+	rep.header_.assign(line_end, data + n);
+	rep.status_code = p.status_code;
+	rep.status_message.clear();
+	percent_decode_append(p.status_message.data(), p.status_message.size(),
+		rep.status_message);
+	p.to_fields(rep.fields);
+	rep.header.clear();
+	if (rep.fill_maps)
+		p.to_map(rep.header);
+	rep.body.clear();
+}
+
+/* io_service сокета (get_io_service() в новых версиях Boost нет) */
+static asio::io_service& get_io_service(tcp::socket &socket)
+{
+#if BOOST_VERSION >= 106600
+	return static_cast<asio::io_service&>(socket.get_executor().context());
+#else
+	return socket.get_io_service();
+#endif
+}
+
+/*
+	Асинхронная операция: отправка запроса (для async_get), чтение
+	заголовка и тела. Живёт, пока на неё ссылаются обработчики.
+	Все обработчики (в т.ч. таймера) - через strand, поэтому
+	io_service может работать в нескольких потоках
+*/
+class async_operation
+	: public boost::enable_shared_from_this<async_operation>
+{
+public:
+	async_operation(tcp::socket &socket, message &msg, reply *rep,
+		request *req, const async_handler &handler)
+		: socket_(socket)
+		, msg_(msg)
+		, rep_(rep)
+		, req_(req)
+		, handler_(handler)
+		, strand_(get_io_service(socket))
+		, timer_(get_io_service(socket))
+		, head_(false)
+		, timed_out_(false)
+		, finished_(false) {}
+
+	void start(const std::string *request,
+		const boost::posix_time::time_duration &timeout)
+	{
+		if (request)
+		{
+			request_ = *request;
+			head_ = (request_.compare(0, 5, "HEAD ") == 0);
+		}
+
+		timeout_ = timeout;
+		strand_.dispatch( boost::bind(&async_operation::run,
+			shared_from_this()) );
+	}
+
+private:
+	tcp::socket &socket_;
+	message &msg_;
+	reply *rep_;   /* Для async_get */
+	request *req_; /* Для async_read_request */
+	async_handler handler_;
+	asio::io_service::strand strand_;
+	asio::deadline_timer timer_;
+	boost::posix_time::time_duration timeout_;
+	std::string request_;
+	parser parser_;
+	body_reader reader_;
+	bool head_;
+	bool timed_out_;
+	bool finished_;
+
+	void run()
+	{
+		if (!timeout_.is_special())
+		{
+			timer_.expires_from_now(timeout_);
+			timer_.async_wait( strand_.wrap( boost::bind(
+				&async_operation::on_timeout, shared_from_this(),
+				asio::placeholders::error) ) );
+		}
+
+		if (rep_)
+			asio::async_write(socket_, asio::buffer(request_),
+				strand_.wrap( boost::bind(&async_operation::on_write,
+					shared_from_this(), asio::placeholders::error) ));
+		else
+			read_header();
+	}
+
+	void on_timeout(const boost::system::error_code &ec)
+	{
+		if (ec || finished_)
+			return;
+
+		/* Незавершённые операции с сокетом прервутся */
+		timed_out_ = true;
+		boost::system::error_code ignored;
+		socket_.close(ignored);
+	}
+
+	void on_write(const boost::system::error_code &ec)
+	{
+		if (ec)
+			finish(ec);
+		else
+			read_header();
+	}
+
+	void read_header()
+	{
+		asio::streambuf &buf = msg_.buf_;
+		const char *data = asio::buffer_cast<const char*>(buf.data());
+		std::size_t n;
+
+		try
+		{
+			n = (rep_ ? parser_.parse_reply(data, buf.size())
+				: parser_.parse_request(data, buf.size()));
+
+			if (!n)
+			{
+				if (buf.size() > 65536)
+				{
+					finish( boost::system::errc::make_error_code(
+						boost::system::errc::message_size) );
+					return;
+				}
+
+				socket_.async_read_some(buf.prepare(4096),
+					strand_.wrap( boost::bind(&async_operation::on_read_header,
+						shared_from_this(), asio::placeholders::error,
+						asio::placeholders::bytes_transferred) ));
+				return;
+			}
+
+			/* Промежуточные ответы (100 Continue) пропускаем */
+			if (rep_ && parser_.status_code / 100 == 1
+				&& parser_.status_code != 101)
+			{
+				buf.consume(n);
+				parser_.reset();
+				read_header();
+				return;
+			}
+
+			unsigned long long length = 0;
+			body_reader::framing_type framing
+				= parser_.body_framing(length, req_ != 0);
+
+			if (rep_)
+			{
+				fill_reply(*rep_, parser_, data, n);
+
+				/* У ответов на HEAD, 1xx, 204 и 304 тела нет */
+				if (head_ || parser_.status_code / 100 == 1
+					|| parser_.status_code == 204 || parser_.status_code == 304)
+				{
+					framing = body_reader::content_length;
+					length = 0;
+				}
+			}
+			else
+			{
+				const char *line_end
+					= my::num::find_delim(data, data + n, '\n') + 1;
+
+				req_->request_.assign(data, line_end);
+				req_->header_.assign(line_end, data + n);
+
+				/* Метод - любой (строку запроса уже проверил parser_) */
+				if (!decode_url(parser_.url.data(),
+					parser_.url.data() + parser_.url.size(), *req_))
+					throw my::exception(L"Не удалось разобрать HTTP-запрос")
+						<< my::param(L"http-request", my::str::to_wstring(req_->request_));
+				parser_.to_fields(req_->fields);
+				req_->header.clear();
+				if (req_->fill_maps)
+					parser_.to_map(req_->header);
+				req_->body.clear();
+			}
+
+			if (framing == body_reader::content_length && length <= 0x1000000)
+				msg_.body.reserve(static_cast<std::size_t>(length));
+
+			reader_.reset(framing, length);
+		}
+		catch (my::exception &)
+		{
+			finish( boost::system::errc::make_error_code(
+				boost::system::errc::protocol_error) );
+			return;
+		}
+
+		buf.consume(n);
+		read_body(false);
+	}
+
+	void on_read_header(const boost::system::error_code &ec, std::size_t n)
+	{
+		msg_.buf_.commit(n);
+
+		if (ec)
+			finish(ec);
+		else
+			read_header();
+	}
+
+	void read_body(bool eof)
+	{
+		asio::streambuf &buf = msg_.buf_;
+
+		try
+		{
+			if (buf.size())
+				buf.consume( reader_.parse(
+					asio::buffer_cast<const char*>(buf.data()), buf.size(),
+					boost::bind(append_body, &msg_.body, _1, _2)) );
+
+			/* Для until_eof - конец тела, иначе - исключение */
+			if (eof && !reader_.done())
+				reader_.eof();
+		}
+		catch (my::exception &)
+		{
+			finish( boost::system::errc::make_error_code(
+				boost::system::errc::protocol_error) );
+			return;
+		}
+
+		if (reader_.done())
+		{
+			finish( boost::system::error_code() );
+			return;
+		}
+
+		socket_.async_read_some(buf.prepare(65536),
+			strand_.wrap( boost::bind(&async_operation::on_read_body,
+				shared_from_this(), asio::placeholders::error,
+				asio::placeholders::bytes_transferred) ));
+	}
+
+	void on_read_body(const boost::system::error_code &ec, std::size_t n)
+	{
+		msg_.buf_.commit(n);
+
+		if (!ec)
+			read_body(false);
+		else if (ec == asio::error::eof)
+			read_body(true);
+		else
+			finish(ec);
+	}
+
+	void finish(boost::system::error_code ec)
+	{
+		if (finished_)
+			return;
+
+		finished_ = true;
+
+		boost::system::error_code ignored;
+		timer_.cancel(ignored);
+
+		if (ec && timed_out_)
+			ec = asio::error::timed_out;
+
+		if (handler_)
+			handler_(ec);
+	}
+};
+
+void async_get(tcp::socket &socket, const std::string &request,
+	reply &rep, const async_handler &handler,
+	const boost::posix_time::time_duration &timeout)
+{
+	boost::shared_ptr<async_operation> op(
+		new async_operation(socket, rep, &rep, 0, handler) );
+	op->start(&request, timeout);
+}
+
+void async_read_request(tcp::socket &socket, request &req,
+	const async_handler &handler,
+	const boost::posix_time::time_duration &timeout)
+{
+	boost::shared_ptr<async_operation> op(
+		new async_operation(socket, req, 0, &req, handler) );
+	op->start(0, timeout);
+}
+
+connection::connection(asio::io_service &io_service,
+	const tcp::endpoint &endpoint)
+	: socket_(io_service)
+	, endpoint_(endpoint)
+	, keep_alive_(true)
+	, replies_(0)
+{
+	socket_.connect(endpoint);
+
+	/* Запросы небольшие - отправляем сразу, без задержки Нейгла */
+	socket_.set_option(tcp::no_delay(true));
+}
+
+void connection::get(const std::string &request, reply &rep)
+{
+	asio::write(socket_, asio::buffer(request), asio::transfer_all());
+	read_reply(rep, request.compare(0, 5, "HEAD ") == 0);
+}
+
+void connection::get(const std::string *requests, reply *replies,
+	std::size_t count)
+{
+	/* Все запросы - одной записью */
+	std::vector<asio::const_buffer> buffers;
+	buffers.reserve(count);
+
+	for (std::size_t i = 0; i < count; i++)
+		buffers.push_back( asio::buffer(requests[i]) );
+
+	asio::write(socket_, buffers, asio::transfer_all());
+
+	for (std::size_t i = 0; i < count; i++)
+	{
+		if (!keep_alive_)
+			throw my::exception(L"Сервер закрыл соединение, не ответив на все запросы")
+				<< my::param(L"requests", count)
+				<< my::param(L"replies", i);
+
+		read_reply(replies[i], requests[i].compare(0, 5, "HEAD ") == 0);
+	}
+}
+
+void connection::read_reply(reply &rep, bool head)
+{
+	std::size_t n;
+
+	/* Промежуточные ответы (100 Continue) пропускаем */
+	do
+	{
+		parser_.reset();
+
+		while ( !(n = parser_.parse_reply(
+			asio::buffer_cast<const char*>(buf_.data()), buf_.size())) )
+		{
+			if (buf_.size() > 65536)
+				throw my::exception(L"Слишком большой HTTP-заголовок")
+					<< my::param(L"size", buf_.size());
+
+			buf_.commit( socket_.read_some(buf_.prepare(4096)) );
+		}
+
+		if (parser_.status_code / 100 == 1 && parser_.status_code != 101)
+			buf_.consume(n);
+	}
+	while (parser_.status_code / 100 == 1 && parser_.status_code != 101);
+
+	fill_reply(rep, parser_, asio::buffer_cast<const char*>(buf_.data()), n);
+
+	unsigned long long length = 0;
+	body_reader::framing_type framing = parser_.body_framing(length, false);
+
+	/* У ответов на HEAD, 1xx, 204 и 304 тела нет */
+	if (head || parser_.status_code / 100 == 1
+		|| parser_.status_code == 204 || parser_.status_code == 304)
+	{
+		framing = body_reader::content_length;
+		length = 0;
+	}
+
+	keep_alive_ = parser_.keep_alive() && framing != body_reader::until_eof;
+
+	/* Заголовок больше не нужен - ссылки parser_ дальше недействительны */
+	buf_.consume(n);
+
+	body_reader reader;
+	reader.reset(framing, length);
+
+	if (framing == body_reader::content_length && length <= 0x1000000)
+		rep.body.reserve(static_cast<std::size_t>(length));
+
+	my::http::read_body(socket_, buf_, reader,
+		boost::bind(append_body, &rep.body, _1, _2));
+
+	replies_++;
+}
+
+connection_pool::connection_ptr connection_pool::acquire(
+	const tcp::endpoint &endpoint)
+{
+	{
+		boost::unique_lock<boost::mutex> lock(mutex_);
+
+		idle_map::iterator iter = idle_.find(endpoint);
+		if (iter != idle_.end() && !iter->second.empty())
+		{
+			connection_ptr conn = iter->second.back();
+			iter->second.pop_back();
+			return conn;
+		}
+	}
+
+	/* Подключение - уже без блокировки */
+	return connection_ptr( new connection(io_service_, endpoint) );
+}
+
+void connection_pool::release(const connection_ptr &conn)
+{
+	if (!conn->keep_alive() || !conn->socket().is_open())
+		return;
+
+	boost::unique_lock<boost::mutex> lock(mutex_);
+
+	std::vector<connection_ptr> &idle = idle_[conn->endpoint()];
+	if (idle.size() < max_idle_)
+		idle.push_back(conn);
+}
+
+/* Идемпотентный запрос (RFC 7231, 4.2.2): повторное выполнение
+	не меняет результата, поэтому его можно отправить ещё раз, даже
+	если сервер успел выполнить первый */
+static bool idempotent(const std::string &request)
+{
+	static const char *methods[]
+		= { "GET ", "HEAD ", "PUT ", "DELETE ", "OPTIONS " };
+
+	for (std::size_t i = 0; i < sizeof(methods) / sizeof(*methods); i++)
+		if (request.compare(0, std::strlen(methods[i]), methods[i]) == 0)
+			return true;
+
+	return false;
+}
+
+void connection_pool::get(const tcp::endpoint &endpoint,
+	const std::string &request, reply &rep)
+{
+	connection_ptr conn = acquire(endpoint);
+
+	try
+	{
+		conn->get(request, rep);
+	}
+	catch (boost::system::system_error &)
+	{
+		/* Сервер мог закрыть соединение, пока оно было свободно -
+			повторяем по новому. Ошибка на новом - настоящая ошибка.
+			Неидемпотентный запрос (POST и т.п.) не повторяем: обрыв
+			мог случиться уже после его выполнения */
+		if (conn->replies() == 0 || !idempotent(request))
+			throw;
+
+		conn = connection_ptr( new connection(io_service_, endpoint) );
+		conn->get(request, rep);
+	}
+
+	release(conn);
+}
+
+void connection_pool::clear()
+{
+	boost::unique_lock<boost::mutex> lock(mutex_);
+	idle_.clear();
+}
+
+/* Стандартное сообщение для кода ответа */
+static const char* status_text(unsigned int status_code)
+{
+	switch (status_code)
+	{
+		case 200: return "OK";
+		case 201: return "Created";
+		case 204: return "No Content";
+		case 301: return "Moved Permanently";
+		case 302: return "Found";
+		case 304: return "Not Modified";
+		case 400: return "Bad Request";
+		case 403: return "Forbidden";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		case 500: return "Internal Server Error";
+		case 503: return "Service Unavailable";
+	}
+
+	return "Unknown";
+}
+
+/* Оставлять ли соединение после запроса: Connection: close/keep-alive
+	(как parser::keep_alive - по fields, не зависит от fill_maps),
+	по умолчанию - для HTTP/1.1 да, для HTTP/1.0 нет */
+static bool keep_alive(const request &req)
+{
+	boost::string_ref connection;
+
+	if (req.fields.find("Connection", connection))
+	{
+		if (has_token(connection, "close"))
+			return false;
+		if (has_token(connection, "keep-alive"))
+			return true;
+	}
+
+	std::size_t pos = req.request_.rfind("HTTP/1.");
+	return pos != std::string::npos && pos + 7 < req.request_.size()
+		&& req.request_[pos + 7] != '0';
+}
+
+/*
+	Соединение с клиентом: запрос - ответ - следующий запрос...
+	Работает в потоке одного реактора
+*/
+class server_session
+	: public boost::enable_shared_from_this<server_session>
+{
+public:
+	server_session(asio::io_service &io_service, const server &srv)
+		: socket_(io_service)
+		, server_(srv)
+		, keep_alive_(false)
+	{
+		req_.fill_maps = srv.fill_maps();
+	}
+
+	tcp::socket& socket()
+		{ return socket_; }
+
+	void start()
+	{
+		/* Ответы небольшие - без задержки Нейгла */
+		boost::system::error_code ec;
+		socket_.set_option(tcp::no_delay(true), ec);
+
+		read();
+	}
+
+private:
+	tcp::socket socket_;
+	const server &server_;
+	request req_;   /* Буфер чтения (req_.buf_) - общий для всех запросов */
+	reply rep_;
+	std::string head_; /* Строка статуса и служебные поля */
+	bool keep_alive_;
+
+	void read()
+	{
+		async_read_request(socket_, req_,
+			boost::bind(&server_session::on_request, shared_from_this(), _1),
+			server_.keep_alive_timeout());
+	}
+
+	void on_request(const boost::system::error_code &ec)
+	{
+		if (ec)
+		{
+			close();
+			return;
+		}
+
+		rep_.status_code = 200;
+		rep_.status_message.clear();
+		rep_.header_.clear();
+		rep_.body.clear();
+		rep_.body_file_.reset();
+
+		const server::handler_type *handler = server_.find_route(req_.url);
+
+		if (!handler)
+			rep_.status_code = 404;
+		else
+		{
+			try
+			{
+				(*handler)(req_, rep_);
+			}
+			catch (std::exception &)
+			{
+				rep_.status_code = 500;
+				rep_.status_message.clear();
+				rep_.header_.clear();
+				rep_.body.clear();
+				rep_.body_file_.reset();
+			}
+		}
+
+		keep_alive_ = keep_alive(req_);
+		write();
+	}
+
+	void write()
+	{
+		char num[32];
+
+		head_.assign("HTTP/1.1 ");
+		head_.append(num, my::num::put(num, sizeof(num), rep_.status_code));
+		head_ += ' ';
+
+		if (rep_.status_message.empty())
+			head_ += status_text(rep_.status_code);
+		else
+			head_ += my::utf8::encode(rep_.status_message);
+
+		/* Тело - строка или отображённый в память файл: отправляется
+			прямо оттуда, без копирования */
+		const boost::string_ref body = rep_.body_ref();
+
+		head_ += "\r\nContent-Length: ";
+		head_.append(num, my::num::put(num, sizeof(num), body.size()));
+		head_ += "\r\n";
+
+		if (!keep_alive_)
+			head_ += "Connection: close\r\n";
+
+		/* У ответа на HEAD тела нет, но Content-Length - как у GET */
+		const bool head = (req_.request_.compare(0, 5, "HEAD ") == 0);
+
+		boost::array<asio::const_buffer, 4> buffers = {{
+			asio::buffer(head_),
+			asio::buffer(rep_.header_),
+			asio::buffer("\r\n", 2),
+			asio::buffer(body.data(), head ? 0 : body.size())
+		}};
+
+		asio::async_write(socket_, buffers,
+			boost::bind(&server_session::on_write, shared_from_this(),
+				asio::placeholders::error));
+	}
+
+	void on_write(const boost::system::error_code &ec)
+	{
+		if (ec || !keep_alive_)
+			close();
+		else
+			read();
+	}
+
+	void close()
+	{
+		boost::system::error_code ec;
+		socket_.shutdown(tcp::socket::shutdown_both, ec);
+		socket_.close(ec);
+	}
+};
+
+struct server::reactor
+{
+	asio::io_service io_service;
+	boost::scoped_ptr<asio::io_service::work> work;
+	boost::scoped_ptr<boost::thread> thread;
+};
+
+server::server(const tcp::endpoint &endpoint, std::size_t threads)
+	: next_reactor_(0)
+	, keep_alive_timeout_(boost::posix_time::seconds(60))
+	, fill_maps_(false)
+	, started_(false)
+{
+	if (threads == 0)
+		threads = boost::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+
+	for (std::size_t i = 0; i < threads; i++)
+		reactors_.push_back( reactor_ptr(new reactor) );
+
+	/* Слушаем сразу - чтобы до start() был известен порт */
+	acceptor_.reset( new tcp::acceptor(reactors_[0]->io_service, endpoint) );
+	accept_timer_.reset( new asio::deadline_timer(reactors_[0]->io_service) );
+}
+
+server::~server()
+{
+	stop();
+
+	accept_timer_.reset();
+	acceptor_.reset();
+
+	/* Первым - реактор с acceptor'ом: в его очереди может остаться
+		сессия, сокет которой принадлежит другому реактору */
+	for (std::size_t i = 0; i < reactors_.size(); i++)
+		reactors_[i].reset();
+}
+
+void server::route(const std::wstring &url, const handler_type &handler)
+{
+	routes_[url] = handler;
+}
+
+const server::handler_type* server::find_route(const std::wstring &url) const
+{
+	routes_map::const_iterator iter = routes_.find(url);
+
+	if (iter != routes_.end())
+		return &iter->second;
+
+	/* "/api/v1/items" -> "/api/v1/" -> "/api/" -> "/" */
+	std::size_t pos = url.size();
+
+	while (pos && (pos = url.find_last_of(L'/', pos - 1)) != std::wstring::npos)
+	{
+		iter = routes_.find( url.substr(0, pos + 1) );
+
+		if (iter != routes_.end())
+			return &iter->second;
+	}
+
+	return 0;
+}
+
+void server::start()
+{
+	if (started_)
+		return;
+
+	started_ = true;
+
+	for (std::size_t i = 0; i < reactors_.size(); i++)
+	{
+		reactor &r = *reactors_[i];
+
+		r.io_service.reset();
+		r.work.reset( new asio::io_service::work(r.io_service) );
+		r.thread.reset( new boost::thread( boost::bind(
+			&asio::io_service::run, &r.io_service) ) );
+	}
+
+	/* acceptor работает в потоке первого реактора */
+	reactors_[0]->io_service.post( boost::bind(&server::accept, this) );
+}
+
+void server::stop()
+{
+	if (!started_)
+		return;
+
+	started_ = false;
+
+	for (std::size_t i = 0; i < reactors_.size(); i++)
+	{
+		reactor &r = *reactors_[i];
+
+		r.work.reset();
+		r.io_service.stop();
+		r.thread->join();
+		r.thread.reset();
+	}
+
+	boost::system::error_code ec;
+	acceptor_->close(ec);
+}
+
+void server::accept()
+{
+	/* Соединения - реакторам по кругу */
+	asio::io_service &io_service
+		= reactors_[next_reactor_++ % reactors_.size()]->io_service;
+
+	boost::shared_ptr<server_session> session(
+		new server_session(io_service, *this) );
+
+	acceptor_->async_accept(session->socket(),
+		boost::bind(&server::on_accept, this, session, &io_service,
+			asio::placeholders::error));
+}
+
+void server::on_accept(boost::shared_ptr<server_session> session,
+	asio::io_service *io_service, const boost::system::error_code &ec)
+{
+	if (ec == asio::error::operation_aborted || !acceptor_->is_open())
+		return;
+
+	if (ec)
+	{
+		/* Ошибка может быть постоянной (EMFILE, ENFILE) - повторяем
+			с паузой, иначе реактор будет занят только ею */
+		accept_timer_->expires_from_now(boost::posix_time::milliseconds(100));
+		accept_timer_->async_wait( boost::bind(&server::on_accept_timer,
+			this, asio::placeholders::error) );
+		return;
+	}
+
+	/* Сессия начинает работу в потоке своего реактора */
+	io_service->post( boost::bind(&server_session::start, session) );
+
+	accept();
+}
+
+void server::on_accept_timer(const boost::system::error_code &ec)
+{
+	if (ec == asio::error::operation_aborted || !acceptor_->is_open())
+		return;
+
+	accept();
 }
 
 } }
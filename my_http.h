@@ -4,11 +4,20 @@
 #include "my_inet.h"
 #include "my_xml.h"
 
+#include <cstddef> /* std::size_t */
 #include <string>
 #include <map>
 #include <vector>
 #include <utility> /* std::pair */
 
+#include <boost/function.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/container/small_vector.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/utility.hpp> /* boost::noncopyable */
+#include <boost/thread/mutex.hpp>
+
 namespace my { namespace http {
 
 typedef std::pair<std::string, std::string> param_type;
@@ -33,12 +42,75 @@ unsigned int parse_reply(const std::string &line,
 	Connection: close\r\n\r\n */
 void parse_header(const std::string &lines, params_type &params);
 
+/* Декодирование %XX. Разбор прекращается на первой неверной
+	последовательности (% без двух hex-цифр) */
 std::string percent_decode(const char *str, int len = -1);
 inline std::string percent_decode(const std::string &str)
 {
 	return percent_decode(str.c_str(), (int)str.size());
 }
 
+/* То же - с добавлением в конец out, без временной строки */
+void percent_decode_append(const char *str, std::size_t len,
+	std::string &out);
+
+/* Декодирование на месте (результат никогда не длиннее исходной
+	строки). Возврат: новая длина */
+std::size_t percent_decode_inplace(char *str, std::size_t len);
+
+/* Декодирование %XX и сразу UTF-8 - за один проход, с добавлением
+	в конец out. Результат - как у utf8::decode(percent_decode(str)) */
+void percent_decode_append(const char *str, std::size_t len,
+	std::wstring &out);
+
+inline std::wstring percent_utf8_decode(const char *str, std::size_t len)
+{
+	std::wstring out;
+	percent_decode_append(str, len, out);
+	return out;
+}
+
+/*
+	Набор символов, кодируемых percent_encode: управляющие, пробел,
+	не ascii-символы (>127) и заказанные пользователем. Таблица
+	на 256 символов строится один раз - при частом кодировании
+	с одним и тем же набором его лучше создать заранее:
+
+		static const my::http::escape_set url_escape("&=?");
+		std::string str = my::http::percent_encode(url, url_escape);
+*/
+class escape_set
+{
+public:
+	explicit escape_set(const char *escape_symbols = NULL);
+
+	bool operator()(unsigned char ch) const
+		{ return table_[ch] != 0; }
+
+	/* Заказанные печатные символы - для векторной проверки
+		(если их не больше max_symbols) */
+	enum { max_symbols = 8 };
+
+	const char* symbols() const
+		{ return symbols_; }
+
+	std::size_t symbols_count() const
+		{ return symbols_count_; }
+
+private:
+	unsigned char table_[256];
+	char symbols_[max_symbols];
+	std::size_t symbols_count_;
+};
+
+std::string percent_encode(const char *str, std::size_t len,
+	const escape_set &escape);
+inline std::string percent_encode(const std::string &str,
+	const escape_set &escape)
+{
+	return percent_encode(str.c_str(), str.size(), escape);
+}
+
 std::string percent_encode(const char *str,
 	const char *escape_symbols = NULL, int len = -1);
 inline std::string percent_encode(const std::string &str,
@@ -47,20 +119,277 @@ inline std::string percent_encode(const std::string &str,
 	return percent_encode(str.c_str(), escape_symbols, (int)str.size());
 }
 
+/* Поле заголовка: "name: value". Ссылки - прямо в буфер чтения (без
+	копирования), действительны, пока жив и не изменён сам буфер */
+struct header_field
+{
+	boost::string_ref name;
+	boost::string_ref value;
+};
+
+/* Поиск конца заголовка (пустой строки) в начале data - c места,
+	на котором остановился прошлый поиск (scanned, вначале - 0).
+	Возврат: размер заголовка вместе с пустой строкой или 0, если
+	заголовок ещё не получен целиком */
+std::size_t find_header_end(const char *data, std::size_t size,
+	std::size_t &scanned);
+
+/* Разбор полей заголовка из [ptr, end) - до пустой строки.
+	Возврат: указатель на конец заголовка (за пустой строкой) */
+const char* parse_fields(const char *ptr, const char *end,
+	std::vector<header_field> &fields);
+
+/* Обработчик очередной порции тела сообщения. Данные передаются
+	прямо из буфера чтения (без копирования) и действительны только
+	на время вызова */
+typedef boost::function<void (const char *data, std::size_t size)> body_handler;
+
+/*
+	Разбор тела сообщения по мере поступления данных - в любом
+	количестве и любыми порциями (хоть по одному байту):
+		content_length - ровно length байт,
+		chunked - Transfer-Encoding: chunked (куски вида
+			"размер\r\nданные\r\n", в конце - "0\r\n" и трейлер),
+		until_eof - до закрытия соединения (eof).
+	Тело (без служебных данных chunked) передаётся в handler.
+*/
+class body_reader
+{
+public:
+	enum framing_type { until_eof, content_length, chunked };
+
+	body_reader()
+		{ reset(until_eof); }
+
+	void reset(framing_type framing, unsigned long long length = 0);
+
+	/* Разбор очередной порции. Возврат: кол-во байт, относящихся
+		к телу. Когда тело закончилось (done), разбор прекращается -
+		оставшиеся данные относятся уже к следующему сообщению */
+	std::size_t parse(const char *data, std::size_t size,
+		const body_handler &handler);
+
+	/* Соединение закрыто. Для until_eof - это конец тела,
+		в остальных случаях - ошибка (тело не получено полностью) */
+	void eof();
+
+	bool done() const
+		{ return state_ == done_state; }
+
+	framing_type framing() const
+		{ return framing_; }
+
+private:
+	enum state_type
+	{
+		data_state,       /* Данные (left_ байт) */
+		size_state,       /* Размер куска (hex) */
+		ext_state,        /* Остаток строки размера (расширения) */
+		data_cr_state,    /* "\r\n" после данных куска */
+		data_lf_state,
+		trailer_state,    /* Начало строки трейлера */
+		trailer_line_state,
+		trailer_lf_state, /* '\n' пустой строки в конце трейлера */
+		done_state
+	};
+
+	framing_type framing_;
+	state_type state_;
+	unsigned long long left_;
+	bool has_digits_;
+
+	void throw_error(const char *ptr, const char *data);
+};
+
+class field_list;
+
+/*
+	Инкрементальный разбор запроса/ответа - без выделения памяти
+	(кроме первого заполнения списка полей) и без копирования:
+	все результаты - ссылки в буфер, переданный в parse_*.
+
+	Данные можно передавать по мере поступления: пока заголовок
+	не получен целиком, parse_* возвращают 0 и при следующем вызове
+	(с тем же началом буфера и новыми данными в конце) продолжают
+	поиск с того же места. Ошибка в заголовке - исключение.
+
+	Разбор в map<wstring, wstring> (с декодированием) - только
+	по требованию (to_map).
+*/
+class parser
+{
+public:
+	boost::string_ref method;         /* Запрос: GET, POST и т.д. */
+	boost::string_ref url;            /* Запрос: путь с параметрами */
+	unsigned int status_code;  /* Ответ: код */
+	boost::string_ref status_message; /* Ответ: сообщение */
+	int minor_version;         /* HTTP/1.x */
+
+	parser()
+		{ reset(); }
+
+	void reset();
+
+	/* Возврат: размер заголовка (вместе со строкой запроса/ответа)
+		или 0, если данных пока недостаточно */
+	std::size_t parse_request(const char *data, std::size_t size);
+	std::size_t parse_reply(const char *data, std::size_t size);
+
+	const std::vector<header_field>& fields() const
+		{ return fields_; }
+
+	/* Поиск поля (без учёта регистра). Возврат: 0 - нет поля */
+	const boost::string_ref* find(const char *name) const;
+
+	/* Способ определения конца тела (для запроса без Content-Length
+		и chunked - тела нет) */
+	body_reader::framing_type body_framing(unsigned long long &length,
+		bool is_request) const;
+
+	/* Поля заголовка в map (с percent- и utf8-декодированием -
+		как в message::header) */
+	void to_map(std::map<std::wstring, std::wstring> &map) const;
+
+	/* То же - в field_list (percent-декодирование, без utf8) */
+	void to_fields(field_list &fields) const;
+
+	/* Можно ли продолжать работу с соединением после этого
+		сообщения: Connection: close/keep-alive, по умолчанию -
+		для HTTP/1.1 да, для HTTP/1.0 нет */
+	bool keep_alive() const;
+
+private:
+	std::size_t scanned_;
+	std::vector<header_field> fields_;
+
+	const char* parse_version(const char *ptr, const char *end);
+};
+
+/*
+	Компактный список полей "имя - значение" (заголовок, параметры
+	запроса) - вместо map<wstring, wstring>: имена и значения лежат
+	подряд в одном буфере (arena), в записях - только смещения,
+	первые inline_size записей - прямо в объекте. Значения хранятся
+	после percent-декодирования, но в UTF-8 (без перевода в wstring).
+
+	clear() память не освобождает - при повторном использовании
+	(keep-alive, сервер) выделений памяти нет совсем. Поиск -
+	перебором, без учёта регистра и без вставки пустых значений;
+	у каждой записи - хэш имени, строки сравниваются только при
+	совпадении хэша.
+	Ссылки, полученные из name/value/find, действительны до
+	следующего add или clear.
+*/
+class field_list
+{
+public:
+	static const std::size_t inline_size = 16;
+
+	field_list() {}
+
+	void clear()
+	{
+		entries_.clear();
+		arena_.clear();
+	}
+
+	bool empty() const
+		{ return entries_.empty(); }
+
+	std::size_t size() const
+		{ return entries_.size(); }
+
+	void reserve(std::size_t count)
+		{ entries_.reserve(count); }
+
+	boost::string_ref name(std::size_t index) const
+	{
+		const entry &e = entries_[index];
+		return boost::string_ref(arena_.data() + e.name, e.name_size);
+	}
+
+	boost::string_ref value(std::size_t index) const
+	{
+		const entry &e = entries_[index];
+		return boost::string_ref(arena_.data() + e.value, e.value_size);
+	}
+
+	/* Добавление как есть */
+	void add(const char *name, std::size_t name_size,
+		const char *value, std::size_t value_size);
+
+	/* Добавление с percent-декодированием имени и значения */
+	void add_decoded(const char *name, std::size_t name_size,
+		const char *value, std::size_t value_size);
+
+	/* Поиск первого поля с именем name (без учёта регистра).
+		Возврат: false - нет поля */
+	bool find(const char *name, boost::string_ref &value) const;
+	bool find(const std::wstring &name, boost::string_ref &value) const;
+
+	/* В map (с utf8-декодированием). Повторные имена - как при
+		разборе в map: остаётся последнее значение */
+	void to_map(std::map<std::wstring, std::wstring> &map) const;
+
+private:
+	struct entry
+	{
+		unsigned int name;
+		unsigned int name_size;
+		unsigned int value;
+		unsigned int value_size;
+		unsigned int hash; /* name_hash имени */
+	};
+
+	boost::container::small_vector<entry, inline_size> entries_;
+	std::string arena_;
+};
+
 class message
 {
 public:
 	asio::streambuf buf_; /* Буфер для чтения их сокета*/
 	std::string header_; /* Заголовок AS IS */
 	std::map<std::wstring, std::wstring> header;
+	field_list fields; /* Те же поля заголовка - без map и wstring */
 	std::string body;
 
-	message() {}
+	/* Заполнять ли при чтении header (и params у запроса). Если
+		достаточно fields (query) - лучше отключить: на каждое
+		сообщение это десятки выделений памяти */
+	bool fill_maps;
+
+	message() : fill_maps(true) {}
+	virtual ~message() {}
 
 	void read_header(tcp::socket &socket);
+
+	/* Чтение тела целиком в body (по Content-Length, chunked
+		или до закрытия соединения) */
 	void read_body(tcp::socket &socket);
 
-	std::wstring content_type();
+	/* Потоковое чтение тела - без накопления в памяти: данные
+		передаются в handler по мере поступления, память ограничена
+		размером буфера чтения */
+	void read_body(tcp::socket &socket, const body_handler &handler);
+
+	/* Чтение тела прямо в файл - по мере поступления, без накопления
+		в body. Под Linux тело с Content-Length переносится из сокета
+		в файл через splice - минуя память процесса */
+	void save_body(tcp::socket &socket, const std::wstring &filename);
+
+	/* Поиск поля заголовка (без учёта регистра). Возврат: 0 - нет поля */
+	const std::wstring* find_header(const std::wstring &name) const;
+
+	/* То же по fields (без map). Возврат: false - нет поля */
+	bool find_field(const char *name, boost::string_ref &value) const
+		{ return fields.find(name, value); }
+
+	/* Способ определения конца тела - по полям заголовка */
+	virtual body_reader::framing_type body_framing(
+		unsigned long long &length) const;
+
+	std::wstring content_type() const;
 
 	void to_xml(::xml::ptree &pt);
 	void to_xml(::xml::wptree &pt);
@@ -75,6 +404,11 @@ public:
 	unsigned int status_code;
 	std::wstring status_message;
 
+	/* Тело из файла (вместо body) - файл отображается в память
+		и отправляется сервером прямо оттуда, без чтения в строку */
+	struct mapped_file;
+	boost::shared_ptr<mapped_file> body_file_;
+
 	reply() : message(), status_code(0) {}
 
 	void read_reply(tcp::socket &socket);
@@ -82,6 +416,12 @@ public:
 	/* Отправка запроса и получение ответа */
 	void get(tcp::socket &socket, const std::string &request,
 		bool do_read_body = true);
+
+	/* Ответить файлом (body_file_). Ошибка открытия - исключение */
+	void send_file(const std::wstring &filename);
+
+	/* Тело для отправки: файл, если задан, иначе body */
+	boost::string_ref body_ref() const;
 };
 
 class request : public message
@@ -90,10 +430,224 @@ public:
 	std::string request_; /* Строка запроса AS IS */
 	std::wstring url; /* URL */
 	std::map<std::wstring, std::wstring> params; /* Параметры: ?a=A&b=B... */
+	field_list query; /* Те же параметры - без map и wstring */
 
 	request() : message() {}
 
 	void read_request(tcp::socket &socket);
+
+	/* У запроса без Content-Length и chunked тела нет */
+	virtual body_reader::framing_type body_framing(
+		unsigned long long &length) const;
+};
+
+/*
+	Асинхронные операции (boost::asio): без отдельного потока
+	на каждый запрос - всё выполняется в потоке (потоках) io_service
+	сокета, по окончании вызывается handler(ec) (если не пустой).
+
+	Сокет и rep/req должны жить до вызова handler. Отмена - закрытием
+	сокета (ec = asio::error::operation_aborted), по истечении timeout
+	сокет закрывается сам (ec = asio::error::timed_out). Ошибка
+	в формате сообщения - boost::system::errc::protocol_error.
+*/
+typedef boost::function<void (const boost::system::error_code &ec)> async_handler;
+
+/* Отправка запроса и получение ответа (как reply::get) */
+void async_get(tcp::socket &socket, const std::string &request,
+	reply &rep, const async_handler &handler,
+	const boost::posix_time::time_duration &timeout
+		= boost::posix_time::pos_infin);
+
+/* Получение запроса (как request::read_request + read_header
+	+ read_body, но с любым методом, а не только GET) */
+void async_read_request(tcp::socket &socket, request &req,
+	const async_handler &handler,
+	const boost::posix_time::time_duration &timeout
+		= boost::posix_time::pos_infin);
+
+/*
+	Постоянное соединение с сервером (HTTP/1.1 keep-alive): запросы
+	отправляются по одному и тому же соединению, пока сервер его
+	не закроет. Конвейер (pipelining) - отправка сразу нескольких
+	запросов и получение ответов на них по порядку.
+
+	Ответы читаются из общего для соединения буфера: всё, что пришло
+	после конца одного ответа, относится к следующему. Запрос -
+	готовый текст ("GET / HTTP/1.1\r\nHost: ...\r\n\r\n").
+*/
+class connection : boost::noncopyable
+{
+public:
+	connection(asio::io_service &io_service, const tcp::endpoint &endpoint);
+
+	tcp::socket& socket()
+		{ return socket_; }
+
+	const tcp::endpoint& endpoint() const
+		{ return endpoint_; }
+
+	/* Можно ли отправить по соединению следующий запрос */
+	bool keep_alive() const
+		{ return keep_alive_; }
+
+	/* Кол-во ответов, полученных по соединению */
+	unsigned int replies() const
+		{ return replies_; }
+
+	/* Отправка запроса и получение ответа */
+	void get(const std::string &request, reply &rep);
+
+	/* Конвейер: отправка count запросов одним вызовом, затем
+		получение count ответов */
+	void get(const std::string *requests, reply *replies, std::size_t count);
+
+	/* Получение ответа на уже отправленный запрос (head - ответ
+		на HEAD, тела у него нет) */
+	void read_reply(reply &rep, bool head = false);
+
+private:
+	tcp::socket socket_;
+	tcp::endpoint endpoint_;
+	asio::streambuf buf_;
+	parser parser_;
+	bool keep_alive_;
+	unsigned int replies_;
+};
+
+/*
+	Пул постоянных соединений: по несколько свободных соединений
+	на каждый адрес (endpoint). Потокобезопасен.
+
+		my::http::connection_pool pool(io_service);
+		...
+		my::http::reply rep;
+		pool.get(endpoint, "GET / HTTP/1.1\r\nHost: ...\r\n\r\n", rep);
+*/
+class connection_pool : boost::noncopyable
+{
+public:
+	typedef boost::shared_ptr<connection> connection_ptr;
+
+	connection_pool(asio::io_service &io_service,
+		std::size_t max_idle_per_host = 4)
+		: io_service_(io_service)
+		, max_idle_(max_idle_per_host) {}
+
+	/* Свободное соединение с endpoint или новое */
+	connection_ptr acquire(const tcp::endpoint &endpoint);
+
+	/* Возврат соединения в пул (если сервер не просил его закрыть) */
+	void release(const connection_ptr &conn);
+
+	/* Запрос через пул. Если сервер успел закрыть свободное
+		соединение, запрос повторяется по новому - но только
+		идемпотентный (GET, HEAD, PUT, DELETE, OPTIONS): сервер мог
+		выполнить запрос до обрыва, и POST выполнился бы дважды.
+		Для остальных методов ошибка передаётся вызывающему - решать,
+		можно ли повторить запрос, ему */
+	void get(const tcp::endpoint &endpoint, const std::string &request,
+		reply &rep);
+
+	/* Закрытие всех свободных соединений */
+	void clear();
+
+private:
+	typedef std::map< tcp::endpoint, std::vector<connection_ptr> > idle_map;
+
+	asio::io_service &io_service_;
+	std::size_t max_idle_;
+	boost::mutex mutex_;
+	idle_map idle_;
+};
+
+class server_session;
+
+/*
+	Встраиваемый HTTP/1.1 сервер.
+
+	Несколько реакторов - по io_service на поток (по умолчанию -
+	по числу ядер). Общий acceptor раздаёт новые соединения реакторам
+	по кругу, дальше соединение обслуживается только своим потоком -
+	без блокировок. Соединения постоянные (keep-alive), запросы
+	читаются через async_read_request, ответ отправляется одной
+	записью (scatter-gather) из нескольких буферов: строка статуса
+	со служебными полями, rep.header_ и rep.body - без склейки.
+
+	Обработчик выбирается по url: сначала точное совпадение, затем
+	маршруты, оканчивающиеся на '/', - от длинного к короткому
+	("/api/" обслуживает и "/api/items"). Поля заголовка запроса -
+	в req.fields, параметры - в req.query (req.header и req.params
+	пусты, если не включён set_fill_maps). Обработчик заполняет rep:
+	status_code (по умолчанию 200), status_message (пусто -
+	стандартное), header_ - дополнительные строки заголовка AS IS
+	("Content-Type: text/plain\r\n"), body. Исключение
+	в обработчике - ответ 500.
+
+		my::http::server srv(tcp::endpoint(tcp::v4(), 8080));
+		srv.route(L"/ping", ping_handler);
+		srv.start();
+*/
+class server : boost::noncopyable
+{
+public:
+	typedef boost::function<void (const request &req, reply &rep)> handler_type;
+
+	/* threads - кол-во реакторов, 0 - по числу ядер */
+	server(const tcp::endpoint &endpoint, std::size_t threads = 0);
+	~server();
+
+	/* Маршруты задаются до start() */
+	void route(const std::wstring &url, const handler_type &handler);
+
+	/* Обработчик для url. Возврат: 0 - нет подходящего маршрута */
+	const handler_type* find_route(const std::wstring &url) const;
+
+	/* Время ожидания очередного запроса по соединению */
+	void set_keep_alive_timeout(const boost::posix_time::time_duration &timeout)
+		{ keep_alive_timeout_ = timeout; }
+
+	const boost::posix_time::time_duration& keep_alive_timeout() const
+		{ return keep_alive_timeout_; }
+
+	/* Заполнять ли у запросов header и params. По умолчанию нет:
+		поля заголовка и параметры есть в req.fields и req.query,
+		а map'ы с wstring - десятки выделений памяти на запрос.
+		Включать, только если обработчикам нужны именно map'ы */
+	void set_fill_maps(bool fill)
+		{ fill_maps_ = fill; }
+
+	bool fill_maps() const
+		{ return fill_maps_; }
+
+	/* Адрес, на котором слушает сервер (при порте 0 - порт,
+		выбранный системой) */
+	tcp::endpoint endpoint() const
+		{ return acceptor_->local_endpoint(); }
+
+	void start();
+
+	/* Остановка всех реакторов (повторный start() не предусмотрен) */
+	void stop();
+
+private:
+	struct reactor;
+	typedef boost::shared_ptr<reactor> reactor_ptr;
+	typedef std::map<std::wstring, handler_type> routes_map;
+
+	std::vector<reactor_ptr> reactors_;
+	boost::scoped_ptr<tcp::acceptor> acceptor_;
+	boost::scoped_ptr<asio::deadline_timer> accept_timer_; /* Пауза после ошибки */
+	std::size_t next_reactor_;
+	routes_map routes_;
+	boost::posix_time::time_duration keep_alive_timeout_;
+	bool fill_maps_;
+	bool started_;
+
+	void accept();
+	void on_accept(boost::shared_ptr<server_session> session,
+		asio::io_service *io_service, const boost::system::error_code &ec);
+	void on_accept_timer(const boost::system::error_code &ec);
 };
 
 } }
@@ -0,0 +1,384 @@
+﻿#include "my_http.h"
+#include "my_num.h"
+#include "my_bench.h"
+#include "my_fs.h"
+
+#include <cstddef> /* std::size_t */
+#include <iterator> /* std::istreambuf_iterator */
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+/* Кол-во одновременных запросов в тестах через loopback */
+#define LOOPBACK_COUNT 64
+
+/* Размер файла в тестах передачи файлов */
+#define FILE_SIZE (8 * 1024 * 1024)
+
+static wstring file_src;
+static wstring file_dest;
+
+/* Файл в ответе: по-старому - чтение в body */
+static void file_to_body(const my::http::request &, my::http::reply &rep)
+{
+	fs::ifstream fs(file_src, std::ios::binary);
+	rep.body.assign(std::istreambuf_iterator<char>(fs),
+		std::istreambuf_iterator<char>());
+}
+
+static void file_send(const my::http::request &, my::http::reply &rep)
+{
+	rep.send_file(file_src);
+}
+
+/*
+	Тестовый сервер на async_read_request: на каждый запрос -
+	короткий ответ и закрытие соединения
+*/
+struct server_connection
+{
+	tcp::socket socket;
+	my::http::request req;
+
+	server_connection(asio::io_service &io_service)
+		: socket(io_service) {}
+};
+
+typedef boost::shared_ptr<server_connection> server_connection_ptr;
+
+static const string server_reply = "HTTP/1.1 200 OK\r\n"
+	"Content-Length: 2\r\n"
+	"\r\n"
+	"ok";
+
+static void on_server_write(server_connection_ptr conn,
+	const boost::system::error_code &)
+{
+	boost::system::error_code ec;
+	conn->socket.shutdown(tcp::socket::shutdown_both, ec);
+	conn->socket.close(ec);
+}
+
+static void on_server_request(server_connection_ptr conn,
+	const boost::system::error_code &ec)
+{
+	if (!ec)
+		asio::async_write(conn->socket, asio::buffer(server_reply),
+			boost::bind(on_server_write, conn, asio::placeholders::error));
+}
+
+static void server_accept(asio::io_service &io_service,
+	tcp::acceptor &acceptor);
+
+static void on_server_accept(asio::io_service &io_service,
+	tcp::acceptor &acceptor, server_connection_ptr conn,
+	const boost::system::error_code &ec)
+{
+	if (ec)
+		return;
+
+	my::http::async_read_request(conn->socket, conn->req,
+		boost::bind(on_server_request, conn, _1));
+
+	server_accept(io_service, acceptor);
+}
+
+static void server_accept(asio::io_service &io_service,
+	tcp::acceptor &acceptor)
+{
+	server_connection_ptr conn( new server_connection(io_service) );
+
+	acceptor.async_accept(conn->socket, boost::bind(on_server_accept,
+		boost::ref(io_service), boost::ref(acceptor), conn,
+		asio::placeholders::error));
+}
+
+/* Клиент для async_get */
+struct client_connection
+{
+	tcp::socket socket;
+	my::http::reply rep;
+
+	client_connection(asio::io_service &io_service)
+		: socket(io_service) {}
+};
+
+static void on_client_connect(client_connection *conn, const string *request,
+	const boost::system::error_code &ec)
+{
+	if (!ec)
+		my::http::async_get(conn->socket, *request, conn->rep,
+			my::http::async_handler(), posix_time::seconds(10));
+}
+
+int main(int argc, char *argv[])
+{
+	my::bench::runner bench(argc, argv);
+	my::bench::random rnd;
+
+	/* Типичный URL с параметрами */
+	const string url = "/api/v1/search?q=some text with spaces&lang=ru"
+		"&from=2010-06-09 12:00:00&to=2010-06-10 12:00:00&limit=100";
+
+	/* Бинарные данные - много символов, требующих кодирования */
+	string binary;
+	for (size_t i = 0; i < 4096; i++)
+		binary += (char)rnd(256);
+
+	/* Текст - в основном безопасные символы */
+	string text;
+	for (size_t i = 0; i < 4096; i++)
+		text += (rnd(20) == 0 ? ' ' : (char)('a' + rnd(26)));
+
+	const string url_enc = my::http::percent_encode(url, "&=?");
+	const string binary_enc = my::http::percent_encode(binary);
+	const string text_enc = my::http::percent_encode(text);
+
+	for (my::bench::timer t(bench, "http", "percent_encode(url)"); t.next(); )
+	{
+		string str = my::http::percent_encode(url, "&=?");
+		my::bench::do_not_optimize(str);
+	}
+
+	const my::http::escape_set url_escape("&=?");
+
+	for (my::bench::timer t(bench, "http", "percent_encode(url,escape_set)"); t.next(); )
+	{
+		string str = my::http::percent_encode(url, url_escape);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "http", "percent_encode(text 4k)"); t.next(); )
+	{
+		string str = my::http::percent_encode(text);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "http", "percent_encode(binary 4k)"); t.next(); )
+	{
+		string str = my::http::percent_encode(binary);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "http", "percent_decode(url)"); t.next(); )
+	{
+		string str = my::http::percent_decode(url_enc);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "http", "percent_decode(text 4k)"); t.next(); )
+	{
+		string str = my::http::percent_decode(text_enc);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "http", "percent_decode(binary 4k)"); t.next(); )
+	{
+		string str = my::http::percent_decode(binary_enc);
+		my::bench::do_not_optimize(str);
+	}
+
+	/*
+		Заголовок
+	*/
+
+	const string request_line = "GET /api/v1/search?q=text&lang=ru HTTP/1.1\r\n";
+	const string header_lines =
+		"Host: www.example.com\r\n"
+		"User-Agent: Mozilla/5.0 (Windows NT 6.1; rv:2.0) Gecko/20100101\r\n"
+		"Accept: text/html,application/xhtml+xml,application/xml;q=0.9\r\n"
+		"Accept-Language: ru-ru,ru;q=0.8,en-us;q=0.5,en;q=0.3\r\n"
+		"Accept-Encoding: gzip, deflate\r\n"
+		"Connection: keep-alive\r\n"
+		"Cookie: session=0123456789abcdef; lang=ru\r\n"
+		"\r\n";
+	const string request_text = request_line + header_lines;
+
+	for (my::bench::timer t(bench, "http", "parse_header"); t.next(); )
+	{
+		my::http::params_type params;
+		my::http::parse_header(header_lines, params);
+		my::bench::do_not_optimize(params);
+	}
+
+	my::http::parser parser;
+
+	for (my::bench::timer t(bench, "http", "parser::parse_request"); t.next(); )
+	{
+		my::bench::do_not_optimize( parser.parse_request(
+			request_text.c_str(), request_text.size()) );
+		my::bench::do_not_optimize( parser.find("Connection") );
+	}
+
+	/* Заголовок с 30 полями (часть - в percent-кодировке) */
+	string big_request = "GET /api/v1/search?q=%D1%82%D0%B5%D0%BA%D1%81%D1%82 HTTP/1.1\r\n";
+	for (size_t k = 0; k < 30; k++)
+		big_request += "X-Field-" + my::num::to_string((int)k) + ": "
+			+ (k % 3 ? "some plain value" : "%D0%B7%D0%BD%D0%B0%D1%87%D0%B5%D0%BD%D0%B8%D0%B5")
+			+ "\r\n";
+	big_request += "\r\n";
+
+	my::http::parser big_parser;
+	big_parser.parse_request(big_request.c_str(), big_request.size());
+
+	for (my::bench::timer t(bench, "http", "parser::to_map(30 fields)"); t.next(); )
+	{
+		map<wstring, wstring> fields;
+		big_parser.to_map(fields);
+		my::bench::do_not_optimize(fields);
+	}
+
+	/* Список переиспользуется - как у сообщения на keep-alive соединении */
+	my::http::field_list big_fields;
+
+	for (my::bench::timer t(bench, "http", "parser::to_fields(30 fields)"); t.next(); )
+	{
+		big_parser.to_fields(big_fields);
+		my::bench::do_not_optimize(big_fields);
+	}
+
+	map<wstring, wstring> big_map;
+	big_parser.to_map(big_map);
+
+	/* Последнее поле - худший случай для перебора */
+	for (my::bench::timer t(bench, "http", "map::find(30 fields)"); t.next(); )
+		my::bench::do_not_optimize( big_map.find(L"X-Field-29") );
+
+	for (my::bench::timer t(bench, "http", "field_list::find(30 fields)"); t.next(); )
+	{
+		boost::string_ref value;
+		my::bench::do_not_optimize( big_fields.find("X-Field-29", value) );
+		my::bench::do_not_optimize(value);
+	}
+
+	/*
+		Тело сообщения
+	*/
+
+	/* 64 Кб кусками по 4 Кб */
+	string body_chunked;
+	for (size_t i = 0; i < 16; i++)
+		body_chunked += "1000\r\n" + binary + "\r\n";
+	body_chunked += "0\r\n\r\n";
+
+	const string body_plain = body_chunked.substr(0, 65536);
+
+	for (my::bench::timer t(bench, "http", "body_reader(length 64k)"); t.next(); )
+	{
+		my::http::body_reader reader;
+		reader.reset(my::http::body_reader::content_length, body_plain.size());
+		my::bench::do_not_optimize( reader.parse(body_plain.c_str(),
+			body_plain.size(), my::http::body_handler()) );
+	}
+
+	for (my::bench::timer t(bench, "http", "body_reader(chunked 64k)"); t.next(); )
+	{
+		my::http::body_reader reader;
+		reader.reset(my::http::body_reader::chunked);
+		my::bench::do_not_optimize( reader.parse(body_chunked.c_str(),
+			body_chunked.size(), my::http::body_handler()) );
+	}
+
+	/*
+		Запросы через loopback: блокирующий reply::get (по очереди)
+		и async_get (все одновременно в одном потоке)
+	*/
+
+	asio::io_service server_io;
+	tcp::acceptor acceptor(server_io,
+		tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	const tcp::endpoint server_endpoint = acceptor.local_endpoint();
+
+	server_accept(server_io, acceptor);
+	boost::thread server_thread( boost::bind(&asio::io_service::run, &server_io) );
+
+	const string loopback_request = "GET /api/v1/ping HTTP/1.1\r\n"
+		"Host: localhost\r\n"
+		"\r\n";
+
+	asio::io_service client_io;
+
+	for (my::bench::timer t(bench, "http", "loopback reply::get x64"); t.next(); )
+	{
+		for (size_t k = 0; k < LOOPBACK_COUNT; k++)
+		{
+			tcp::socket socket(client_io);
+			socket.connect(server_endpoint);
+
+			my::http::reply rep;
+			rep.get(socket, loopback_request);
+			my::bench::do_not_optimize(rep.body);
+		}
+	}
+
+	for (my::bench::timer t(bench, "http", "loopback async_get x64"); t.next(); )
+	{
+		vector< boost::shared_ptr<client_connection> > conns;
+
+		for (size_t k = 0; k < LOOPBACK_COUNT; k++)
+		{
+			conns.push_back( boost::shared_ptr<client_connection>(
+				new client_connection(client_io)) );
+			conns.back()->socket.async_connect(server_endpoint,
+				boost::bind(on_client_connect, conns.back().get(),
+					&loopback_request, asio::placeholders::error));
+		}
+
+		client_io.run();
+		client_io.reset();
+	}
+
+	server_io.stop();
+	server_thread.join();
+
+	/*
+		Передача файла 8 Мб через loopback: через строки (body - save)
+		и без них (send_file - save_body)
+	*/
+
+	const fs::path tmp_dir = fs::temp_directory_path();
+	file_src = (tmp_dir / "my_http_bench_src.bin").wstring();
+	file_dest = (tmp_dir / "my_http_bench_dest.bin").wstring();
+
+	{
+		fs::ofstream fs(file_src, std::ios::binary);
+		for (size_t k = 0; k < FILE_SIZE / binary.size(); k++)
+			fs << binary;
+	}
+
+	my::http::server file_server(
+		tcp::endpoint(asio::ip::address_v4::loopback(), 0), 1);
+	file_server.route(L"/body", file_to_body);
+	file_server.route(L"/file", file_send);
+	file_server.start();
+
+	tcp::socket file_socket(client_io);
+	file_socket.connect(file_server.endpoint());
+
+	for (my::bench::timer t(bench, "http", "loopback 8M: body + save"); t.next(); )
+	{
+		my::http::reply rep;
+		rep.get(file_socket, "GET /body HTTP/1.1\r\nHost: localhost\r\n\r\n");
+		rep.save(file_dest);
+	}
+
+	for (my::bench::timer t(bench, "http", "loopback 8M: send_file + save_body"); t.next(); )
+	{
+		my::http::reply rep;
+		rep.get(file_socket, "GET /file HTTP/1.1\r\nHost: localhost\r\n\r\n", false);
+		rep.save_body(file_socket, file_dest);
+	}
+
+	file_socket.close();
+	file_server.stop();
+
+	fs::remove(file_src);
+	fs::remove(file_dest);
+
+	return bench.report();
+}
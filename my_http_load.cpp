@@ -0,0 +1,266 @@
+﻿/*
+	Нагрузочный тест HTTP-сервера (в духе wrk)
+
+	connections постоянных соединений, по каждому - запрос за запросом
+	(async_get) в течение duration секунд. Результат - кол-во запросов
+	в секунду и задержки (50%, 90%, 99%, максимальная).
+
+		my_http_load [параметры] [host port url]
+
+	Параметры командной строки:
+		--connections=n  - кол-во соединений (по умолчанию 64)
+		--threads=n      - кол-во потоков клиента (по умолчанию 1)
+		--duration=s     - время теста в секундах (по умолчанию 10)
+		--server-threads=n - кол-во реакторов встроенного сервера
+		                   (по умолчанию - по числу ядер)
+
+	Без адреса - поднимается встроенный my::http::server на loopback
+	с маршрутом "/ping".
+*/
+
+#include "my_http.h"
+#include "my_time.h"
+#include "my_str.h" /* my::str::iequals */
+
+#include <cstddef> /* std::size_t */
+#include <cstdlib> /* std::atoi */
+#include <cstring> /* std::strncmp */
+#include <algorithm> /* std::sort */
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+/* Параметр вида --name=value */
+static bool option(const char *arg, const char *name, string &value)
+{
+	size_t len = strlen(name);
+
+	if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+		return false;
+
+	value = arg + len + 1;
+	return true;
+}
+
+/*
+	Соединение клиента. Обработчики одного соединения выполняются
+	строго по очереди, поэтому задержки копятся без блокировок
+*/
+class load_connection
+{
+public:
+	vector<long> latencies; /* Задержки, мкс */
+	size_t errors;
+
+	load_connection(asio::io_service &io_service,
+		const tcp::endpoint &endpoint, const string &request,
+		const posix_time::ptime &deadline)
+		: errors(0)
+		, socket_(io_service)
+		, endpoint_(endpoint)
+		, request_(request)
+		, deadline_(deadline)
+	{
+		/* Заголовок ответа нужен только для Connection */
+		rep_.fill_maps = false;
+	}
+
+	void start()
+	{
+		rep_.buf_.consume(rep_.buf_.size());
+
+		boost::system::error_code ec;
+		socket_.close(ec);
+		socket_.connect(endpoint_, ec);
+
+		if (ec)
+		{
+			errors++;
+			return;
+		}
+
+		socket_.set_option(tcp::no_delay(true), ec);
+		send();
+	}
+
+private:
+	tcp::socket socket_;
+	tcp::endpoint endpoint_;
+	string request_;
+	posix_time::ptime deadline_;
+	posix_time::ptime start_;
+	my::http::reply rep_;
+
+	void send()
+	{
+		start_ = my::time::utc_now();
+
+		my::http::async_get(socket_, request_, rep_,
+			boost::bind(&load_connection::on_reply, this, _1),
+			posix_time::seconds(10));
+	}
+
+	void on_reply(const boost::system::error_code &ec)
+	{
+		posix_time::ptime now = my::time::utc_now();
+
+		if (ec || rep_.status_code != 200)
+			errors++;
+		else
+			latencies.push_back( (long)(now - start_).total_microseconds() );
+
+		if (now >= deadline_)
+			return;
+
+		/* Сервер закрыл соединение - переподключаемся */
+		boost::string_ref connection;
+		if (ec || (rep_.find_field("Connection", connection)
+			&& my::str::iequals(connection, "close")))
+			start();
+		else
+			send();
+	}
+};
+
+typedef boost::shared_ptr<load_connection> load_connection_ptr;
+
+static void ping(const my::http::request &, my::http::reply &rep)
+{
+	rep.header_ = "Content-Type: text/plain\r\n";
+	rep.body = "pong";
+}
+
+/* Перцентиль (отсортированного) */
+static long percentile(const vector<long> &sorted, double pct)
+{
+	if (sorted.empty())
+		return 0;
+
+	size_t index = (size_t)(pct / 100.0 * (double)(sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+int main(int argc, char *argv[])
+{
+	size_t connections = 64;
+	size_t threads = 1;
+	size_t server_threads = 0;
+	long duration = 10;
+	vector<string> args;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string value;
+
+		if (option(argv[i], "--connections", value))
+			connections = (size_t)atoi(value.c_str());
+		else if (option(argv[i], "--threads", value))
+			threads = (size_t)atoi(value.c_str());
+		else if (option(argv[i], "--duration", value))
+			duration = atol(value.c_str());
+		else if (option(argv[i], "--server-threads", value))
+			server_threads = (size_t)atoi(value.c_str());
+		else if (strncmp(argv[i], "--", 2) == 0)
+			cerr << "load: unknown option " << argv[i] << endl;
+		else
+			args.push_back(argv[i]);
+	}
+
+	if (connections == 0)
+		connections = 1;
+	if (threads == 0)
+		threads = 1;
+
+	try
+	{
+		asio::io_service io_service;
+		boost::scoped_ptr<my::http::server> server;
+		tcp::endpoint endpoint;
+		string host, url;
+
+		if (args.size() >= 3)
+		{
+			tcp::resolver resolver(io_service);
+			endpoint = *resolver.resolve(
+				tcp::resolver::query(args[0], args[1]));
+			host = args[0];
+			url = args[2];
+		}
+		else
+		{
+			server.reset( new my::http::server(
+				tcp::endpoint(asio::ip::address_v4::loopback(), 0),
+				server_threads) );
+			server->route(L"/ping", ping);
+			server->start();
+
+			endpoint = server->endpoint();
+			host = "localhost";
+			url = "/ping";
+		}
+
+		const string request = "GET " + url + " HTTP/1.1\r\n"
+			"Host: " + host + "\r\n"
+			"\r\n";
+
+		cout << "connections: " << connections
+			<< ", threads: " << threads
+			<< ", duration: " << duration << " s" << endl;
+
+		const posix_time::ptime start = my::time::utc_now();
+		const posix_time::ptime deadline = start + posix_time::seconds(duration);
+
+		vector<load_connection_ptr> conns;
+		for (size_t i = 0; i < connections; i++)
+		{
+			conns.push_back( load_connection_ptr( new load_connection(
+				io_service, endpoint, request, deadline) ) );
+			conns.back()->start();
+		}
+
+		boost::thread_group group;
+		for (size_t i = 1; i < threads; i++)
+			group.create_thread( boost::bind(&asio::io_service::run, &io_service) );
+
+		io_service.run();
+		group.join_all();
+
+		const double seconds
+			= (double)(my::time::utc_now() - start).total_microseconds() / 1e6;
+
+		vector<long> latencies;
+		size_t errors = 0;
+
+		for (size_t i = 0; i < conns.size(); i++)
+		{
+			latencies.insert(latencies.end(),
+				conns[i]->latencies.begin(), conns[i]->latencies.end());
+			errors += conns[i]->errors;
+		}
+
+		sort(latencies.begin(), latencies.end());
+
+		cout << "requests: " << latencies.size()
+			<< ", errors: " << errors << endl
+			<< "requests/s: " << (long)((double)latencies.size() / seconds) << endl
+			<< "latency, us: 50% " << percentile(latencies, 50.0)
+			<< ", 90% " << percentile(latencies, 90.0)
+			<< ", 99% " << percentile(latencies, 99.0)
+			<< ", max " << (latencies.empty() ? 0 : latencies.back()) << endl;
+
+		if (server)
+			server->stop();
+	}
+	catch (std::exception &e)
+	{
+		cerr << "load: " << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
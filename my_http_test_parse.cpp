@@ -0,0 +1,385 @@
+﻿#include "my_http.h"
+#include "my_num.h"
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+/* Вывод с видимыми \r и \n */
+string show(const string &str)
+{
+	string out;
+	for (size_t i = 0; i < str.size(); i++)
+	{
+		if (str[i] == '\r')
+			out += "\\r";
+		else if (str[i] == '\n')
+			out += "\\n";
+		else
+			out += str[i];
+	}
+	return out;
+}
+
+string show(const boost::string_ref &str)
+{
+	return show(str.to_string());
+}
+
+const char* framing_name(my::http::body_reader::framing_type framing)
+{
+	switch (framing)
+	{
+		case my::http::body_reader::content_length: return "content_length";
+		case my::http::body_reader::chunked: return "chunked";
+		default: return "until_eof";
+	}
+}
+
+struct body_sink
+{
+	string *body;
+	body_sink(string &b) : body(&b) {}
+	void operator()(const char *data, size_t size)
+		{ body->append(data, size); }
+};
+
+/* Разбор тела порциями по step байт (step == 0 - всё сразу).
+	Возврат: текст результата (тело, сколько байт съедено, ошибка) */
+string parse_body(my::http::body_reader::framing_type framing,
+	unsigned long long length, const string &data, size_t split, bool eof)
+{
+	my::http::body_reader reader;
+	reader.reset(framing, length);
+
+	string body;
+	size_t used = 0;
+
+	try
+	{
+		/* Сначала [0, split), затем остаток */
+		if (split)
+			used = reader.parse(data.c_str(), split, body_sink(body));
+		if (used == split)
+			used += reader.parse(data.c_str() + used, data.size() - used,
+				body_sink(body));
+		if (eof && !reader.done())
+			reader.eof();
+	}
+	catch (my::exception &)
+	{
+		return "error";
+	}
+
+	return "body=[" + show(body) + "] used=" + my::num::to_string(used)
+		+ (reader.done() ? " done" : " not done");
+}
+
+/* Разбор по одному байту */
+string parse_body_bytes(my::http::body_reader::framing_type framing,
+	unsigned long long length, const string &data, bool eof)
+{
+	my::http::body_reader reader;
+	reader.reset(framing, length);
+
+	string body;
+	size_t used = 0;
+
+	try
+	{
+		while (used < data.size() && !reader.done())
+			used += reader.parse(data.c_str() + used, 1, body_sink(body));
+		if (eof && !reader.done())
+			reader.eof();
+	}
+	catch (my::exception &)
+	{
+		return "error";
+	}
+
+	return "body=[" + show(body) + "] used=" + my::num::to_string(used)
+		+ (reader.done() ? " done" : " not done");
+}
+
+void test_body(my::http::body_reader::framing_type framing,
+	unsigned long long length, const string &data, bool eof = false)
+{
+	cout << "framing=" << framing_name(framing);
+	if (framing == my::http::body_reader::content_length)
+		cout << " length=" << length;
+	cout << (eof ? " eof" : "") << endl;
+	cout << "data=" << show(data) << endl;
+
+	string res = parse_body(framing, length, data, 0, eof);
+	cout << "parse=" << res << endl;
+
+	/* Результат не должен зависеть от того, как разбиты данные */
+	bool same = (parse_body_bytes(framing, length, data, eof) == res);
+	for (size_t split = 1; same && split < data.size(); split++)
+		same = (parse_body(framing, length, data, split, eof) == res);
+	cout << "split=" << (same ? "same" : "FAILED") << endl;
+	cout << endl;
+}
+
+/* Разбор заголовка по мере поступления данных: buf растёт по одному
+	байту, начало буфера - то же */
+string parse_message(const string &data, bool is_request, size_t step)
+{
+	my::http::parser p;
+	string out;
+
+	try
+	{
+		size_t n = 0;
+		size_t size = (step ? 0 : data.size());
+
+		while (true)
+		{
+			if (step)
+				size = (size + step < data.size() ? size + step : data.size());
+
+			n = (is_request ? p.parse_request(data.c_str(), size)
+				: p.parse_reply(data.c_str(), size));
+
+			if (n || size == data.size())
+				break;
+		}
+
+		if (!n)
+			return "incomplete";
+
+		out += "size=" + my::num::to_string(n);
+		if (is_request)
+			out += " method=[" + show(p.method) + "] url=[" + show(p.url) + "]";
+		else
+			out += " status=" + my::num::to_string(p.status_code)
+				+ " message=[" + show(p.status_message) + "]";
+		out += " version=1." + my::num::to_string(p.minor_version);
+
+		for (size_t i = 0; i < p.fields().size(); i++)
+			out += "\n  [" + show(p.fields()[i].name) + "]=["
+				+ show(p.fields()[i].value) + "]";
+
+		unsigned long long length = 0;
+		my::http::body_reader::framing_type framing
+			= p.body_framing(length, is_request);
+		out += string("\n  framing=") + framing_name(framing);
+		if (framing == my::http::body_reader::content_length)
+			out += " length=" + my::num::to_string(length);
+		out += (p.keep_alive() ? " keep-alive" : " close");
+	}
+	catch (my::exception &)
+	{
+		out += (out.empty() ? "" : "\n  ");
+		out += "error";
+	}
+
+	return out;
+}
+
+void test_message(const string &data, bool is_request)
+{
+	cout << (is_request ? "request=" : "reply=") << show(data) << endl;
+
+	string res = parse_message(data, is_request, 0);
+	cout << res << endl;
+
+	bool same = true;
+	for (size_t step = 1; same && step < 4; step++)
+		same = (parse_message(data, is_request, step) == res);
+	cout << "split=" << (same ? "same" : "FAILED") << endl;
+	cout << endl;
+}
+
+void test_header_end(const string &data)
+{
+	size_t scanned = 0;
+	size_t n = my::http::find_header_end(data.c_str(), data.size(), scanned);
+	cout << "find_header_end(" << show(data) << ")=" << n;
+
+	/* По одному байту */
+	size_t n2 = 0;
+	scanned = 0;
+	for (size_t size = 1; !n2 && size <= data.size(); size++)
+		n2 = my::http::find_header_end(data.c_str(), size, scanned);
+	if (n2 != n)
+		cout << " (split FAILED: " << n2 << ")";
+	cout << endl;
+}
+
+void test_old_request(const string &line)
+{
+	cout << "parse_request(" << show(line) << ")";
+	try
+	{
+		string url;
+		my::http::params_type params;
+		my::http::parse_request(line, url, params);
+		cout << " url=[" << url << "]";
+		for (size_t i = 0; i < params.size(); i++)
+			cout << " [" << params[i].first << "]=[" << params[i].second << "]";
+	}
+	catch (my::exception &)
+	{
+		cout << " error";
+	}
+	cout << endl;
+}
+
+void test_old_reply(const string &line)
+{
+	cout << "parse_reply(" << show(line) << ")";
+	try
+	{
+		string message;
+		unsigned int code = my::http::parse_reply(line, message);
+		cout << " code=" << code << " message=[" << message << "]";
+	}
+	catch (my::exception &)
+	{
+		cout << " error";
+	}
+	cout << endl;
+}
+
+void test_old_header(const string &lines)
+{
+	cout << "parse_header(" << show(lines) << ")";
+	try
+	{
+		my::http::params_type params;
+		my::http::parse_header(lines, params);
+		for (size_t i = 0; i < params.size(); i++)
+			cout << " [" << params[i].first << "]=[" << params[i].second << "]";
+	}
+	catch (my::exception &)
+	{
+		cout << " error";
+	}
+	cout << endl;
+}
+
+int main()
+{
+	typedef my::http::body_reader br;
+
+	cout << "*** body_reader\n\n";
+
+	/* Content-Length */
+	test_body(br::content_length, 5, "hello");
+	test_body(br::content_length, 5, "helloGET / HTTP/1.1\r\n");
+	test_body(br::content_length, 0, "GET / HTTP/1.1\r\n");
+	test_body(br::content_length, 10, "short");
+	test_body(br::content_length, 10, "short", true);
+
+	/* chunked */
+	test_body(br::chunked, 0, "5\r\nhello\r\n0\r\n\r\n");
+	test_body(br::chunked, 0, "5\r\nhello\r\n7\r\n, world\r\n0\r\n\r\nNEXT");
+	test_body(br::chunked, 0, "A\r\n0123456789\r\n1a\r\nabcdefghijklmnopqrstuvwxyz\r\n0\r\n\r\n");
+	test_body(br::chunked, 0, "5;name=value\r\nhello\r\n0;last\r\n\r\n");
+	test_body(br::chunked, 0, "5 \r\nhello\r\n0\r\n\r\n");
+	test_body(br::chunked, 0, "5\r\nhello\r\n0\r\nExpires: never\r\nX-Sum: 1\r\n\r\nNEXT");
+	test_body(br::chunked, 0, "5\nhello\n0\nX-Trailer: 1\n\nNEXT");
+	test_body(br::chunked, 0, "0\r\n\r\n");
+	test_body(br::chunked, 0, "5\r\nhello\r\n0\r\n", true);
+
+	/* Ошибки в строке размера */
+	test_body(br::chunked, 0, "\r\nhello\r\n0\r\n\r\n");
+	test_body(br::chunked, 0, "x5\r\nhello\r\n0\r\n\r\n");
+	test_body(br::chunked, 0, ";ext\r\nhello\r\n0\r\n\r\n");
+	test_body(br::chunked, 0, "-5\r\nhello\r\n0\r\n\r\n");
+	test_body(br::chunked, 0, "10000000000000000\r\n");
+	test_body(br::chunked, 0, "5\r\nhelloX\r\n0\r\n\r\n");
+	test_body(br::chunked, 0, "5\r\nhello\r\r\n0\r\n\r\n");
+	test_body(br::chunked, 0, "0\r\n\rX");
+
+	/* until_eof */
+	test_body(br::until_eof, 0, "all the rest");
+	test_body(br::until_eof, 0, "all the rest", true);
+	test_body(br::until_eof, 0, "", true);
+
+	cout << "*** find_header_end\n\n";
+
+	test_header_end("");
+	test_header_end("\r\n");
+	test_header_end("\n");
+	test_header_end("GET / HTTP/1.1\r\n");
+	test_header_end("GET / HTTP/1.1\r\n\r\n");
+	test_header_end("GET / HTTP/1.1\r\nHost: a\r\n\r\nBODY");
+	test_header_end("GET / HTTP/1.1\nHost: a\n\nBODY");
+	test_header_end("GET / HTTP/1.1\r\nHost: a\n\r\nBODY");
+	test_header_end("GET / HTTP/1.1\r\nHost: a\r\r\n");
+	cout << endl;
+
+	cout << "*** parser\n\n";
+
+	test_message("GET /path?a=1&b=2 HTTP/1.1\r\nHost: example.com\r\n"
+		"Accept:  */*  \r\n\r\n", true);
+	test_message("POST /form HTTP/1.1\r\nContent-Length: 11\r\n"
+		"Connection: close\r\n\r\nhello world", true);
+	test_message("POST /up HTTP/1.1\r\nTransfer-Encoding: gzip, Chunked\r\n"
+		"Content-Length: 100\r\n\r\n", true);
+	test_message("GET / HTTP/1.0\nhost: a\nconnection: Keep-Alive\n\n", true);
+	test_message("GET / HTTP/1.0\r\n\r\n", true);
+	test_message("GET / HTTP/1.1\r\nConnection: keep-alive, Close\r\n\r\n", true);
+	test_message("GET / HTTP/1.1\r\nConnection: closed\r\n\r\n", true);
+	test_message("GET / HTTP/1.1\r\nContent-Length: 12x\r\n\r\n", true);
+	test_message("GET / HTTP/1.1\r\nContent-Length:\r\n\r\n", true);
+	test_message("GET /\r\n\r\n", true);
+	test_message("GET  / HTTP/1.1\r\n\r\n", true);
+	test_message("GET / HTTP/2.0\r\n\r\n", true);
+	test_message("GET / HTTP/1.1 \r\n\r\n", true);
+	test_message("GET / HTTP/1.1\r\nNo colon\r\n\r\n", true);
+	test_message("GET / HTTP/1.1\r\n : empty name\r\n\r\n", true);
+	test_message("GET / HTTP/1.1\r\nHost: a\r\n", true);
+
+	test_message("HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok", false);
+	test_message("HTTP/1.1 404 Not Found\r\nTransfer-Encoding: chunked\r\n\r\n", false);
+	test_message("HTTP/1.0 200 OK\r\nServer: x\r\n\r\n", false);
+	test_message("HTTP/1.1 204\r\n\r\n", false);
+	test_message("HTTP/1.1 301 \nLocation: /new\n\n", false);
+	test_message("HTTP/1.1 20 OK\r\n\r\n", false);
+	test_message("HTTP/1.1 abc OK\r\n\r\n", false);
+	test_message("HTTP/1.1200 OK\r\n\r\n", false);
+	test_message("HTTX/1.1 200 OK\r\n\r\n", false);
+
+	cout << "*** parse_request, parse_reply, parse_header\n\n";
+
+	test_old_request("GET /path HTTP/1.1\r\n");
+	test_old_request("GET /path?a=1&b=%41 HTTP/1.1\r\n");
+	test_old_request("GET /path?a HTTP/1.1\r\n");
+	test_old_request("POST /path HTTP/1.1\r\n");
+	test_old_request("GET /path HTTP/1.0\r\n");
+	test_old_request("GET /path HTTP/1.1\n");
+	test_old_request("GET /path HTTP/1.1");
+	test_old_request("GET");
+	test_old_request("");
+	cout << endl;
+
+	test_old_reply("HTTP/1.1 200 OK\r\n");
+	test_old_reply("HTTP/1.1 404 Page Not Found\r\n");
+	test_old_reply("HTTP/1.1 200\r\n");
+	test_old_reply("HTTP/1.1 200 \r\n");
+	test_old_reply("HTTP/1.1 OK\r\n");
+	test_old_reply("HTTP/1.0 200 OK\r\n");
+	test_old_reply("HTTP/1.1 200 OK\n");
+	test_old_reply("HTTP/1.1 200 OK");
+	test_old_reply("");
+	cout << endl;
+
+	test_old_header("\r\n");
+	test_old_header("Content-Type: text/plain; charset=utf8\r\n"
+		"Connection: close\r\n\r\n");
+	test_old_header("A:1\nB:  2 \n\n");
+	test_old_header("A: 1\r\n");
+	test_old_header("A: 1\r\n\r\nextra");
+	test_old_header("No colon\r\n\r\n");
+	test_old_header(": value\r\n\r\n");
+	test_old_header(" A: 1\r\n\r\n");
+	test_old_header("");
+	cout << endl;
+
+	return 0;
+}
@@ -31,7 +31,7 @@ private:
 	std::wostream &out_;
 	fs::wofstream fs_;
 	const int flags_;
-	const std::wstring time_format_;
+	const my::time::wformat time_format_;
 	boost::recursive_mutex rmutex_;
 	std::wstringstream buf_;
 	int state_;
@@ -40,7 +40,7 @@ private:
 	{
 		std::wstringstream ss;
 		ss << L"Log opened: " << my::time::to_wstring(
-			my::time::local_now(), time_format_.c_str());
+			my::time::local_now(), time_format_);
 
 		std::size_t sz = ss.str().size();
 		buf_ << std::wstring(sz, L'=') << std::endl
@@ -58,7 +58,7 @@ private:
 	{
 		std::wstringstream ss;
 		ss << L"Log closed: " << my::time::to_wstring(
-			my::time::local_now(), time_format_.c_str());
+			my::time::local_now(), time_format_);
 
 		std::size_t sz = ss.str().size();
 		buf_ << std::endl << std::wstring(sz, L'-') << std::endl
@@ -87,7 +87,7 @@ private:
 							buf_ << std::endl;
 
 						buf_ << my::time::to_wstring(
-							my::time::local_now(), time_format_.c_str());
+							my::time::local_now(), time_format_);
 
 						if ( !(flags_ & nothread) )
 						{
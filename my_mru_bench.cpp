@@ -0,0 +1,83 @@
+﻿#include "my_mru.h"
+#include "my_bench.h"
+
+#include <cstddef> /* std::size_t */
+#include <string>
+#include <vector>
+using namespace std;
+
+/* Кол-во подготовленных ключей (степень двойки - для быстрого
+	перебора по маске) */
+#define DATA_SIZE 4096
+
+int main(int argc, char *argv[])
+{
+	my::bench::runner bench(argc, argv);
+	my::bench::random rnd;
+
+	vector<int> keys(DATA_SIZE);
+	for (size_t i = 0; i < DATA_SIZE; i++)
+		keys[i] = (int)rnd(DATA_SIZE * 2);
+
+	size_t i = 0;
+
+	/* Список полностью помещается в ограничение */
+	{
+		my::mru::list<int, int> mru(DATA_SIZE * 2);
+		for (size_t j = 0; j < DATA_SIZE; j++)
+			mru.insert(keys[j], (int)j);
+
+		for (my::bench::timer t(bench, "mru", "find"); t.next(); )
+		{
+			my::bench::do_not_optimize(
+				mru.find(keys[i++ & (DATA_SIZE - 1)]) );
+		}
+
+		for (my::bench::timer t(bench, "mru", "up"); t.next(); )
+		{
+			my::bench::do_not_optimize(
+				mru.up(keys[i++ & (DATA_SIZE - 1)]) );
+		}
+
+		for (my::bench::timer t(bench, "mru", "operator[]"); t.next(); )
+		{
+			my::bench::do_not_optimize(
+				mru[keys[i++ & (DATA_SIZE - 1)]]++ );
+		}
+	}
+
+	/* Список вдвое меньше набора ключей - постоянное вытеснение */
+	{
+		my::mru::list<int, int> mru(DATA_SIZE / 2);
+
+		for (my::bench::timer t(bench, "mru", "insert(evict)"); t.next(); )
+		{
+			int key = keys[i++ & (DATA_SIZE - 1)];
+			my::bench::do_not_optimize( mru.insert(key, key) );
+		}
+	}
+
+	/* Ключ - строка */
+	{
+		vector<string> str_keys(DATA_SIZE);
+		for (size_t j = 0; j < DATA_SIZE; j++)
+			str_keys[j] = "key-" + string(1, (char)('a' + j % 26))
+				+ string(8, (char)('a' + keys[j] % 26));
+
+		my::mru::list<string, int> mru(DATA_SIZE / 2);
+
+		for (my::bench::timer t(bench, "mru", "insert<string>(evict)"); t.next(); )
+		{
+			const string &key = str_keys[i++ & (DATA_SIZE - 1)];
+			my::bench::do_not_optimize( mru.insert(key, 0) );
+		}
+
+		for (my::bench::timer t(bench, "mru", "find<string>"); t.next(); )
+		{
+			my::bench::do_not_optimize(
+				mru.find(str_keys[i++ & (DATA_SIZE - 1)]) );
+		}
+	}
+
+	return bench.report();
+}
@@ -4,19 +4,26 @@
 	В строку - свой алгоритм (первый придуманный алгоритм
 		оказался быстрее itoa и, даже (!), Boost.Spirit.Karma (после
 		создания его безопасной версии стал таким как последний).
+		Текущий вариант: кол-во цифр подсчитывается заранее, цифры
+		пишутся сразу в выходной буфер по две за одно деление
+		(таблица "00".."99") - ещё в 2-3 раза быстрее.
 
-	Из строки (to_signed, to_unsigned, to_real)- использую
-		Boost.Spirit2 (ужасно медленно компилируется, поэтому шаблоны
-		вынес в *.cpp (и чтоб они компилировались, а не игнорировались,
-		включил функцию my_num_dummy, которая задействует все возможные
-		варианты).
+	Из строки целые числа (to_signed, to_unsigned) - свой парсер:
+		цифры проверяются и преобразуются по 8 штук за раз (SWAR),
+		переполнение отслеживается точно. В 1.5-2 раза быстрее Spirit.
+
+	Вещественные числа из строки - алгоритм Eisel-Lemire (как
+		в fast_float): правильное округление без длинной арифметики
+		почти во всех случаях; в строку - кратчайшая запись,
+		при обратном чтении дающая то же число (Schubfach).
 
 	----------------------------------------
 
 	Функции преобразования числа в строку.
 
 	Поддерживаемые типы: char, short, int, long, long long
-		и их беззнаковые версии.
+		и их беззнаковые версии (и __int128, если поддерживается
+		компилятором).
 
 		----------
 
@@ -50,6 +57,24 @@
 
 			Преобразование числа value в строку.
 
+		----------
+
+		template<class Char>
+		size_t put(
+				Char *buf,
+				size_t buf_sz,
+				double value); (и float)
+
+		template<class Char>
+		std::basic_string<Char> to_str(double value);
+		std::string to_string(double value);
+		std::wstring to_wstring(double value);
+
+			Кратчайшая запись вещественного числа, при обратном
+			чтении дающая то же самое число: 0.1, 123.45, 1.5e-8,
+			1e+21, nan, inf, -inf. Если не входим в буфер - он
+			заполняется '#', как и для целых.
+
 
 	----------------------------------------
 
@@ -126,13 +151,86 @@
 			автоматически.
 
 			Возврат: успех преобразования, в res - полученное значение.
+
+
+	----------------------------------------
+
+	Пакетные функции - для столбцов данных (CSV и т.п.).
+
+	Поддерживаемые типы: все перечисленные выше целые и вещественные
+		(format_column - кроме long double).
+
+		----------
+
+		size_t parse_column(
+				const char *begin,
+				const char *end,
+				char delim,
+				type *out,
+				size_t out_sz,
+				unsigned char *status = 0);
+
+			Разбор полей, разделённых символом delim, в массив out
+			(не более out_sz значений). С SSE2/AVX2 (если включены
+			при компиляции) разделители ищутся заранее, пачкой по 64,
+			а целое поле до 16 цифр разбирается целиком, без ветвлений
+			на каждую цифру; без них - за один проход (цифры - по 8
+			за раз). Если delim - '\n', '\r' в конце поля
+			игнорируется. Разделитель в самом конце буфера пустого
+			поля не добавляет.
+
+			Ошибки не прерывают разбор: значение такого поля - 0,
+			в status (если задан, размером не меньше out_sz) - код:
+			field_ok, field_empty, field_invalid, field_overflow.
+
+			Возврат: кол-во разобранных полей.
+
+		----------
+
+		size_t format_column(
+				char *buf,
+				size_t buf_sz,
+				const type *values,
+				size_t count,
+				char delim,
+				size_t *written = 0);
+
+			Вывод значений через delim в буфер buf. Выводятся только
+			значения, целиком поместившиеся в буфер; их кол-во -
+			в written. Строка всегда завершается нулём.
+
+			Возврат: размер полученной строки.
 */
 
 #ifndef MY_NUM_H
 #define MY_NUM_H
 
+#include "my_str.h" /* my::str::end */
+
 #include <cstddef> /* std::size_t */
+#include <cstring> /* std::memcpy */
 #include <string>
+#include <limits>
+
+#include <boost/mpl/if.hpp>
+#include <boost/type_traits/make_unsigned.hpp>
+
+/* Векторные инструкции - только если разрешены при компиляции
+	(в заголовке - для пакетного разбора столбцов) */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MY_NUM_SIMD 32
+#elif defined(__SSE2__) || defined(_M_X64) \
+	|| defined(_M_IX86_FP) && _M_IX86_FP >= 2
+#include <emmintrin.h>
+#define MY_NUM_SIMD 16
+#else
+#define MY_NUM_SIMD 0
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h> /* _BitScanForward */
+#endif
 
 namespace my { namespace num {
 
@@ -147,147 +245,294 @@ namespace my { namespace num {
 #define NUM_TO_STR_BUF_SIZE 64
 
 /*
-	signed_to
+	Таблица пар цифр "00".."99" (200 байт) - преобразование
+	ведётся сразу по две цифры за одно деление
+*/
+inline const char* digit_pairs()
+{
+	static const char pairs[201] =
+		"00010203040506070809"
+		"10111213141516171819"
+		"20212223242526272829"
+		"30313233343536373839"
+		"40414243444546474849"
+		"50515253545556575859"
+		"60616263646566676869"
+		"70717273747576777879"
+		"80818283848586878889"
+		"90919293949596979899";
+	return pairs;
+}
 
-	Алгоритм преобразования целого числа со знаком в строку.
-	Ради производительности имеет ограничение - используется
-	временный буфер размером NUM_TO_STR_BUF_SIZE байт
-	(128 бит требует 39 байт).
+/*
+	Максимальное кол-во цифр в числе типа T - вычисляется
+	при компиляции (log10(2) ~ 643/2136)
+*/
+template<class T>
+struct max_digits
+{
+	enum { value = std::numeric_limits<T>::digits * 643 / 2136 + 1 };
+};
 
-	Напрямую использовать не рекомендуется, т.к. шаблон принимает
-	любые типы и результат такого действия не предсказуем.
+/*
+	Тип, в котором ведутся вычисления: беззнаковый, и не меньше
+	unsigned int (с короткими типами процессору работать не удобно)
 */
-template<class T, class Char>
-std::size_t put_signed(Char *buf, std::size_t buf_sz,
-	T n, std::size_t decimals = 0)
+template<class T>
+struct work_type
 {
-	static const Char sym[]
-		= { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+	typedef typename boost::make_unsigned<T>::type unsigned_type;
+	typedef typename boost::mpl::if_c<
+		(sizeof(unsigned_type) < sizeof(unsigned int)),
+		unsigned int, unsigned_type>::type type;
+};
 
-	/* Результат сохраняем во временный буфер в обратном порядке */
-	Char tmp[NUM_TO_STR_BUF_SIZE];
-	Char *tmp_ptr = tmp;
-	bool neg;
+/*
+	count_digits
 
-	/* Сохраняем знак. Операции проводим только с отрицательными
-		числами. Логичнее было бы проводить с положительными,
-		но не все отрицательные числа можно перевести
-		в положительные - например, (char)-128 */
-	if ( (neg = n < 0) == false)
-		n = -n;
+	Подсчёт кол-ва десятичных цифр числа
+*/
+template<class T>
+inline std::size_t count_digits(T n)
+{
+	/* По 4 цифры за одно деление */
+	std::size_t count = 1;
+	for (;;)
+	{
+		if (n < 10u)
+			return count;
+		if (n < 100u)
+			return count + 1;
+		if (n < 1000u)
+			return count + 2;
+		if (n < 10000u)
+			return count + 3;
+		n /= 10000u;
+		count += 4;
+	}
+}
 
-	do
+/* Для 64 бит - без делений: по номеру старшего бита определяем
+	кол-во цифр с точностью до одной, уточняем по таблице */
+inline std::size_t count_digits(unsigned long long n)
+{
+#if defined(__GNUC__)
+	static const unsigned long long pow10[20] =
 	{
-		T nn = n / 10;
-		*tmp_ptr++ = sym[ (nn<<3) + (nn<<1) - n ];
-		n = nn;
-	} while (n);
+		1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+		10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+		100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+		100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+		100000000000000000ULL, 1000000000000000000ULL,
+		10000000000000000000ULL
+	};
+
+	/* Младший бит на кол-во цифр не влияет, зато избавляет от нуля */
+	n |= 1;
+	std::size_t t = (64 - __builtin_clzll(n)) * 1233 >> 12;
+	return t + (n >= pow10[t]);
+#else
+	return count_digits<unsigned long long>(n);
+#endif
+}
 
-	/* На данный момент во временном буфере хранится число
-		в обратном порядке, без знака и без завершающего нуля */
+inline std::size_t count_digits(unsigned long n)
+	{ return count_digits((unsigned long long)n); }
 
-	/* Заполняем выходную строку. Отдельно, если не входим
-		в ограничение размера (###), отдельно - если входим */
-	Char *ptr = buf;
-	//Char *end = buf + buf_sz;
+/*
+	write_digits
+
+	Вывод цифр числа n в буфер, заканчивающийся в end (вывод ведётся
+	с конца). Размер буфера должен быть рассчитан заранее (count_digits).
+*/
+template<class T, class Char>
+inline void write_digits(Char *end, T n)
+{
+	const char *pairs = digit_pairs();
+
+	while (n >= 100u)
+	{
+		unsigned int i = static_cast<unsigned int>(n % 100u) * 2;
+		n /= 100u;
+		*--end = Char(pairs[i + 1]);
+		*--end = Char(pairs[i]);
+	}
+
+	if (n < 10u)
+		*--end = Char('0' + static_cast<unsigned int>(n));
+	else
+	{
+		unsigned int i = static_cast<unsigned int>(n) * 2;
+		*--end = Char(pairs[i + 1]);
+		*--end = Char(pairs[i]);
+	}
+}
 
-	std::size_t tmp_sz = tmp_ptr - tmp;
-	std::size_t zero_count = (decimals > tmp_sz ? decimals - tmp_sz : 0);
+/* 64 бит: пока число не влезает в 32 бита, отделяем по 8 цифр
+	- дальше работаем с 32-битными числами, это заметно быстрее */
+template<class Char>
+inline void write_digits(Char *end, unsigned long long n)
+{
+	const char *pairs = digit_pairs();
 
-	if (tmp_sz + zero_count + neg >= buf_sz)
+	while (n >> 32)
 	{
-		if (buf_sz != 0)
-		{
-			Char *last = buf + buf_sz - 1;
-			while (ptr != last)
-   				*ptr++ = '#';
+		unsigned int part = static_cast<unsigned int>(n % 100000000u);
+		n /= 100000000u;
 
-   			*ptr = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			unsigned int i = (part % 100u) * 2;
+			part /= 100u;
+			*--end = Char(pairs[i + 1]);
+			*--end = Char(pairs[i]);
 		}
-   	}
-   	else
-   	{
-		if (neg)
-			*ptr++ = '-';
+	}
 
-		Char *zero_end = ptr + zero_count;
-		while (ptr < zero_end)
-			*ptr++ = '0';
+	write_digits(end, static_cast<unsigned int>(n));
+}
 
-		while (tmp_ptr != tmp)
-   			*ptr++ = *--tmp_ptr;
+template<class Char>
+inline void write_digits(Char *end, unsigned long n)
+{
+	if (sizeof(unsigned long) > sizeof(unsigned int))
+		write_digits(end, static_cast<unsigned long long>(n));
+	else
+		write_digits(end, static_cast<unsigned int>(n));
+}
 
-		*ptr = 0;
-   	}
+#if defined(__SIZEOF_INT128__)
+/* 128 бит: делим на части по 19 цифр, дальше - 64-битная арифметика.
+	Деление 128-битных чисел - медленная библиотечная функция */
+inline std::size_t count_digits(unsigned __int128 n)
+{
+	const unsigned long long e19 = 10000000000000000000ULL;
 
-	return ptr - buf;
+	std::size_t count = 0;
+	while (n >> 64)
+	{
+		n /= e19;
+		count += 19;
+	}
+
+	return count + count_digits((unsigned long long)n);
 }
 
-/*
-	unsigned_to
+template<class Char>
+inline void write_digits(Char *end, unsigned __int128 n)
+{
+	const unsigned long long e19 = 10000000000000000000ULL;
 
-	Алгоритм преобразования целого числа без знака в строку.
-	Ради производительности имеет ограничение - используется
-	временный буфер размером NUM_TO_STR_BUF_SIZE байт
-	(128 бит требует 39 байт).
+	while (n >> 64)
+	{
+		unsigned long long part = (unsigned long long)(n % e19);
+		n /= e19;
+
+		/* Часть выводится вместе с ведущими нулями */
+		Char *begin = end - 19;
+		write_digits(end, part);
+		end -= count_digits(part);
+		while (end != begin)
+			*--end = Char('0');
+	}
+
+	write_digits(end, (unsigned long long)n);
+}
+#endif
 
-	Напрямую использовать не рекомендуется, т.к. шаблон принимает
-	любые типы и результат такого действия не предсказуем.
-*/
+/*
+	put_overflow
 
-template<class T, class Char>
-std::size_t put_unsigned(Char *buf, std::size_t buf_sz,
-	T n, std::size_t decimals = 0)
+	Число не входит в буфер - буфер заполняется '#'.
+*/
+template<class Char>
+inline std::size_t put_overflow(Char *buf, std::size_t buf_sz)
 {
-	static const Char sym[]
-		= { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+	if (buf_sz == 0)
+		return 0;
 
-	/* Результат сохраняем во временный буфер в обратном порядке */
-	Char tmp[NUM_TO_STR_BUF_SIZE];
-	Char *tmp_ptr = tmp;
+	Char *ptr = buf;
+	Char *last = buf + buf_sz - 1;
+	while (ptr != last)
+		*ptr++ = '#';
 
-	do
-	{
-		T nn = n / 10;
-		*tmp_ptr++ = sym[ n - (nn<<3) - (nn<<1) ];
-		n = nn;
-	} while (n);
+	*ptr = 0;
+	return ptr - buf;
+}
+
+/*
+	put_digits
+
+	Вывод числа (по модулю) со знаком и ведущими нулями. Если
+	не входим в ограничение размера - буфер заполняется '#'.
+*/
+template<class U, class Char>
+inline std::size_t put_digits(Char *buf, std::size_t buf_sz,
+	U n, bool neg, std::size_t decimals)
+{
+	std::size_t digits = count_digits(n);
+	std::size_t zero_count = (decimals > digits ? decimals - digits : 0);
+	std::size_t size = digits + zero_count + neg;
 
-	/* На данный момент в буфере хранится число в обратном
-		порядке, без завершающего нуля */
+	if (size >= buf_sz)
+		return put_overflow(buf, buf_sz);
 
-	/* Заполняем выходную строку. Отдельно, если не входим
-		в ограничение размера (###), отдельно - если входим */
 	Char *ptr = buf;
-	//Char *end = buf + buf_sz;
 
-	std::size_t tmp_sz = tmp_ptr - tmp;
-	std::size_t zero_count = (decimals > tmp_sz ? decimals - tmp_sz : 0);
+	if (neg)
+		*ptr++ = '-';
 
-	if (tmp_sz + zero_count >= buf_sz)
-	{
-		if (buf_sz != 0)
-		{
-			Char *last = buf + buf_sz - 1;
-			while (ptr != last)
-   				*ptr++ = '#';
+	Char *zero_end = ptr + zero_count;
+	while (ptr < zero_end)
+		*ptr++ = '0';
 
-   			*ptr = 0;
-		}
-   	}
-   	else
-   	{
-		Char *zero_end = ptr + zero_count;
-		while (ptr < zero_end)
-			*ptr++ = '0';
+	ptr += digits;
+	write_digits(ptr, n);
+	*ptr = 0;
 
-		while (tmp_ptr != tmp)
-   			*ptr++ = *--tmp_ptr;
+	return size;
+}
 
-		*ptr = 0;
-   	}
+/*
+	signed_to
 
-	return ptr - buf;
+	Алгоритм преобразования целого числа со знаком в строку.
+	Кол-во цифр подсчитывается заранее, поэтому цифры пишутся
+	сразу на своё место в выходном буфере - по две за одно
+	деление (см. digit_pairs).
+
+	Напрямую использовать не рекомендуется, т.к. шаблон принимает
+	любые типы и результат такого действия не предсказуем.
+*/
+template<class T, class Char>
+inline std::size_t put_signed(Char *buf, std::size_t buf_sz,
+	T n, std::size_t decimals = 0)
+{
+	typedef typename work_type<T>::type U;
+
+	/* Модуль числа получаем в беззнаковом типе - так корректно
+		обрабатываются и минимальные значения, например, (char)-128 */
+	bool neg = n < 0;
+	U u = neg ? U(0) - U(n) : U(n);
+
+	return put_digits(buf, buf_sz, u, neg, decimals);
+}
+
+/*
+	unsigned_to
+
+	Алгоритм преобразования целого числа без знака в строку
+	(см. signed_to).
+
+	Напрямую использовать не рекомендуется, т.к. шаблон принимает
+	любые типы и результат такого действия не предсказуем.
+*/
+template<class T, class Char>
+inline std::size_t put_unsigned(Char *buf, std::size_t buf_sz,
+	T n, std::size_t decimals = 0)
+{
+	typedef typename work_type<T>::type U;
+	return put_digits(buf, buf_sz, U(n), false, decimals);
 }
 
 /*
@@ -336,39 +581,449 @@ DEF_NUM_TO_FUNCS(unsigned,unsigned int)
 DEF_NUM_TO_FUNCS(unsigned,unsigned long)
 DEF_NUM_TO_FUNCS(unsigned,unsigned long long)
 
+#if defined(__SIZEOF_INT128__)
+DEF_NUM_TO_FUNCS(signed,__int128)
+DEF_NUM_TO_FUNCS(unsigned,unsigned __int128)
+#endif
+
+
+/*
+	Функции преобразования вещественных чисел в строку
+
+	Кратчайшая запись, при обратном чтении дающая то же самое число
+	(алгоритм Schubfach, см. my_num.cpp). Оформление - как в JavaScript:
+	обычная запись для чисел от 1e-7 до 1e21, иначе - экспоненциальная
+	(1.5e-8, 1e+21); nan, inf, -inf.
+
+	format_real - в буфер размером не меньше NUM_TO_STR_BUF_SIZE,
+	возврат - длина строки.
+*/
+
+std::size_t format_real(char *buf, double value);
+std::size_t format_real(char *buf, float value);
+
+template<class T, class Char>
+inline std::size_t put_real(Char *buf, std::size_t buf_sz, T value)
+{
+	char tmp[NUM_TO_STR_BUF_SIZE];
+	std::size_t size = format_real(tmp, value);
+
+	if (size >= buf_sz)
+		return put_overflow(buf, buf_sz);
+
+	for (std::size_t i = 0; i <= size; i++)
+		buf[i] = Char(tmp[i]);
+
+	return size;
+}
+
+template<class T, class Char>
+inline std::basic_string<Char> real_to_str(T value)
+{
+	Char buf[NUM_TO_STR_BUF_SIZE];
+	std::size_t size = put_real<T,Char>(buf, sizeof(buf) / sizeof(*buf), value);
+	return std::basic_string<Char>(buf, size);
+}
+
+#define DEF_REAL_TO_FUNCS(T)\
+template<class Char>\
+inline std::size_t put(Char *str, std::size_t size, T n)\
+	{ return put_real<T,Char>(str, size, n); }\
+template<class Char>\
+inline std::basic_string<Char> to_str(T n)\
+	{ return real_to_str<T,Char>(n); }\
+inline std::string to_string(T n)\
+	{ return to_str<char>(n); }\
+inline std::wstring to_wstring(T n)\
+	{ return to_str<wchar_t>(n); }
+
+DEF_REAL_TO_FUNCS(float)
+DEF_REAL_TO_FUNCS(double)
+
 
 /*
 	Функции преобразования строки в число
 */
 
+
+/*
+	Разбор целых чисел - свой парсер вместо Boost.Spirit. Цифры
+	char-строк проверяются и преобразуются сразу по 8 штук (SWAR -
+	восемь символов в одном 64-битном числе), переполнение
+	отслеживается точно, по каждой цифре.
+
+	SWAR-вариант рассчитан на little-endian (первый символ строки -
+	младший байт числа), на остальных платформах - обычный цикл.
+*/
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ \
+	|| defined(_M_IX86) || defined(_M_X64) || defined(_M_AMD64)
+#define MY_NUM_SWAR 1
+#else
+#define MY_NUM_SWAR 0
+#endif
+
+#if MY_NUM_SWAR
+
+/* Загрузка 8 символов в 64-битное число. Для char - простое
+	копирование. Для wchar_t упаковка символов в байты обходится
+	дороже, чем экономит (проверено на my_num_bench), поэтому такие
+	строки разбираются обычным циклом (возврат false) */
+inline bool load_8chars(const char *ptr, unsigned long long &v)
+{
+	std::memcpy(&v, ptr, sizeof(v));
+	return true;
+}
+
+template<class Char>
+inline bool load_8chars(const Char *, unsigned long long &)
+	{ return false; }
+
+/* Маска "не цифр": байт нулевой, если символ - цифра. Переносы
+	при сложении возможны только из байта-не цифры, поэтому портятся
+	лишь байты, стоящие после первой не цифры - это нам не мешает */
+inline unsigned long long nondigit_mask(unsigned long long v)
+{
+	return ((v & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL)
+		| (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL)
+			^ 0x3030303030303030ULL);
+}
+
+/* Кол-во цифр в начале (номер первого ненулевого байта маски) */
+inline unsigned int leading_digits(unsigned long long mask)
+{
+#if defined(__GNUC__)
+	return static_cast<unsigned int>(__builtin_ctzll(mask)) >> 3;
+#else
+	unsigned int n = 0;
+	while ((mask & 0xFF) == 0)
+	{
+		mask >>= 8;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/* Преобразование 8 цифр в число: сначала пары, потом четвёрки,
+	в конце - восьмёрка. Три умножения вместо восьми */
+inline unsigned int parse_8digits(unsigned long long v)
+{
+	v -= 0x3030303030303030ULL;
+	v = (v * 10) + (v >> 8);
+	v = (((v & 0x000000FF000000FFULL) * 0x000F424000000064ULL)
+		+ (((v >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >> 32;
+	return static_cast<unsigned int>(v);
+}
+
+#endif /* MY_NUM_SWAR */
+
+/*
+	parse_digits
+
+	Разбор цифр из [ptr, end) в число типа Type (вычисления - в U),
+	не превышающее max + extra (extra - 0 или 1: модуль отрицательного
+	числа на единицу больше максимального положительного). Последняя
+	цифра max (2^n-1) никогда не равна 9, так что прибавление extra
+	её не переносит.
+
+	Возврат: указатель на первый не разобранный символ; в res -
+	накопленное значение; overflow - признак того, что разбор
+	остановлен из-за переполнения (ptr - на "лишней" цифре).
+*/
+template<class Type, class U, class Char>
+inline const Char* parse_digits(const Char *ptr, const Char *end,
+	unsigned int extra, U &res, bool &overflow)
+{
+	const U max = U(std::numeric_limits<Type>::max());
+	const Char *begin = ptr;
+	U n = 0;
+	overflow = false;
+
+#if MY_NUM_SWAR
+	/* По 8 цифр, пока переполнение невозможно в принципе */
+	if (max >= 99999999u)
+	{
+		const U safe = (max - 99999999u) / 100000000u;
+
+		while (end - ptr >= 8 && n <= safe)
+		{
+			unsigned long long v;
+			if (!load_8chars(ptr, v))
+				break;
+
+			unsigned long long mask = nondigit_mask(v);
+
+			if (mask == 0)
+			{
+				n = n * 100000000u + parse_8digits(v);
+				ptr += 8;
+				continue;
+			}
+
+			/* Цифр меньше восьми - сдвигаем их в старшие байты,
+				младшие заполняем нулями ('0') */
+			unsigned int count = leading_digits(mask);
+			if (count)
+			{
+				static const unsigned int pow10[8] =
+					{ 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000 };
+				unsigned int shift = (8 - count) * 8;
+				v = (v << shift) | (0x3030303030303030ULL >> (64 - shift));
+				n = n * pow10[count] + parse_8digits(v);
+				ptr += count;
+			}
+
+			res = n;
+			return ptr;
+		}
+	}
+#endif
+
+	/* Пока цифр меньше, чем в max, переполнения быть не может -
+		проверяем только конец цифр */
+	const std::ptrdiff_t safe_count = max_digits<Type>::value - 1;
+	if (ptr - begin < safe_count)
+	{
+		const Char *safe_end = (end - begin > safe_count
+			? begin + safe_count : end);
+
+		for (; ptr != safe_end; ++ptr)
+		{
+			unsigned int d = static_cast<unsigned int>(*ptr - Char('0'));
+			if (d > 9)
+			{
+				res = n;
+				return ptr;
+			}
+			n = n * 10u + d;
+		}
+	}
+
+	/* Остаток - с точной проверкой переполнения */
+	const U limit10 = max / 10u;
+	const unsigned int limit_digit = static_cast<unsigned int>(max % 10u) + extra;
+
+	for (; ptr != end; ++ptr)
+	{
+		unsigned int d = static_cast<unsigned int>(*ptr - Char('0'));
+		if (d > 9)
+			break;
+
+		if (n > limit10 || (n == limit10 && d > limit_digit))
+		{
+			/* Повторяем поведение Boost.Spirit: если умножение
+				ещё возможно, оно уже произошло */
+			if (n <= limit10)
+				n *= 10u;
+			overflow = true;
+			break;
+		}
+
+		n = n * 10u + d;
+	}
+
+	res = n;
+	return ptr;
+}
+
+/*
+	get_signed и get_unsigned
+
+	Разбор целого числа. Знак ('+' или '-') допускается только
+	для знаковых типов. Если цифр нет - res не меняется, возврат 0.
+	При переполнении разбор останавливается на цифре, вызвавшей
+	переполнение, в res - значение, накопленное до неё.
+
+	parse_signed и parse_unsigned возвращают указатель на первый
+	не разобранный символ, ok - признак успешного разбора.
+*/
 template<class Char, class Type>
-std::size_t get_signed(const Char *str, std::size_t str_sz, Type &res);
+inline const Char* parse_signed(const Char *str, const Char *end,
+	Type &res, bool &ok)
+{
+	typedef typename work_type<Type>::type U;
+
+	const Char *ptr = str;
+	bool neg = false;
+
+	if (ptr != end && (*ptr == Char('-') || *ptr == Char('+')))
+		neg = (*ptr++ == Char('-'));
+
+	U n;
+	bool overflow;
+	const Char *digits = ptr;
+	ptr = parse_digits<Type>(ptr, end, neg ? 1u : 0u, n, overflow);
+
+	if (ptr == digits)
+	{
+		ok = false;
+		return str;
+	}
+
+	res = neg ? Type(U(0) - n) : Type(n);
+	ok = !overflow;
+	return ptr;
+}
 
 template<class Char, class Type>
-Type to_signed_def(const Char *str, std::size_t str_sz, Type def);
+inline const Char* parse_unsigned(const Char *str, const Char *end,
+	Type &res, bool &ok)
+{
+	typedef typename work_type<Type>::type U;
+
+	U n;
+	bool overflow;
+	const Char *ptr = parse_digits<Type>(str, end, 0, n, overflow);
+
+	if (ptr == str)
+	{
+		ok = false;
+		return str;
+	}
+
+	res = Type(n);
+	ok = !overflow;
+	return ptr;
+}
 
 template<class Char, class Type>
-bool try_to_signed(const Char *str, std::size_t str_sz, Type &res);
+inline std::size_t get_signed(const Char *str, std::size_t str_sz, Type &res)
+{
+	bool ok;
+	return parse_signed(str, my::str::end(str, str_sz), res, ok) - str;
+}
 
+template<class Char, class Type>
+inline Type to_signed_def(const Char *str, std::size_t str_sz, Type def)
+{
+	const Char *end = my::str::end(str, str_sz);
+	Type res;
+	bool ok;
+	return parse_signed(str, end, res, ok) == end && ok ? res : def;
+}
 
 template<class Char, class Type>
-std::size_t get_unsigned(const Char *str, std::size_t str_sz, Type &res);
+inline bool try_to_signed(const Char *str, std::size_t str_sz, Type &res)
+{
+	const Char *end = my::str::end(str, str_sz);
+	Type tmp;
+	bool ok;
+
+	if (parse_signed(str, end, tmp, ok) != end || !ok)
+		return false;
+
+	res = tmp;
+	return true;
+}
 
 template<class Char, class Type>
-Type to_unsigned_def(const Char *str, std::size_t str_sz, Type def);
+inline std::size_t get_unsigned(const Char *str, std::size_t str_sz, Type &res)
+{
+	bool ok;
+	return parse_unsigned(str, my::str::end(str, str_sz), res, ok) - str;
+}
+
+template<class Char, class Type>
+inline Type to_unsigned_def(const Char *str, std::size_t str_sz, Type def)
+{
+	const Char *end = my::str::end(str, str_sz);
+	Type res;
+	bool ok;
+	return parse_unsigned(str, end, res, ok) == end && ok ? res : def;
+}
 
 template<class Char, class Type>
-bool try_to_unsigned(const Char *str, std::size_t str_sz, Type &res);
+inline bool try_to_unsigned(const Char *str, std::size_t str_sz, Type &res)
+{
+	const Char *end = my::str::end(str, str_sz);
+	Type tmp;
+	bool ok;
+
+	if (parse_unsigned(str, end, tmp, ok) != end || !ok)
+		return false;
+
+	res = tmp;
+	return true;
+}
+
 
+/*
+	parse_real
+
+	Разбор вещественного числа (Eisel-Lemire, см. my_num.cpp).
+	Сам алгоритм работает с char, для остальных типов символов
+	запись числа сначала копируется в узкий буфер. При переполнении
+	в res - бесконечность, ok - false.
+*/
+const char* parse_real(const char *str, const char *end, float &res, bool &ok);
+const char* parse_real(const char *str, const char *end, double &res, bool &ok);
+const char* parse_real(const char *str, const char *end, long double &res, bool &ok);
+
+/* Символы, которые могут входить в запись числа (вместе с inf и nan(...)) */
+template<class Char>
+inline bool is_real_char(Char ch)
+{
+	return (ch >= Char('0') && ch <= Char('9'))
+		|| (ch >= Char('a') && ch <= Char('z'))
+		|| (ch >= Char('A') && ch <= Char('Z'))
+		|| ch == Char('.') || ch == Char('+') || ch == Char('-')
+		|| ch == Char('(') || ch == Char(')') || ch == Char('_');
+}
 
 template<class Char, class Type>
-std::size_t get_real(const Char *str, std::size_t str_sz, Type &res);
+inline const Char* parse_real(const Char *str, const Char *end,
+	Type &res, bool &ok)
+{
+	const Char *ptr = str;
+	while (ptr != end && is_real_char(*ptr))
+		++ptr;
+
+	std::size_t size = ptr - str;
+	char local[NUM_TO_STR_BUF_SIZE];
+	std::string heap;
+	char *narrow = local;
+
+	if (size > sizeof(local))
+	{
+		heap.resize(size);
+		narrow = &heap[0];
+	}
+
+	for (std::size_t i = 0; i < size; i++)
+		narrow[i] = char(str[i]);
+
+	return str + (parse_real(narrow, narrow + size, res, ok) - narrow);
+}
 
 template<class Char, class Type>
-Type to_real_def(const Char *str, std::size_t str_sz, Type def);
+inline std::size_t get_real(const Char *str, std::size_t str_sz, Type &res)
+{
+	bool ok;
+	return parse_real(str, my::str::end(str, str_sz), res, ok) - str;
+}
 
 template<class Char, class Type>
-bool try_to_real(const Char *str, std::size_t str_sz, Type &res);
+inline Type to_real_def(const Char *str, std::size_t str_sz, Type def)
+{
+	const Char *end = my::str::end(str, str_sz);
+	Type res;
+	bool ok;
+	return parse_real(str, end, res, ok) == end && ok ? res : def;
+}
+
+template<class Char, class Type>
+inline bool try_to_real(const Char *str, std::size_t str_sz, Type &res)
+{
+	const Char *end = my::str::end(str, str_sz);
+	Type tmp;
+	bool ok;
+
+	if (parse_real(str, end, tmp, ok) != end || !ok)
+		return false;
+
+	res = tmp;
+	return true;
+}
 
 
 #define DEF_TO_NUM_FUNCS(S,N,T)\
@@ -408,6 +1063,334 @@ DEF_TO_NUM_FUNCS(real,float,float)
 DEF_TO_NUM_FUNCS(real,double,double)
 DEF_TO_NUM_FUNCS(real,long_double,long double)
 
+
+/*
+	Пакетные функции
+*/
+
+enum
+{
+	field_ok = 0,
+	field_empty = 1,
+	field_invalid = 2,
+	field_overflow = 3
+};
+
+/* Номер младшего установленного бита (mask != 0) - позиция
+	найденного символа по маске векторного сравнения */
+inline unsigned int lowest_bit(unsigned int mask)
+{
+#if defined(__GNUC__)
+	return static_cast<unsigned int>(__builtin_ctz(mask));
+#elif defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return static_cast<unsigned int>(index);
+#else
+	unsigned int n = 0;
+	while (!(mask & 1))
+	{
+		mask >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+	find_delim
+
+	Поиск разделителя: сразу в 16/32 байтах (SSE2/AVX2) - векторная
+	версия в my_num.cpp. Возврат: указатель на разделитель или end.
+*/
+const char* find_delim(const char *ptr, const char *end, char delim);
+
+/*
+	find_delims
+
+	Поиск подряд нескольких разделителей (тем же сравнением сразу
+	16/32 байтов): в out - указатели на первые out_sz разделителей.
+	Возврат: кол-во найденных (меньше out_sz - дошли до end).
+*/
+std::size_t find_delims(const char *ptr, const char *end, char delim,
+	const char **out, std::size_t out_sz);
+
+/*
+	parse_value - разбор начала поля тем же разбором, что и в get
+*/
+template<class T>
+inline const char* parse_value(const char *ptr, const char *end,
+	T &res, bool &ok)
+{
+	return std::numeric_limits<T>::is_signed
+		? parse_signed(ptr, end, res, ok)
+		: parse_unsigned(ptr, end, res, ok);
+}
+
+inline const char* parse_value(const char *ptr, const char *end,
+	float &res, bool &ok)
+	{ return parse_real(ptr, end, res, ok); }
+
+inline const char* parse_value(const char *ptr, const char *end,
+	double &res, bool &ok)
+	{ return parse_real(ptr, end, res, ok); }
+
+inline const char* parse_value(const char *ptr, const char *end,
+	long double &res, bool &ok)
+	{ return parse_real(ptr, end, res, ok); }
+
+/*
+	parse_field
+
+	Разбор поля [ptr, field_end) обычным путём - тем же разбором, что
+	и в get (вещественные, поля с ошибкой, '\r' перед '\n' и т.п.).
+	Возврат: код (field_ok и т.д.).
+*/
+template<class T>
+unsigned char parse_field(const char *ptr, const char *field_end,
+	char delim, T &res)
+{
+	const char *value_end = field_end;
+	if (delim == '\n' && value_end != ptr && value_end[-1] == '\r')
+		--value_end;
+
+	bool ok;
+	const char *last = parse_value(ptr, value_end, res, ok);
+
+	if (ok && last == value_end)
+		return field_ok;
+
+	res = T();
+
+	if (ptr == value_end)
+		return field_empty;
+
+	/* Вещественное - разобрано до конца, но не уместилось в тип */
+	if (!std::numeric_limits<T>::is_integer)
+		return (last == value_end ? field_overflow : field_invalid);
+
+	/* Целое - разбор остановлен на цифре: если дальше до конца
+		поля только цифры - переполнение, иначе это просто не число */
+	if (ok || last == ptr)
+		return field_invalid;
+
+	for (; last != value_end; ++last)
+		if (static_cast<unsigned int>(*last - '0') > 9)
+			return field_invalid;
+
+	return field_overflow;
+}
+
+#if MY_NUM_SIMD
+/*
+	parse_int_digits
+
+	Разбор целого поля, конец которого уже известен, без поцифровых
+	ветвлений (в столбце длины чисел разные, и поцифровой цикл - это
+	ошибки предсказания переходов на каждом поле; знак - тоже): 16
+	байтов, заканчивающихся концом поля, читаются целиком, байты до
+	начала цифр обнуляются по маске, все цифры проверяются сразу
+	и сворачиваются в 16-значное число умножениями со сложением пар
+	(pmaddwd). Поле должно отстоять от начала буфера begin не меньше
+	чем на 16 байтов, ptr - указывать на доступный символ (в пустом
+	поле - на разделитель).
+
+	Возврат: false - поле надо разбирать обычным путём (нет цифр или
+	их больше 16, в поле не только цифры, переполнение, поле близко
+	к началу буфера).
+*/
+template<class T>
+inline bool parse_int_digits(const char *begin, const char *ptr,
+	const char *field_end, T &res)
+{
+	typedef typename work_type<T>::type U;
+
+	/* Маска цифр: с позиции count - 16 байтов, последние count -
+		единичные */
+	static const unsigned char digits_mask[32] =
+	{
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+		0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+	};
+
+	unsigned int neg = 0;
+	if (std::numeric_limits<T>::is_signed)
+	{
+		neg = (*ptr == '-');
+		ptr += (neg | (*ptr == '+'));
+	}
+
+	const std::size_t count = field_end - ptr;
+	if (count - 1 >= 16 || field_end - begin < 16)
+		return false;
+
+	const __m128i mask = _mm_loadu_si128(
+		reinterpret_cast<const __m128i*>(digits_mask + count));
+	__m128i x = _mm_and_si128(mask, _mm_sub_epi8(
+		_mm_loadu_si128(reinterpret_cast<const __m128i*>(field_end - 16)),
+		_mm_set1_epi8('0')));
+
+	/* Не цифра - байт больше 9: у него или у него же + 118 старший
+		бит единичный */
+	if (_mm_movemask_epi8(_mm_or_si128(x, _mm_add_epi8(x, _mm_set1_epi8(118)))))
+		return false;
+
+	/* Пары цифр (в 16-битных словах: старшая цифра - в младшем
+		байте), четвёрки, восьмёрки */
+	x = _mm_add_epi16(_mm_srli_epi16(x, 8), _mm_mullo_epi16(
+		_mm_and_si128(x, _mm_set1_epi16(0xFF)), _mm_set1_epi16(10)));
+	x = _mm_madd_epi16(x, _mm_set1_epi32(0x00010064));
+	x = _mm_madd_epi16(_mm_packs_epi32(x, x), _mm_set1_epi32(0x00012710));
+
+	const unsigned long long value
+		= static_cast<unsigned int>(_mm_cvtsi128_si32(x)) * 100000000ULL
+		+ static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(x, 4)));
+
+	if (value > static_cast<unsigned long long>(
+			U(std::numeric_limits<T>::max()) + neg))
+		return false;
+
+	/* Смена знака - без ветвления: (value ^ -1) + 1 */
+	const U sign = U(0) - U(neg);
+	res = T((U(value) ^ sign) + U(neg));
+	return true;
+}
+
+inline bool parse_int_digits(const char *, const char *, const char *,
+	float &) { return false; }
+
+inline bool parse_int_digits(const char *, const char *, const char *,
+	double &) { return false; }
+
+inline bool parse_int_digits(const char *, const char *, const char *,
+	long double &) { return false; }
+
+template<class T>
+inline unsigned char parse_column_field(const char *begin, const char *ptr,
+	const char *field_end, char delim, T &res)
+{
+	return parse_int_digits(begin, ptr, field_end, res)
+		? static_cast<unsigned char>(field_ok)
+		: parse_field(ptr, field_end, delim, res);
+}
+#endif
+
+template<class T>
+std::size_t parse_column(const char *begin, const char *end, char delim,
+	T *out, std::size_t out_sz, unsigned char *status = 0)
+{
+	const char *ptr = begin;
+	T *res = out;
+	T *const res_end = out + out_sz;
+
+#if MY_NUM_SIMD
+	/* Концы полей ищутся заранее, пачкой: разбор поля тогда не ждёт
+		разбора предыдущего, и поле разбирается целиком, до известного
+		конца (parse_int_digits) */
+	const char *delims[64];
+
+	while (ptr != end && res != res_end)
+	{
+		std::size_t want = res_end - res;
+		if (want > sizeof(delims) / sizeof(*delims))
+			want = sizeof(delims) / sizeof(*delims);
+
+		const char *const *last
+			= delims + find_delims(ptr, end, delim, delims, want);
+
+		for (const char *const *it = delims; it != last; ++it, ++res)
+		{
+			unsigned char st = parse_column_field(begin, ptr, *it, delim, *res);
+			if (status)
+				status[res - out] = st;
+			ptr = *it + 1;
+		}
+
+		/* Разделителей до конца буфера меньше, чем нужно: последнее
+			поле - до конца буфера (если после разделителя что-то есть) */
+		if (last != delims + want)
+		{
+			if (ptr != end)
+			{
+				unsigned char st = parse_column_field(begin, ptr, end, delim, *res);
+				if (status)
+					status[res - out] = st;
+				++res;
+			}
+			break;
+		}
+	}
+#else
+	/* Без SIMD искать разделители заранее дороже: число разбирается
+		с начала поля, и если сразу за ним - разделитель, поле готово */
+	while (ptr != end && res != res_end)
+	{
+		bool ok;
+		const char *field_end = parse_value(ptr, end, *res, ok);
+		unsigned char st = field_ok;
+
+		if (!ok || (field_end != end && *field_end != delim))
+		{
+			field_end = find_delim(field_end, end, delim);
+			st = parse_field(ptr, field_end, delim, *res);
+		}
+
+		if (status)
+			status[res - out] = st;
+		++res;
+
+		ptr = (field_end == end ? end : field_end + 1);
+	}
+#endif
+
+	return res - out;
+}
+
+template<class T>
+std::size_t format_column(char *buf, std::size_t buf_sz,
+	const T *values, std::size_t count, char delim,
+	std::size_t *written = 0)
+{
+	char *ptr = buf;
+	char *last = buf + (buf_sz ? buf_sz - 1 : 0); /* Место для нуля */
+	std::size_t i = 0;
+
+	for (; i < count; i++)
+	{
+		std::size_t left = last - ptr;
+		std::size_t delim_sz = (i ? 1 : 0);
+
+		/* Если места заведомо хватает - сразу в буфер, иначе
+			через временный буфер */
+		if (left >= NUM_TO_STR_BUF_SIZE + delim_sz)
+		{
+			if (delim_sz)
+				*ptr++ = delim;
+			ptr += put(ptr, NUM_TO_STR_BUF_SIZE, values[i]);
+		}
+		else
+		{
+			char tmp[NUM_TO_STR_BUF_SIZE];
+			std::size_t size = put(tmp, sizeof(tmp), values[i]);
+			if (size + delim_sz > left)
+				break;
+
+			if (delim_sz)
+				*ptr++ = delim;
+			std::memcpy(ptr, tmp, size);
+			ptr += size;
+		}
+	}
+
+	if (buf_sz)
+		*ptr = 0;
+	if (written)
+		*written = i;
+
+	return ptr - buf;
+}
+
 }}
 
 #endif
@@ -0,0 +1,215 @@
+﻿#include "my_num.h"
+#include "my_bench.h"
+
+#include <cstddef> /* std::size_t */
+#include <string>
+#include <vector>
+using namespace std;
+
+/* Кол-во подготовленных значений (степень двойки - для быстрого
+	перебора по маске) */
+#define DATA_SIZE 1024
+
+int main(int argc, char *argv[])
+{
+	my::bench::runner bench(argc, argv);
+	my::bench::random rnd;
+
+	vector<int> ints(DATA_SIZE);
+	vector<long long> longs(DATA_SIZE);
+	vector<unsigned long long> ulongs(DATA_SIZE);
+	vector<string> int_strs(DATA_SIZE);
+	vector<string> long_strs(DATA_SIZE);
+	vector<wstring> int_wstrs(DATA_SIZE);
+	vector<double> reals(DATA_SIZE);
+	vector<string> real_strs(DATA_SIZE);
+	vector<string> shortest_strs(DATA_SIZE);
+
+	for (size_t i = 0; i < DATA_SIZE; i++)
+	{
+		ints[i] = (int)rnd();
+		longs[i] = (long long)rnd();
+		ulongs[i] = rnd();
+		int_strs[i] = my::num::to_string(ints[i]);
+		long_strs[i] = my::num::to_string(longs[i]);
+		int_wstrs[i] = my::num::to_wstring(ints[i]);
+		real_strs[i] = my::num::to_string((long long)rnd(1000000))
+			+ "." + my::num::to_string((long long)rnd(1000000), 6);
+		reals[i] = (double)(long long)rnd() / (double)(rnd(1000000) + 1);
+		shortest_strs[i] = my::num::to_string(reals[i]);
+	}
+
+	/* Столбец CSV: те же числа через запятую */
+	string column;
+	for (size_t i = 0; i < DATA_SIZE; i++)
+	{
+		if (i)
+			column += ',';
+		column += int_strs[i];
+	}
+
+	vector<int> column_out(DATA_SIZE);
+	vector<unsigned char> column_status(DATA_SIZE);
+	vector<char> column_buf(DATA_SIZE * 16);
+
+	char buf[64];
+	wchar_t wbuf[64];
+	size_t i = 0;
+
+	/*
+		Число -> строка
+	*/
+
+	for (my::bench::timer t(bench, "num", "put(int)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::num::put(buf, sizeof(buf),
+			ints[i++ & (DATA_SIZE - 1)]) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "num", "put(int,decimals=12)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::num::put(buf, sizeof(buf),
+			ints[i++ & (DATA_SIZE - 1)], 12) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "num", "put(small int)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::num::put(buf, sizeof(buf),
+			(int)(i++ & 63)) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "num", "put(long long)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::num::put(buf, sizeof(buf),
+			longs[i++ & (DATA_SIZE - 1)]) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "num", "put(unsigned long long)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::num::put(buf, sizeof(buf),
+			ulongs[i++ & (DATA_SIZE - 1)]) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "num", "put<wchar_t>(int)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::num::put(wbuf,
+			sizeof(wbuf) / sizeof(*wbuf), ints[i++ & (DATA_SIZE - 1)]) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "num", "to_string(int)"); t.next(); )
+	{
+		string str = my::num::to_string(ints[i++ & (DATA_SIZE - 1)]);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "num", "put(double)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::num::put(buf, sizeof(buf),
+			reals[i++ & (DATA_SIZE - 1)]) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "num", "to_string(double)"); t.next(); )
+	{
+		string str = my::num::to_string(reals[i++ & (DATA_SIZE - 1)]);
+		my::bench::do_not_optimize(str);
+	}
+
+	/*
+		Строка -> число
+	*/
+
+	for (my::bench::timer t(bench, "num", "get(int)"); t.next(); )
+	{
+		int n = 0;
+		const string &str = int_strs[i++ & (DATA_SIZE - 1)];
+		my::bench::do_not_optimize( my::num::get(str.c_str(), str.size(), n) );
+		my::bench::do_not_optimize(n);
+	}
+
+	for (my::bench::timer t(bench, "num", "get(long long)"); t.next(); )
+	{
+		long long n;
+		const string &str = long_strs[i++ & (DATA_SIZE - 1)];
+		my::bench::do_not_optimize( my::num::get(str.c_str(), str.size(), n) );
+		my::bench::do_not_optimize(n);
+	}
+
+	for (my::bench::timer t(bench, "num", "get<wchar_t>(int)"); t.next(); )
+	{
+		int n = 0;
+		const wstring &str = int_wstrs[i++ & (DATA_SIZE - 1)];
+		my::bench::do_not_optimize( my::num::get(str.c_str(), str.size(), n) );
+		my::bench::do_not_optimize(n);
+	}
+
+	for (my::bench::timer t(bench, "num", "to_int_def"); t.next(); )
+	{
+		my::bench::do_not_optimize(
+			my::num::to_int_def(int_strs[i++ & (DATA_SIZE - 1)], 0) );
+	}
+
+	for (my::bench::timer t(bench, "num", "try_to_longlong"); t.next(); )
+	{
+		long long n = 0;
+		my::bench::do_not_optimize(
+			my::num::try_to_longlong(long_strs[i++ & (DATA_SIZE - 1)], n) );
+		my::bench::do_not_optimize(n);
+	}
+
+	for (my::bench::timer t(bench, "num", "get(double)"); t.next(); )
+	{
+		double n;
+		const string &str = real_strs[i++ & (DATA_SIZE - 1)];
+		my::bench::do_not_optimize( my::num::get(str.c_str(), str.size(), n) );
+		my::bench::do_not_optimize(n);
+	}
+
+	for (my::bench::timer t(bench, "num", "get(double,17 digits)"); t.next(); )
+	{
+		double n;
+		const string &str = shortest_strs[i++ & (DATA_SIZE - 1)];
+		my::bench::do_not_optimize( my::num::get(str.c_str(), str.size(), n) );
+		my::bench::do_not_optimize(n);
+	}
+
+	/*
+		Столбцы (на один вызов - DATA_SIZE значений)
+	*/
+
+	for (my::bench::timer t(bench, "num", "get(int) x1024"); t.next(); )
+	{
+		const char *ptr = column.c_str();
+		const char *end = ptr + column.size();
+		for (size_t j = 0; j < DATA_SIZE; j++)
+		{
+			ptr += my::num::get(ptr, end - ptr, column_out[j]);
+			if (ptr != end)
+				++ptr;
+		}
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "num", "parse_column<int> x1024"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::num::parse_column(column.c_str(),
+			column.c_str() + column.size(), ',', &column_out[0],
+			column_out.size(), &column_status[0]) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "num", "format_column<int> x1024"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::num::format_column(&column_buf[0],
+			column_buf.size(), &ints[0], ints.size(), ',') );
+		my::bench::clobber_memory();
+	}
+
+	return bench.report();
+}
@@ -94,6 +94,9 @@ int main()
 	cout.precision(16);
 	TEST("double",double,double,"0.123456789012345",-1)
 	TEST("long_double",long_double,long double,"0.123456789012345",-1)
+	TEST("double",double,double,"-1.5e3",-1)
+	TEST("double",double,double,"2.5e",-1)
+	TEST("double",double,double,".5",-1)
 
 	return 0;
 }
@@ -124,5 +124,41 @@ int main(void)
 	TEST_U_CAST("uchar",uchar,unsigned char,unsigned int,wcout,wstring)
 	TEST_U("uint",uint,unsigned int,wcout,wstring)
 
+#define TEST_R(TN,T,COUT,STR,VALUE) {\
+	T n = (T)(VALUE);\
+	STR str = my::num::to_##STR(n);\
+	STR::value_type buf[8];\
+	size_t sz = my::num::put(buf, sizeof(buf) / sizeof(*buf), n);\
+	COUT << TN << "(" << #VALUE << ") = " << str\
+		<< " [sz=8] = " << buf << " (sz=" << sz << ")" << endl;}
+
+	cout << "*** reals ***\n" << endl;
+	TEST_R("double",double,cout,string,0.0)
+	TEST_R("double",double,cout,string,-0.0)
+	TEST_R("double",double,cout,string,0.1)
+	TEST_R("double",double,cout,string,1.0/3)
+	TEST_R("double",double,cout,string,-123.456)
+	TEST_R("double",double,cout,string,100.0)
+	TEST_R("double",double,cout,string,1e21)
+	TEST_R("double",double,cout,string,123456789012345680000.0)
+	TEST_R("double",double,cout,string,0.000001)
+	TEST_R("double",double,cout,string,1.5e-7)
+	TEST_R("double",double,cout,string,4.9406564584124654e-324)
+	TEST_R("double",double,cout,string,1.7976931348623157e308)
+	TEST_R("double",double,cout,string,numeric_limits<double>::infinity())
+	TEST_R("double",double,cout,string,-numeric_limits<double>::infinity())
+	TEST_R("double",double,cout,string,numeric_limits<double>::quiet_NaN())
+	TEST_R("float",float,cout,string,0.1f)
+	TEST_R("float",float,cout,string,16777216.0f)
+	TEST_R("float",float,cout,string,3.4028235e38f)
+	TEST_R("float",float,cout,string,1e-45f)
+	cout << endl;
+
+	cout << "*** reals to wstring ***\n" << endl;
+	TEST_R("double",double,wcout,wstring,1.0/3)
+	TEST_R("double",double,wcout,wstring,-1.5e-7)
+	TEST_R("float",float,wcout,wstring,0.3f)
+	wcout << endl;
+
 	return 0;
 }
@@ -0,0 +1,43 @@
+﻿#include "my_punycode.h"
+#include "my_inet.h"
+#include "my_bench.h"
+
+#include <string>
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+	my::bench::runner bench(argc, argv);
+
+	const wstring label = L"президент";
+	const string label_enc = my::punycode_encode(label.c_str(), label.size());
+
+	const wstring host = L"www.президент.рф";
+	const string host_enc = my::ip::punycode_encode(host);
+
+	for (my::bench::timer t(bench, "punycode", "encode(label)"); t.next(); )
+	{
+		string str = my::punycode_encode(label.c_str(), label.size());
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "punycode", "decode(label)"); t.next(); )
+	{
+		wstring str = my::punycode_decode(label_enc.c_str(), label_enc.size());
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "punycode", "ip::encode(host)"); t.next(); )
+	{
+		string str = my::ip::punycode_encode(host);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "punycode", "ip::decode(host)"); t.next(); )
+	{
+		wstring str = my::ip::punycode_decode(host_enc);
+		my::bench::do_not_optimize(str);
+	}
+
+	return bench.report();
+}
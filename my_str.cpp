@@ -30,6 +30,23 @@ wstring to_wstring(const char *str, int len)
 	return out;
 }
 
+bool iequals(boost::string_ref a, boost::string_ref b)
+{
+	if (a.size() != b.size())
+		return false;
+
+	for (std::size_t i = 0; i < a.size(); i++)
+	{
+		/* Для букв - сравнение без учёта 0x20 */
+		char ch = a[i];
+		if (ch != b[i] && ((ch | 0x20) != (b[i] | 0x20)
+			|| (unsigned int)((ch | 0x20) - 'a') > 'z' - 'a'))
+			return false;
+	}
+
+	return true;
+}
+
 string escape(const char *ptr, int flags, int len)
 {
 	const char * esc[] = {
@@ -5,6 +5,8 @@
 #include <string>
 #include <algorithm>
 
+#include <boost/utility/string_ref.hpp>
+
 namespace my { namespace str {
 
 
@@ -105,6 +107,10 @@ std::wstring to_wstring(const char *str, int len = -1);
 inline std::wstring to_wstring(const std::string &str)
 	{ return my::str::to_wstring(str.c_str(), (int)str.size()); }
 
+/* Сравнение ascii-строк без учёта регистра (имена полей http и т.п.),
+	без локали: регистр не учитывается только у латинских букв */
+bool iequals(boost::string_ref a, boost::string_ref b);
+
 
 enum
 {
@@ -0,0 +1,82 @@
+﻿#include "my_str.h"
+#include "my_utf8.h"
+#include "my_bench.h"
+
+#include <cstddef> /* std::size_t */
+#include <string>
+#include <vector>
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+	my::bench::runner bench(argc, argv);
+	my::bench::random rnd;
+
+	/* Типичная строка лога - в основном печатные символы,
+		изредка кавычки и управляющие символы */
+	string text;
+	for (size_t i = 0; i < 4096; i++)
+	{
+		unsigned long long r = rnd(100);
+		if (r < 2)
+			text += (char)rnd(32);
+		else if (r < 4)
+			text += (r == 2 ? '\"' : '\\');
+		else
+			text += (char)(32 + rnd(95));
+	}
+
+	const string short_text = text.substr(0, 32);
+	const wstring wtext = my::str::to_wstring(text);
+	const string hex = my::str::to_hex(text);
+
+	/* Текст в utf-8 - латиница вперемешку с кириллицей */
+	wstring wide;
+	for (size_t i = 0; i < 4096; i++)
+		wide += (wchar_t)(rnd(2) ? 0x430 + rnd(32) : 'a' + rnd(26));
+	const string utf8 = my::utf8::encode(wide);
+
+	for (my::bench::timer t(bench, "str", "escape(32b)"); t.next(); )
+	{
+		string str = my::str::escape(short_text);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "str", "escape(4k)"); t.next(); )
+	{
+		string str = my::str::escape(text);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "str", "escape<wchar_t>(4k)"); t.next(); )
+	{
+		wstring str = my::str::escape(wtext);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "str", "to_hex(4k)"); t.next(); )
+	{
+		string str = my::str::to_hex(text);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "str", "from_hex(4k)"); t.next(); )
+	{
+		string str = my::str::from_hex(hex);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "utf8", "decode(4k chars)"); t.next(); )
+	{
+		wstring str = my::utf8::decode(utf8);
+		my::bench::do_not_optimize(str);
+	}
+
+	for (my::bench::timer t(bench, "utf8", "encode(4k chars)"); t.next(); )
+	{
+		string str = my::utf8::encode(wide);
+		my::bench::do_not_optimize(str);
+	}
+
+	return bench.report();
+}
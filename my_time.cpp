@@ -3,21 +3,19 @@
 
 using namespace std;
 
+#include <cstring> /* std::memcpy */
+#include <cstdlib> /* std::getenv */
+#include <ctime> /* std::time */
+#include <time.h> /* tzset */
+
 #include <boost/date_time/time_parsing.hpp>
 #include <boost/date_time/c_local_time_adjustor.hpp>
+#include <boost/atomic.hpp>
 
 namespace boost {
 std::size_t hash_value(const posix_time::ptime &t)
 {
-	int size = sizeof(t) / sizeof(size_t);
-
-	size_t seed = 0;
-	size_t *ptr = (size_t*)&t;
-
-	while (size--)
-		boost::hash_combine(seed, *ptr);
-
-	return seed;
+	return my::time::hash(t);
 }
 }
 
@@ -30,7 +28,7 @@ posix_time::ptime utc_now()
 
 posix_time::ptime local_now()
 {
-	return posix_time::microsec_clock::local_time();
+	return utc_to_local(utc_now());
 }
 
 double div(
@@ -58,57 +56,383 @@ posix_time::time_duration mul(
 			(double)time.ticks() * rhs + 0.5));
 }
 
+/*
+	Кэш смещений местного времени.
+
+	Элемент кэша - одно 64-битное слово (читается и пишется атомарно,
+	без блокировок):
+		биты 63..32 - номер дня от 1970-01-01 (UTC),
+		биты 31..24 - поколение (меняется в reset_timezone),
+		биты 23..0  - смещение в секундах + tz_offset_bias.
+	Нулевое слово - пустой элемент (поколение никогда не равно 0).
+*/
+static const unsigned int tz_cache_size = 4096; /* Степень двойки: > 10 лет */
+static const long tz_offset_bias = 0x800000;
+static boost::atomic<unsigned long long> tz_cache[tz_cache_size];
+static boost::atomic<unsigned int> tz_generation(1);
+
+/*
+	Смена часового пояса. Не чаще раза в секунду (на быстром пути -
+	только std::time и сравнение) сверяется значение TZ: если оно
+	изменилось, вызывается tzset и сбрасывается кэш. Смену системного
+	пояса без TZ не видит и сама libc (localtime читает его один раз),
+	поэтому она не отслеживается.
+*/
+static boost::atomic<long long> tz_checked(0); /* time_t последней проверки */
+static boost::atomic<unsigned long long> tz_state(0); /* Хэш TZ, 0 - не задана */
+
+static unsigned long long timezone_state()
+{
+	const char *tz = std::getenv("TZ");
+	if (!tz)
+		return 0;
+
+	/* FNV-1a; младший бит - чтобы не совпасть с 0 */
+	unsigned long long hash = 14695981039346656037ULL;
+	for (; *tz; ++tz)
+		hash = (hash ^ static_cast<unsigned char>(*tz)) * 1099511628211ULL;
+
+	return hash | 1;
+}
+
+static void check_timezone()
+{
+	const long long now = static_cast<long long>(std::time(0));
+	if (now == tz_checked.load(boost::memory_order_relaxed))
+		return;
+
+	tz_checked.store(now, boost::memory_order_relaxed);
+
+	unsigned long long state = tz_state.load();
+	const unsigned long long current = timezone_state();
+
+	/* Сбрасывает кэш только тот поток, что первым увидел смену */
+	if (current != state && tz_state.compare_exchange_strong(state, current))
+	{
+#if defined(_WIN32)
+		_tzset();
+#else
+		tzset();
+#endif
+		reset_timezone();
+	}
+}
+
+/* Смещение (в секундах) по localtime - медленно */
+inline long c_utc_offset(long long utc_ticks)
+{
+	posix_time::ptime utc_time = from_ticks(utc_ticks);
+	return static_cast<long>(
+		(boost::date_time::c_local_adjustor<posix_time::ptime>
+			::utc_to_local(utc_time) - utc_time).total_seconds());
+}
+
+/* Смещение (в секундах) через кэш */
+static long cached_utc_offset(long long utc_ticks)
+{
+	check_timezone();
+
+	const long day = ticks_to_days(utc_ticks);
+	const unsigned int generation = tz_generation.load(boost::memory_order_relaxed);
+	const unsigned long long key =
+		(static_cast<unsigned long long>(static_cast<unsigned int>(day)) << 32)
+		| (generation << 24);
+
+	boost::atomic<unsigned long long> &entry
+		= tz_cache[static_cast<unsigned int>(day) & (tz_cache_size - 1)];
+	unsigned long long value = entry.load(boost::memory_order_relaxed);
+
+	if ((value & ~0xFFFFFFULL) == key)
+		return static_cast<long>(value & 0xFFFFFF) - tz_offset_bias;
+
+	/* Промах: день кэшируется, только если смещение в его начале
+		и в конце совпадает (т.е. в этот день не было перехода) */
+	const long long start = day * ticks_per_day();
+	const long offset = c_utc_offset(start);
+
+	if (c_utc_offset(start + ticks_per_day() - ticks_per_second()) != offset)
+		return c_utc_offset(utc_ticks);
+
+	entry.store(key | static_cast<unsigned long long>(offset + tz_offset_bias),
+		boost::memory_order_relaxed);
+
+	return offset;
+}
+
 posix_time::ptime utc_to_local(const posix_time::ptime &utc_time)
 {
-	return boost::date_time::c_local_adjustor<posix_time::ptime>
-		::utc_to_local(utc_time);
+	if (utc_time.is_special())
+		return boost::date_time::c_local_adjustor<posix_time::ptime>
+			::utc_to_local(utc_time);
+
+	long long ticks = to_ticks(utc_time);
+	return from_ticks(ticks + cached_utc_offset(ticks) * ticks_per_second());
 }
 
 posix_time::ptime local_to_utc(const posix_time::ptime &local_time)
 {
-	/* Прямой функции для c_local_adjustor почему-то нет */
-	posix_time::time_duration td = utc_to_local(local_time) - local_time;
-	return local_time - td;
+	if (local_time.is_special())
+		return local_time;
+
+	/* Прямой функции для c_local_adjustor почему-то нет - смещение
+		берётся как для UTC, равного заданному местному времени */
+	long long ticks = to_ticks(local_time);
+	return from_ticks(ticks - cached_utc_offset(ticks) * ticks_per_second());
 }
 
+posix_time::time_duration utc_offset(const posix_time::ptime &utc_time)
+{
+	return posix_time::seconds(cached_utc_offset(to_ticks(utc_time)));
+}
+
+void reset_timezone()
+{
+	/* Старые элементы кэша становятся недействительными сами - по
+		несовпадению поколения; 0 пропускаем (пустой элемент) */
+	unsigned int generation = tz_generation.load();
+	unsigned int next;
+	do
+	{
+		next = (generation + 1) & 0xFF;
+		if (next == 0)
+			next = 1;
+	}
+	while (!tz_generation.compare_exchange_weak(generation, next));
+}
+
+/* Округление ptime - в пределах суток (от начала дня) */
 posix_time::ptime floor(const posix_time::ptime &time,
 	const posix_time::time_duration &prec)
 {
-	return posix_time::ptime(time.date(),
-		my::time::floor(time.time_of_day(), prec));
+	if (time.is_special() || prec.is_special())
+		return time;
+
+	long long ticks = to_ticks(time);
+	long long day = floor_ticks(ticks, ticks_per_day());
+
+	return from_ticks(day + floor_ticks(ticks - day, prec.ticks()));
 }
 
 posix_time::time_duration floor(const posix_time::time_duration &dur,
 	const posix_time::time_duration &prec)
 {
-	return prec * (int)( my::time::div(dur, prec) );
+	if (dur.is_special() || prec.is_special())
+		return dur;
+
+	return duration_from_ticks(floor_ticks(dur.ticks(), prec.ticks()));
 }
 
 posix_time::ptime ceil(const posix_time::ptime &time,
 	const posix_time::time_duration &prec)
 {
-	return posix_time::ptime(time.date(),
-		my::time::ceil(time.time_of_day(), prec));
+	if (time.is_special() || prec.is_special())
+		return time;
+
+	long long ticks = to_ticks(time);
+	long long day = floor_ticks(ticks, ticks_per_day());
+
+	return from_ticks(day + ceil_ticks(ticks - day, prec.ticks()));
 }
 
 posix_time::time_duration ceil(const posix_time::time_duration &dur,
 	const posix_time::time_duration &prec)
 {
-	posix_time::time_duration fl = my::time::floor(dur, prec);
-	return fl == dur ? fl : fl + prec;
+	if (dur.is_special() || prec.is_special())
+		return dur;
+
+	return duration_from_ticks(ceil_ticks(dur.ticks(), prec.ticks()));
 }
 
 posix_time::ptime round(const posix_time::ptime &time,
 	const posix_time::time_duration &prec)
 {
-	return posix_time::ptime(time.date(),
-		my::time::round(time.time_of_day(), prec));
+	if (time.is_special() || prec.is_special())
+		return time;
+
+	long long ticks = to_ticks(time);
+	long long day = floor_ticks(ticks, ticks_per_day());
+
+	return from_ticks(day + round_ticks(ticks - day, prec.ticks()));
 }
 
 posix_time::time_duration round(const posix_time::time_duration &dur,
 	const posix_time::time_duration &prec)
 {
-	return my::time::floor(dur + prec / 2, prec);
+	if (dur.is_special() || prec.is_special())
+		return dur;
+
+	return duration_from_ticks(round_ticks(dur.ticks(), prec.ticks()));
+}
+
+void floor_many(const posix_time::ptime *times, posix_time::ptime *out,
+	std::size_t count, const posix_time::time_duration &prec)
+{
+	const long long p = (prec.is_special() ? 0 : prec.ticks());
+
+	/* Если prec делит сутки нацело, округление в пределах суток -
+		то же самое, что и округление тиков от 1970 года */
+	if (p <= 0 || ticks_per_day() % p)
+	{
+		for (std::size_t i = 0; i < count; i++)
+			out[i] = floor(times[i], prec);
+		return;
+	}
+
+	/* Текущий интервал [lo, lo + p) */
+	long long lo = 0;
+	posix_time::ptime lo_time;
+
+	for (std::size_t i = 0; i < count; i++)
+	{
+		if (times[i].is_special())
+		{
+			out[i] = times[i];
+			continue;
+		}
+
+		long long t = to_ticks(times[i]);
+
+		if (lo_time.is_special() || static_cast<unsigned long long>(t - lo)
+			>= static_cast<unsigned long long>(p))
+		{
+			lo = floor_ticks(t, p);
+			lo_time = from_ticks(lo);
+		}
+
+		out[i] = lo_time;
+	}
+}
+
+std::size_t parse_many(const char *begin, const char *end, char delim,
+	posix_time::ptime *out, std::size_t out_sz, unsigned char *status)
+{
+	const char *ptr = begin;
+	std::size_t count = 0;
+
+	while (ptr != end && count < out_sz)
+	{
+		posix_time::ptime &time = out[count];
+		const char *last = ptr + get_iso(ptr, end - ptr, time);
+		unsigned char st = my::num::field_ok;
+
+		/* Быстрый путь: сразу за временем - разделитель */
+		const char *field_end = last;
+		if (last == ptr || (last != end && *last != delim))
+		{
+			field_end = my::num::find_delim(last, end, delim);
+
+			const char *value_end = field_end;
+			if (delim == '\n' && value_end != ptr && value_end[-1] == '\r')
+				--value_end;
+
+			if (ptr == value_end)
+				st = my::num::field_empty;
+			else if (last == ptr || last != value_end)
+				st = my::num::field_invalid;
+		}
+
+		/* Время прочитано целиком, но вне диапазона (25:00:00,
+			23:59:60) - get_iso вернул not_a_date_time */
+		if (st == my::num::field_ok && time.is_special())
+			st = my::num::field_invalid;
+
+		if (st != my::num::field_ok)
+			time = posix_time::not_a_date_time;
+
+		if (status)
+			status[count] = st;
+		count++;
+
+		ptr = (field_end == end ? end : field_end + 1);
+	}
+
+	return count;
+}
+
+bool parse_iso_fields(const char *str, const char *end, int *fields)
+{
+#if MY_NUM_SWAR
+	if (end - str < 19 || (str[10] != ' ' && str[10] != 'T'))
+		return false;
+
+	/* Три загрузки по 8 символов: "YYYY-MM-", "DD" и "HH:MM:SS".
+		После xor с шаблоном цифры становятся числами 0..9, а верные
+		разделители - нулями */
+	static const char date_layout[8] = { '0','0','0','0','-','0','0','-' };
+	static const char time_layout[8] = { '0','0',':','0','0',':','0','0' };
+	static const unsigned char date_seps[8] = { 0,0,0,0,0xFF,0,0,0xFF };
+	static const unsigned char time_seps[8] = { 0,0,0xFF,0,0,0xFF,0,0 };
+
+	unsigned long long date, day, time, layout, seps;
+
+	std::memcpy(&date, str, 8);
+	std::memcpy(&layout, date_layout, 8);
+	std::memcpy(&seps, date_seps, 8);
+	date ^= layout;
+	unsigned long long bad = date & seps;
+
+	std::memcpy(&day, str + 8, 8);
+	day = (day ^ 0x3030) & 0xFFFF;
+
+	std::memcpy(&time, str + 11, 8);
+	std::memcpy(&layout, time_layout, 8);
+	std::memcpy(&seps, time_seps, 8);
+	time ^= layout;
+	bad |= time & seps;
+
+	/* Байт больше 9 - не цифра */
+	const unsigned long long high = 0x8080808080808080ULL;
+	const unsigned long long add = 0x7676767676767676ULL;
+	bad |= ((date + add) | date | (day + add) | day
+		| (time + add) | time) & high;
+
+	if (bad)
+		return false;
+
+	/* Пары цифр: в каждом байте - 10 * d[i] + d[i + 1] */
+	date = date * 10 + (date >> 8);
+	day = day * 10 + (day >> 8);
+	time = time * 10 + (time >> 8);
+
+	fields[0] = static_cast<int>(date & 0xFF) * 100
+		+ static_cast<int>((date >> 16) & 0xFF);
+	fields[1] = static_cast<int>((date >> 40) & 0xFF);
+	fields[2] = static_cast<int>(day & 0xFF);
+	fields[3] = static_cast<int>(time & 0xFF);
+	fields[4] = static_cast<int>((time >> 24) & 0xFF);
+	fields[5] = static_cast<int>((time >> 48) & 0xFF);
+
+	return true;
+#else
+	return parse_iso_fields<char>(str, end, fields);
+#endif
+}
+
+bool make_iso_time(const int *fields, long fseconds,
+	posix_time::ptime &time)
+{
+	static const int month_days[12]
+		= { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+	int year = fields[0];
+	int month = fields[1];
+	int day = fields[2];
+
+	/* Диапазон gregorian::date - с 1400 года */
+	if (year < 1400 || month < 1 || month > 12 || day < 1
+		|| fields[3] > 23 || fields[4] > 59 || fields[5] > 59)
+		return false;
+
+	bool leap = (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+	if (day > month_days[month - 1] + (month == 2 && leap))
+		return false;
+
+	long long seconds = days_from_civil(year, month, day) * 86400LL
+		+ fields[3] * 3600 + fields[4] * 60 + fields[5];
+
+	time = from_ticks(seconds * ticks_per_second() + fseconds);
+
+	return true;
 }
 
 }}
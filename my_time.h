@@ -25,6 +25,7 @@
 #include <istream>
 #include <ostream>
 #include <string>
+#include <vector>
 #include <locale> /* facet */
 
 #include <boost/date_time/special_defs.hpp>
@@ -42,27 +43,13 @@ namespace date_time=boost::date_time;
 /* hash_value для boost::unordered_map */
 namespace boost {
 std::size_t hash_value(const posix_time::ptime &t);
+
+/* boost::hash ищет hash_value через ADL - в пространстве имён ptime */
+namespace posix_time { using boost::hash_value; }
 }
 
 namespace my { namespace time {
 
-/* hash для std::unordered_map */
-struct ptime_hash : std::unary_function<posix_time::ptime, std::size_t>
-{
-	std::size_t operator()(const posix_time::ptime &t) const
-	{
-		int size = sizeof(t) / sizeof(std::size_t);
-
-		std::size_t seed = 0;
-		std::size_t *ptr = (std::size_t*)&t;
-
-		while (size--)
-			boost::hash_combine(seed, *ptr);
-
-		return seed;
-	}
-};
-
 posix_time::ptime utc_now();
 posix_time::ptime local_now();
 
@@ -78,10 +65,25 @@ posix_time::time_duration mul(
 	const posix_time::time_duration &time,
 	double rhs);
 
-/* UTC <-> local */
+/* UTC <-> local.
+	Смещение местного времени кэшируется по дням (UTC): повторное
+	преобразование в пределах того же дня - целочисленная арифметика,
+	без обращения к localtime и без блокировок. Дни, в которые смещение
+	меняется (переход на летнее время и обратно), не кэшируются.
+
+	Смена TZ замечается сама, не позже чем через секунду: значение TZ
+	сверяется раз в секунду, при изменении вызывается tzset и кэш
+	сбрасывается. Смену системного пояса без TZ (/etc/localtime,
+	настройки Windows) не видит и сама libc - её не отслеживаем */
 posix_time::ptime utc_to_local(const posix_time::ptime &utc_time);
 posix_time::ptime local_to_utc(const posix_time::ptime &local_time);
 
+/* Смещение местного времени относительно UTC в заданный момент */
+posix_time::time_duration utc_offset(const posix_time::ptime &utc_time);
+
+/* Сброс кэша смещений - сразу, не дожидаясь проверки TZ */
+void reset_timezone();
+
 /* Округление времени с точностью до prec.
 	Возвращает значение, равное или меньшее заданному:
 		floor(00:00:03.500, 00:00:01) = 00:00:03 */
@@ -108,6 +110,131 @@ posix_time::time_duration round(const posix_time::time_duration &dur,
 	const posix_time::time_duration &prec);
 
 
+
+/*
+	Время в тиках - целым числом от 1970-01-01 00:00:00 (тик - 1/ticks_per_second()
+	секунды: мкс или нс, в зависимости от настройки Boost.DateTime).
+	Для массовой обработки (группировка событий по интервалам и т.п.):
+	вся арифметика - целочисленная, округление - точное при любой
+	точности, преобразование в ptime и обратно - одно сложение.
+	Для special-значений ptime (not_a_date_time и т.п.) to_ticks
+	не определено - их надо проверять заранее (is_special).
+*/
+
+inline long long ticks_per_second()
+	{ return posix_time::time_duration::ticks_per_second(); }
+
+inline long long ticks_per_day()
+	{ return ticks_per_second() * 86400LL; }
+
+/* Начало отсчёта - 1970-01-01 00:00:00 */
+inline const posix_time::ptime& epoch()
+{
+	static const posix_time::ptime epoch(gregorian::date(1970, 1, 1));
+	return epoch;
+}
+
+inline long long to_ticks(const posix_time::ptime &time)
+	{ return (time - epoch()).ticks(); }
+
+inline long long to_ticks(const posix_time::time_duration &dur)
+	{ return dur.ticks(); }
+
+inline posix_time::ptime from_ticks(long long ticks)
+	{ return epoch() + posix_time::time_duration(0, 0, 0, ticks); }
+
+inline posix_time::time_duration duration_from_ticks(long long ticks)
+	{ return posix_time::time_duration(0, 0, 0, ticks); }
+
+/* Округление тиков с точностью до prec (prec > 0) - как floor, ceil
+	и round выше, но и для отрицательных значений (до 1970 года)
+	округление идёт в нужную сторону, а не к нулю */
+inline long long floor_ticks(long long ticks, long long prec)
+{
+	long long q = ticks / prec;
+	return (q - (ticks - q * prec < 0)) * prec;
+}
+
+inline long long ceil_ticks(long long ticks, long long prec)
+	{ return -floor_ticks(-ticks, prec); }
+
+inline long long round_ticks(long long ticks, long long prec)
+	{ return floor_ticks(ticks + prec / 2, prec); }
+
+/* Номер дня от 1970-01-01 (для civil_from_days) */
+inline long ticks_to_days(long long ticks)
+{
+	long long days = ticks / ticks_per_day();
+	return static_cast<long>(days - (ticks - days * ticks_per_day() < 0));
+}
+
+/* Дата по номеру дня от 1970-01-01 - без таблиц и циклов
+	(алгоритм H. Hinnant, "chrono-compatible low-level date
+	algorithms"). Заметно быстрее gregorian::date::year_month_day */
+inline void civil_from_days(long days, int &year, int &month, int &day)
+{
+	/* Отсчёт от 0000-03-01, эпохи по 400 лет */
+	long z = days + 719468;
+	long era = (z >= 0 ? z : z - 146096) / 146097;
+	unsigned long doe = static_cast<unsigned long>(z - era * 146097);
+	unsigned long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned long mp = (5 * doy + 2) / 153;
+
+	day = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+	month = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+	year = static_cast<int>(yoe + era * 400 + (month <= 2));
+}
+
+/* Обратное преобразование: номер дня от 1970-01-01 по дате */
+inline long days_from_civil(int year, int month, int day)
+{
+	year -= (month <= 2);
+
+	long era = (year >= 0 ? year : year - 399) / 400;
+	unsigned long yoe = static_cast<unsigned long>(year - era * 400);
+	unsigned long doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5
+		+ day - 1;
+	unsigned long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + static_cast<long>(doe) - 719468;
+}
+
+/* Хэш тиков - финализатор MurmurHash3 (fmix64): каждый бит значения
+	влияет на все биты хэша. Время обычно кратно секунде или минуте
+	(младшие биты тиков - нули), и без перемешивания такие ключи
+	в таблицах размером в степень двойки попадают в одни и те же
+	корзины */
+inline std::size_t hash_ticks(long long ticks)
+{
+	unsigned long long h = static_cast<unsigned long long>(ticks);
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return static_cast<std::size_t>(h);
+}
+
+inline std::size_t hash(const posix_time::ptime &time)
+{
+	/* У special-значений тиков нет - у каждого свой ключ
+		за пределами диапазона ptime */
+	if (time.is_special())
+		return hash_ticks((1LL << 62) + (time.is_not_a_date_time() ? 0
+			: time.is_neg_infinity() ? 1 : 2));
+
+	return hash_ticks(to_ticks(time));
+}
+
+/* hash для std::unordered_map */
+struct ptime_hash : std::unary_function<posix_time::ptime, std::size_t>
+{
+	std::size_t operator()(const posix_time::ptime &t) const
+		{ return my::time::hash(t); }
+};
+
+
 template<class Time>
 void throw_if_fail(const Time &time,
 	const std::wstring &text = std::wstring(L"Invalid time"))
@@ -173,202 +300,263 @@ std::size_t put(Char *buf, std::size_t buf_sz,
 	return ptr - buf;
 }
 
-/* Преобразование даты (boost::gregorian::date) в строку */
+/* Вывод числа n ровно в width цифр, без проверки размера буфера */
 template<class Char>
-std::size_t put(Char *buf, std::size_t buf_sz,
-	const gregorian::date &date, const Char *format = 0)
+inline Char* put_fixed(Char *ptr, unsigned long n, int width)
 {
-	if (date.is_special())
-		return put(buf, buf_sz, date.as_special());
+	const char *pairs = my::num::digit_pairs();
 
-	Char *ptr = buf;
-	Char *end = buf + buf_sz;
+	Char *end = ptr + width;
 
-	gregorian::date::ymd_type ymd = date.year_month_day();
+	for (; end - ptr >= 2; n /= 100)
+	{
+		unsigned int i = static_cast<unsigned int>(n % 100) * 2;
+		*--end = Char(pairs[i + 1]);
+		*--end = Char(pairs[i]);
+	}
 
-	if (!format)
+	/* Нечётная ширина - ещё одна цифра */
+	if (end != ptr)
+		*--end = Char('0' + n % 10);
+
+	return ptr + width;
+}
+
+/* Поля даты/времени для вывода по формату. Поле, которого нет
+	у выводимого значения (например, %H для даты), выводится как есть */
+struct time_fields
+{
+	bool has_date;
+	bool has_time;
+	bool negative;
+	int year;
+	int month;
+	int day;
+	long long hours;
+	long minutes;
+	long seconds;
+	long fseconds;
+
+	explicit time_fields(const gregorian::date &date)
+		: has_date(true)
+		, has_time(false)
+		, negative(false)
 	{
-		ptr += my::num::put(ptr, end - ptr, ymd.year, 4);
-		ptr += my::str::put(ptr, end - ptr, Char('-'));
-		ptr += my::num::put(ptr, end - ptr, ymd.month, 2);
-		ptr += my::str::put(ptr, end - ptr, Char('-'));
-		ptr += my::num::put(ptr, end - ptr, ymd.day, 2);
+		set_date(date);
 	}
-	else
+
+	explicit time_fields(const posix_time::time_duration &dur)
+		: has_date(false)
+		, has_time(true)
 	{
-		while (ptr < end)
-		{
-			const Char *format_ptr = format;
+		set_time(dur.ticks());
+	}
 
-			while (*format_ptr && *format_ptr != '%')
-				format_ptr++;
+	/* Дата и время - сразу из тиков от 1970-01-01, без
+		промежуточных gregorian::date и time_duration */
+	explicit time_fields(const posix_time::ptime &time)
+		: has_date(true)
+		, has_time(true)
+	{
+		long long ticks = to_ticks(time);
+		long days = ticks_to_days(ticks);
+		ticks -= days * ticks_per_day();
 
-			ptr += my::str::put(ptr, end - ptr,
-				format, format_ptr - format);
+		civil_from_days(days, year, month, day);
+		set_time(ticks);
+	}
 
-			if (*format_ptr == 0)
-				break;
+	void set_date(const gregorian::date &date)
+	{
+		/* 2440588 - номер дня 1970-01-01 */
+		civil_from_days(static_cast<long>(date.day_number()) - 2440588L,
+			year, month, day);
+	}
 
-			Char ch = format_ptr[1];
-			format = format_ptr + 2;
+	void set_time(long long ticks)
+	{
+		const long long ticks_per_second
+			= posix_time::time_duration::ticks_per_second();
 
-			switch (ch)
-			{
-				case 0:
-				case '%':
-					ptr += my::str::put(ptr, end - ptr, Char('%'));
-					break;
+		negative = (ticks < 0);
+		if (negative)
+			ticks = -ticks;
 
-				case 'Y':
-					ptr += my::num::put(ptr, end - ptr, ymd.year, 4);
-					break;
+		long long total_seconds = ticks / ticks_per_second;
+		hours = total_seconds / 3600;
 
-				case 'm':
-					ptr += my::num::put(ptr, end - ptr, ymd.month, 2);
-					break;
+		fseconds = static_cast<long>(ticks - total_seconds * ticks_per_second);
+		seconds = static_cast<long>(total_seconds - hours * 3600);
+		minutes = seconds / 60;
+		seconds -= minutes * 60;
+	}
+};
 
-				case 'd':
-					ptr += my::num::put(ptr, end - ptr, ymd.day, 2);
-					break;
+/* Вывод одного поля формата (%Y, %m и т.д.) */
+template<class Char>
+std::size_t put_field(Char *buf, std::size_t buf_sz, Char ch,
+	const time_fields &fields)
+{
+	Char *ptr = buf;
+	Char *end = buf + buf_sz;
 
-				default:
-					ptr += my::str::put(ptr, end - ptr, Char('%'));
-					ptr += my::str::put(ptr, end - ptr, ch);
-					break;
-			}
+	if (fields.has_date)
+	{
+		switch (ch)
+		{
+			case 'Y':
+				return my::num::put(buf, buf_sz, fields.year, 4);
 
-			if (ch == 0)
-				break;
+			case 'm':
+				return my::num::put(buf, buf_sz, fields.month, 2);
 
-		} /* while (*format) */
+			case 'd':
+				return my::num::put(buf, buf_sz, fields.day, 2);
+		}
 	}
 
+	if (fields.has_time)
+	{
+		switch (ch)
+		{
+			case '-':
+				return fields.negative
+					? my::str::put(buf, buf_sz, Char('-')) : 0;
+
+			case '+':
+				return my::str::put(buf, buf_sz,
+					fields.negative ? Char('-') : Char('+'));
+
+			case 'H':
+				return my::num::put(buf, buf_sz, fields.hours, 2);
+
+			case 'M':
+				return my::num::put(buf, buf_sz, fields.minutes, 2);
+
+			case 'S':
+				return my::num::put(buf, buf_sz, fields.seconds, 2);
+
+			case 'F':
+				if (!fields.fseconds)
+					return 0;
+				/* Продолжаем */
+
+			case 'f':
+				ptr += my::str::put(ptr, end - ptr, Char('.'));
+				ptr += my::num::put(ptr, end - ptr, fields.fseconds,
+					posix_time::time_duration::num_fractional_digits());
+				return ptr - buf;
+		}
+	}
+
+	ptr += my::str::put(ptr, end - ptr, Char('%'));
+	ptr += my::str::put(ptr, end - ptr, ch);
+
 	return ptr - buf;
 }
 
-/* Преобразование длительности (boost::posix_time::time_duration) в строку */
+/* Вывод полей по строке формата - за один проход */
 template<class Char>
-std::size_t put(Char *buf, std::size_t buf_sz,
-	const posix_time::time_duration &dur, const Char *format = 0)
+std::size_t put_fields(Char *buf, std::size_t buf_sz,
+	const time_fields &fields, const Char *format)
 {
-	if (dur.is_special())
-		return put(buf, buf_sz, my::time::as_special(dur));
-
 	Char *ptr = buf;
 	Char *end = buf + buf_sz;
 
-	long long ticks = dur.ticks();
-	bool negative = false;
-
-	if (ticks < 0)
+	while (ptr < end)
 	{
-		negative = true;
-		ticks = -ticks;
-	}
+		const Char *format_ptr = format;
 
-	long long total_seconds = ticks / dur.ticks_per_second();
-	long long hours = total_seconds / 3600;
+		while (*format_ptr && *format_ptr != '%')
+			format_ptr++;
 
-	long fseconds = static_cast<long>(ticks
-		- total_seconds * dur.ticks_per_second());
-	long seconds = static_cast<long>(total_seconds - hours * 3600);
-	long minutes = seconds / 60;
-	seconds -= minutes * 60;
+		ptr += my::str::put(ptr, end - ptr,
+			format, format_ptr - format);
 
-	if (!format)
-	{
-		if (negative)
-			ptr += my::str::put(ptr, end - ptr, Char('-'));
+		if (*format_ptr == 0)
+			break;
 
-		ptr += my::num::put(ptr, end - ptr, hours, 2);
-		ptr += my::str::put(ptr, end - ptr, Char(':'));
-		ptr += my::num::put(ptr, end - ptr, minutes, 2);
-		ptr += my::str::put(ptr, end - ptr, Char(':'));
-		ptr += my::num::put(ptr, end - ptr, seconds, 2);
+		Char ch = format_ptr[1];
+		format = format_ptr + 2;
 
-		if (fseconds)
-		{
-			ptr += my::str::put(ptr, end - ptr, Char('.'));
-			ptr += my::num::put(ptr, end - ptr, fseconds,
-				posix_time::time_duration::num_fractional_digits());
-		}
-	}
-	else
-	{
-		while (ptr < end)
-		{
-			const Char *format_ptr = format;
+		if (ch == 0 || ch == '%')
+			ptr += my::str::put(ptr, end - ptr, Char('%'));
+		else
+			ptr += put_field(ptr, end - ptr, ch, fields);
 
-			while (*format_ptr && *format_ptr != '%')
-				format_ptr++;
+		if (ch == 0)
+			break;
 
-			ptr += my::str::put(ptr, end - ptr,
-				format, format_ptr - format);
+	} /* while (*format) */
 
-			if (*format_ptr == 0)
-				break;
+	return ptr - buf;
+}
 
-			Char ch = format_ptr[1];
-			format = format_ptr + 2;
+/* Преобразование даты (boost::gregorian::date) в строку */
+template<class Char>
+std::size_t put(Char *buf, std::size_t buf_sz,
+	const gregorian::date &date, const Char *format = 0)
+{
+	if (date.is_special())
+		return put(buf, buf_sz, date.as_special());
 
-			switch (ch)
-			{
-				case 0:
-				case '%':
-					ptr += my::str::put(ptr, end - ptr, Char('%'));
-					break;
+	if (format)
+		return put_fields(buf, buf_sz, time_fields(date), format);
 
-				case '-':
-					if (negative)
-						ptr += my::str::put(ptr, end - ptr, Char('-'));
-					break;
+	Char *ptr = buf;
+	Char *end = buf + buf_sz;
 
-				case '+':
-					ptr += my::str::put(ptr, end - ptr,
-						negative ? Char('-') : Char('+'));
-					break;
+	gregorian::date::ymd_type ymd = date.year_month_day();
 
-				case 'H':
-					ptr += my::num::put(ptr, end - ptr, hours, 2);
-					break;
+	ptr += my::num::put(ptr, end - ptr, ymd.year, 4);
+	ptr += my::str::put(ptr, end - ptr, Char('-'));
+	ptr += my::num::put(ptr, end - ptr, ymd.month, 2);
+	ptr += my::str::put(ptr, end - ptr, Char('-'));
+	ptr += my::num::put(ptr, end - ptr, ymd.day, 2);
 
-				case 'M':
-					ptr += my::num::put(ptr, end - ptr, minutes, 2);
-					break;
+	return ptr - buf;
+}
 
-				case 'S':
-					ptr += my::num::put(ptr, end - ptr, seconds, 2);
-					break;
+/* Преобразование длительности (boost::posix_time::time_duration) в строку */
+template<class Char>
+std::size_t put(Char *buf, std::size_t buf_sz,
+	const posix_time::time_duration &dur, const Char *format = 0)
+{
+	if (dur.is_special())
+		return put(buf, buf_sz, my::time::as_special(dur));
 
-				case 'f':
-					ptr += my::str::put(ptr, end - ptr, Char('.'));
-					ptr += my::num::put(ptr, end - ptr, fseconds, 6);
-					break;
+	time_fields fields(dur);
 
-				case 'F':
-					if (fseconds)
-					{
-						ptr += my::str::put(ptr, end - ptr, Char('.'));
-						ptr += my::num::put(ptr, end - ptr, fseconds, 6);
-					}
-					break;
+	if (format)
+		return put_fields(buf, buf_sz, fields, format);
 
-				default:
-					ptr += my::str::put(ptr, end - ptr, Char('%'));
-					ptr += my::str::put(ptr, end - ptr, ch);
-					break;
-			}
+	Char *ptr = buf;
+	Char *end = buf + buf_sz;
 
-			if (ch == 0)
-				break;
+	if (fields.negative)
+		ptr += my::str::put(ptr, end - ptr, Char('-'));
+
+	ptr += my::num::put(ptr, end - ptr, fields.hours, 2);
+	ptr += my::str::put(ptr, end - ptr, Char(':'));
+	ptr += my::num::put(ptr, end - ptr, fields.minutes, 2);
+	ptr += my::str::put(ptr, end - ptr, Char(':'));
+	ptr += my::num::put(ptr, end - ptr, fields.seconds, 2);
 
-		} /* while (*format) */
+	if (fields.fseconds)
+	{
+		ptr += my::str::put(ptr, end - ptr, Char('.'));
+		ptr += my::num::put(ptr, end - ptr, fields.fseconds,
+			posix_time::time_duration::num_fractional_digits());
 	}
 
 	return ptr - buf;
 }
 
-/* Преобразование даты/времени (boost::posix_time::ptime) в строку */
+/* Преобразование даты/времени (boost::posix_time::ptime) в строку.
+	Формат разбирается за один проход, поэтому "%%" - всегда просто
+	'%': "%%H" выводится как "%H". Прежний вариант выводил сначала
+	дату, затем время по получившейся строке, и "%%" раскрывался
+	дважды ("%%H" - часы). Остальной вывод не изменился */
 template<class Char>
 std::size_t put(Char *buf, std::size_t buf_sz,
 	const posix_time::ptime &time, const Char *format = 0)
@@ -385,26 +573,277 @@ std::size_t put(Char *buf, std::size_t buf_sz,
 		ptr += my::str::put(ptr, end - ptr, Char(' '));
 		ptr += put(ptr, end - ptr, time.time_of_day());
 	}
-	else if (buf_sz)
-	{
-		/* Сложный момент, как из двух собрать одно с помощью
-			одного формата? */
+	else
+		ptr += put_fields(ptr, end - ptr, time_fields(time), format);
+
+	return ptr - buf;
+}
 
-		/* Используя формат, выводим дату. Формат для времени
-			сохраняется в выходном буфере */
-		ptr += put(ptr, end - ptr, time.date(), format);
+/* Вывод даты/времени в виде "YYYY-MM-DD HH:MM:SS.ffffff" - все поля
+	фиксированной ширины, позиции известны заранее, поэтому вывод
+	идёт сразу по местам, без разбора формата. Дробная часть - по
+	точности boost (num_fractional_digits, обычно 6 знаков). Если
+	буфер меньше 27 символов (для 6 знаков) - обычный вывод
+	по формату (с обрезанием) */
+template<class Char>
+std::size_t put_iso(Char *buf, std::size_t buf_sz,
+	const posix_time::ptime &time)
+{
+	if (time.is_special())
+		return put(buf, buf_sz, my::time::as_special(time));
 
-        /* Делаем копию полученной строки */
-        std::basic_string<Char> new_format(buf);
+	time_fields fields(time);
+	const int digits = posix_time::time_duration::num_fractional_digits();
 
-		/* Используем скопированную строку как формат */
-		ptr = buf;
-		ptr += put(ptr, end - ptr, time.time_of_day(), new_format.c_str());
+	if (buf_sz < 21 + static_cast<std::size_t>(digits))
+	{
+		static const Char format[] = { '%','Y','-','%','m','-','%','d',
+			' ','%','H',':','%','M',':','%','S','%','f', 0 };
+		return put_fields(buf, buf_sz, fields, format);
 	}
 
+	Char *ptr = buf;
+
+	ptr = put_fixed(ptr, fields.year, 4);
+	*ptr++ = Char('-');
+	ptr = put_fixed(ptr, fields.month, 2);
+	*ptr++ = Char('-');
+	ptr = put_fixed(ptr, fields.day, 2);
+	*ptr++ = Char(' ');
+	ptr = put_fixed(ptr, static_cast<unsigned long>(fields.hours), 2);
+	*ptr++ = Char(':');
+	ptr = put_fixed(ptr, fields.minutes, 2);
+	*ptr++ = Char(':');
+	ptr = put_fixed(ptr, fields.seconds, 2);
+	*ptr++ = Char('.');
+	ptr = put_fixed(ptr, fields.fseconds, digits);
+	*ptr = 0;
+
 	return ptr - buf;
 }
 
+/*
+	Заранее разобранный формат: строка формата разбирается один раз
+	в список операций (кусок текста или поле), и дальше вывод идёт
+	за один проход по списку - без повторного разбора формата и без
+	выделения памяти. Для частого вывода по одному формату (лог):
+
+		my::time::wformat fmt(L"%Y-%m-%d %H:%M:%S%f");
+		...
+		my::time::put(buf, buf_sz, my::time::local_now(), fmt);
+*/
+template<class Char>
+class basic_format
+{
+public:
+	explicit basic_format(const Char *format)
+		: text_(format)
+	{
+		compile();
+	}
+
+	explicit basic_format(const std::basic_string<Char> &format)
+		: text_(format)
+	{
+		compile();
+	}
+
+	const std::basic_string<Char>& str() const
+		{ return text_; }
+
+	/* Наибольший размер вывода (без завершающего нуля) */
+	std::size_t max_size() const
+		{ return max_size_; }
+
+	std::size_t put(Char *buf, std::size_t buf_sz,
+		const time_fields &fields) const
+	{
+		/* Буфера заведомо хватает - вывод без проверок */
+		if (buf_sz > max_size_)
+			return put_unchecked(buf, fields);
+
+		Char *ptr = buf;
+		Char *end = buf + buf_sz;
+
+		if (buf_sz)
+			*ptr = 0;
+
+		for (typename std::vector<op>::const_iterator it = ops_.begin();
+			it != ops_.end() && ptr < end; ++it)
+		{
+			if (it->field)
+				ptr += put_field(ptr, end - ptr, it->field, fields);
+			else
+				ptr += my::str::put(ptr, end - ptr,
+					text_.c_str() + it->pos, it->len);
+		}
+
+		return ptr - buf;
+	}
+
+private:
+	/* Операция: field == 0 - текст text_[pos, pos + len),
+		иначе - поле (символ после '%') */
+	struct op
+	{
+		Char field;
+		std::size_t pos;
+		std::size_t len;
+	};
+
+	std::basic_string<Char> text_;
+	std::vector<op> ops_;
+	std::size_t max_size_; /* Наибольший размер вывода */
+
+	std::size_t put_unchecked(Char *buf, const time_fields &fields) const
+	{
+		Char *ptr = buf;
+		Char *end = buf + max_size_ + 1;
+
+		for (typename std::vector<op>::const_iterator it = ops_.begin();
+			it != ops_.end(); ++it)
+		{
+			Char ch = it->field;
+
+			if (!ch)
+			{
+				const Char *text = text_.c_str() + it->pos;
+				for (std::size_t n = it->len; n; n--)
+					*ptr++ = *text++;
+				continue;
+			}
+
+			/* Частые поля - сразу парами цифр, остальные - как обычно */
+			if (fields.has_date && ch == 'Y')
+				ptr = put_fixed(ptr, fields.year, 4);
+			else if (fields.has_date && (ch == 'm' || ch == 'd'))
+				ptr = put_fixed(ptr, ch == 'm' ? fields.month : fields.day, 2);
+			else if (fields.has_time && (ch == 'M' || ch == 'S'))
+				ptr = put_fixed(ptr, ch == 'M' ? fields.minutes : fields.seconds, 2);
+			else if (fields.has_time && ch == 'H' && fields.hours < 100)
+				ptr = put_fixed(ptr, static_cast<unsigned long>(fields.hours), 2);
+			else if (fields.has_time && (ch == 'f' || (ch == 'F' && fields.fseconds)))
+			{
+				*ptr++ = Char('.');
+				ptr = put_fixed(ptr, fields.fseconds,
+					posix_time::time_duration::num_fractional_digits());
+			}
+			else
+				ptr += put_field(ptr, end - ptr, ch, fields);
+		}
+
+		*ptr = 0;
+
+		return ptr - buf;
+	}
+
+	void add_text(std::size_t pos, std::size_t len)
+	{
+		if (!len)
+			return;
+
+		/* Соседние куски текста объединяем */
+		if (!ops_.empty() && !ops_.back().field
+			&& ops_.back().pos + ops_.back().len == pos)
+		{
+			ops_.back().len += len;
+			return;
+		}
+
+		op o = { 0, pos, len };
+		ops_.push_back(o);
+	}
+
+	void compile()
+	{
+		static const Char fields[]
+			= { 'Y','m','d','H','M','S','f','F','+','-', 0 };
+
+		std::size_t size = text_.size();
+		std::size_t pos = 0;
+
+		/* Текст - не длиннее самого формата */
+		max_size_ = size;
+
+		while (pos < size)
+		{
+			std::size_t next = text_.find(Char('%'), pos);
+			if (next == std::basic_string<Char>::npos)
+				next = size;
+
+			add_text(pos, next - pos);
+
+			if (next == size)
+				break;
+
+			/* '%' в конце строки и "%%" - просто '%' */
+			if (next + 1 == size || text_[next + 1] == '%')
+			{
+				add_text(next + (next + 1 != size), 1);
+				pos = next + 2;
+				continue;
+			}
+
+			Char ch = text_[next + 1];
+
+			/* Неизвестные поля выводятся как есть */
+			if (my::str::end(fields) == std::find(fields,
+				my::str::end(fields), ch))
+				add_text(next, 2);
+			else
+			{
+				op o = { ch, 0, 0 };
+				ops_.push_back(o);
+
+				/* Наибольшая ширина поля (и не меньше "%x") */
+				switch (ch)
+				{
+					case 'Y': max_size_ += 4; break;
+					case 'H': max_size_ += 19; break; /* long long */
+					case 'f':
+					case 'F': max_size_ += 1
+						+ posix_time::time_duration::num_fractional_digits();
+						break;
+					default: max_size_ += 2;
+				}
+			}
+
+			pos = next + 2;
+		}
+	}
+};
+
+typedef basic_format<char> format;
+typedef basic_format<wchar_t> wformat;
+
+/* Вывод по заранее разобранному формату */
+template<class Char>
+inline std::size_t put(Char *buf, std::size_t buf_sz,
+	const gregorian::date &date, const basic_format<Char> &format)
+{
+	return date.is_special()
+		? put(buf, buf_sz, date.as_special())
+		: format.put(buf, buf_sz, time_fields(date));
+}
+
+template<class Char>
+inline std::size_t put(Char *buf, std::size_t buf_sz,
+	const posix_time::time_duration &dur, const basic_format<Char> &format)
+{
+	return dur.is_special()
+		? put(buf, buf_sz, my::time::as_special(dur))
+		: format.put(buf, buf_sz, time_fields(dur));
+}
+
+template<class Char>
+inline std::size_t put(Char *buf, std::size_t buf_sz,
+	const posix_time::ptime &time, const basic_format<Char> &format)
+{
+	return time.is_special()
+		? put(buf, buf_sz, my::time::as_special(time))
+		: format.put(buf, buf_sz, time_fields(time));
+}
+
 template<class Char,class Time>
 inline std::basic_string<Char> to_str(const Time &t,
 	const Char *format = 0)
@@ -457,6 +896,44 @@ inline std::wstring to_wstring(const Time &time,
 	{ return my::time::to_str<wchar_t>(time, format); }
 
 
+template<class Char,class Time>
+inline std::basic_string<Char> to_str(const Time &t,
+	const basic_format<Char> &format)
+{
+	Char buf[64];
+	std::size_t n;
+
+	n = my::time::put(buf, sizeof(buf) / sizeof(*buf), t, format);
+
+	if (n < sizeof(buf) / sizeof(*buf) - 1)
+		return std::basic_string<Char>(buf, n);
+
+	std::basic_string<Char> out(n * 2, ' ');
+
+	while (true)
+	{
+		n = my::time::put(&*out.begin(), out.size() + 1, t, format);
+
+		if (n != out.size())
+			break;
+
+		out.resize(n * 2);
+	}
+
+	out.resize(n);
+
+	return out;
+}
+
+template<class Time>
+inline std::string to_string(const Time &time, const format &fmt)
+	{ return my::time::to_str<char>(time, fmt); }
+
+template<class Time>
+inline std::wstring to_wstring(const Time &time, const wformat &fmt)
+	{ return my::time::to_str<wchar_t>(time, fmt); }
+
+
 /*
 	Функции преобразования строки в дату/время
 */
@@ -696,6 +1173,107 @@ inline std::size_t get(const std::basic_string<Char> &str,
 	posix_time::ptime &time, const Char delim = ' ')
 	{ return my::time::get(str.c_str(), str.size(), time, delim); }
 
+/*
+	Быстрый разбор даты/времени в виде "YYYY-MM-DD HH:MM:SS[.ffffff]"
+	(вместо пробела может быть 'T'). Все поля фиксированной ширины,
+	поэтому проверяются и преобразуются сразу все вместе (для char -
+	по 8 символов за раз, см. my_time.cpp). Если строка не в этом
+	виде - разбор обычным get (результат тот же, только медленнее)
+*/
+
+/* Проверка и разбор полей "YYYY-MM-DD HH:MM:SS" в fields
+	(год, месяц, день, часы, минуты, секунды) */
+template<class Char>
+bool parse_iso_fields(const Char *str, const Char *end, int *fields)
+{
+	static const char layout[] = "0000-00-00 00:00:00";
+
+	if (end - str < 19 || (str[10] != ' ' && str[10] != 'T'))
+		return false;
+
+	int digits[14];
+	int *digit = digits;
+
+	for (int i = 0; i < 19; i++)
+	{
+		if (layout[i] == '0')
+		{
+			unsigned int d = static_cast<unsigned int>(str[i] - '0');
+			if (d > 9)
+				return false;
+			*digit++ = d;
+		}
+		else if (i != 10 && str[i] != layout[i])
+			return false;
+	}
+
+	fields[0] = ((digits[0] * 10 + digits[1]) * 10 + digits[2]) * 10
+		+ digits[3];
+	for (int i = 1; i < 6; i++)
+		fields[i] = digits[i * 2 + 2] * 10 + digits[i * 2 + 3];
+
+	return true;
+}
+
+bool parse_iso_fields(const char *str, const char *end, int *fields);
+
+/* Сборка ptime из полей (fseconds - в тиках). Возврат: false,
+	если поля вне допустимых пределов */
+bool make_iso_time(const int *fields, long fseconds,
+	posix_time::ptime &time);
+
+template<class Char>
+std::size_t get_iso(const Char *str, std::size_t str_sz,
+	posix_time::ptime &time)
+{
+	const Char *end = my::str::end(str, str_sz);
+	int fields[6];
+
+	if (parse_iso_fields(str, end, fields))
+	{
+		const Char *ptr = str + 19;
+		long long fseconds = 0;
+
+		/* Секунды - ровно две цифры */
+		bool ok = (ptr == end
+			|| static_cast<unsigned int>(*ptr - '0') > 9);
+
+		/* Доли секунды: не больше, чем точность time_duration
+			(с лишними цифрами - округление в обычном get) */
+		if (ptr != end && *ptr == '.')
+		{
+			const int max_digits
+				= posix_time::time_duration::num_fractional_digits();
+			const Char *begin = ++ptr;
+
+			for (; ptr != end && ptr - begin <= max_digits; ++ptr)
+			{
+				unsigned int d = static_cast<unsigned int>(*ptr - '0');
+				if (d > 9)
+					break;
+				fseconds = fseconds * 10 + d;
+			}
+
+			int n = static_cast<int>(ptr - begin);
+			ok = (n != 0 && n <= max_digits);
+
+			while (n++ < max_digits)
+				fseconds *= 10;
+		}
+
+		if (ok && make_iso_time(fields, static_cast<long>(fseconds), time))
+			return ptr - str;
+	}
+
+	return my::time::get(str, end - str, time,
+		end - str > 10 && str[10] == 'T' ? Char('T') : Char(' '));
+}
+
+template<class Char>
+inline std::size_t get_iso(const std::basic_string<Char> &str,
+	posix_time::ptime &time)
+	{ return my::time::get_iso(str.c_str(), str.size(), time); }
+
 template<class Char>
 inline posix_time::ptime to_time(const Char *str, std::size_t str_sz, const Char delim = ' ')
 {
@@ -714,6 +1292,133 @@ inline posix_time::ptime to_time(const std::basic_string<Char> &str, const Char
 	{ return my::time::to_time(str.c_str(), str.size(), delim); }
 
 
+/*
+	Пакетные функции - для временных рядов (группировка по интервалам,
+	вывод и разбор столбцов времени). Формат разбирается один раз,
+	а для упорядоченных значений пользуемся тем, что соседние
+	значения обычно попадают в один интервал и в один день
+*/
+
+/* Округление массива тиков: out[i] = floor_ticks(ticks[i], prec).
+	out может совпадать с ticks. Деление - только при выходе
+	за текущий интервал */
+inline void floor_many(const long long *ticks, long long *out,
+	std::size_t count, long long prec)
+{
+	long long lo = 0;
+	bool empty = true;
+
+	for (std::size_t i = 0; i < count; i++)
+	{
+		long long t = ticks[i];
+
+		if (empty || static_cast<unsigned long long>(t - lo)
+			>= static_cast<unsigned long long>(prec))
+		{
+			lo = floor_ticks(t, prec);
+			empty = false;
+		}
+
+		out[i] = lo;
+	}
+}
+
+/* Округление массива: out[i] = floor(times[i], prec) */
+void floor_many(const posix_time::ptime *times, posix_time::ptime *out,
+	std::size_t count, const posix_time::time_duration &prec);
+
+/* Вывод значений через delim в буфер buf по формату (как
+	my::num::format_column): выводятся только значения, целиком
+	поместившиеся в буфер, их кол-во - в written. Строка всегда
+	завершается нулём. Дата пересчитывается только при смене дня.
+	Память не выделяется: значения пишутся сразу в buf, пока места
+	заведомо хватает, последние - через буфер на стеке (только для
+	форматов длиннее 63 символов - через временную строку) */
+template<class Char>
+std::size_t format_many(Char *buf, std::size_t buf_sz,
+	const posix_time::ptime *times, std::size_t count,
+	const basic_format<Char> &format, Char delim,
+	std::size_t *written = 0)
+{
+	const std::size_t max_sz = format.max_size();
+
+	/* Для значений, которые могут не поместиться в конец buf */
+	Char stack_tmp[64];
+	std::vector<Char> heap_tmp;
+
+	/* Поля 1970-01-01 - день 0 */
+	time_fields fields(epoch());
+	long last_days = 0;
+
+	Char *ptr = buf;
+	Char *last = buf + (buf_sz ? buf_sz - 1 : 0); /* Место для нуля */
+	std::size_t i = 0;
+
+	for (; i < count; i++)
+	{
+		std::size_t left = last - ptr;
+		std::size_t delim_sz = (i ? 1 : 0);
+		std::size_t size;
+		Char *tmp = stack_tmp;
+
+		if (times[i].is_special())
+			size = put(tmp, sizeof(stack_tmp) / sizeof(*stack_tmp),
+				my::time::as_special(times[i]));
+		else
+		{
+			long long ticks = to_ticks(times[i]);
+			long days = ticks_to_days(ticks);
+
+			if (days != last_days)
+			{
+				civil_from_days(days, fields.year, fields.month, fields.day);
+				last_days = days;
+			}
+			fields.set_time(ticks - days * ticks_per_day());
+
+			/* Если места заведомо хватает - сразу в буфер */
+			if (left >= max_sz + delim_sz)
+			{
+				if (delim_sz)
+					*ptr++ = delim;
+				ptr += format.put(ptr, max_sz + 1, fields);
+				continue;
+			}
+
+			if (max_sz >= sizeof(stack_tmp) / sizeof(*stack_tmp))
+			{
+				heap_tmp.resize(max_sz + 1);
+				tmp = &heap_tmp[0];
+			}
+
+			size = format.put(tmp, max_sz + 1, fields);
+		}
+
+		if (size + delim_sz > left)
+			break;
+
+		if (delim_sz)
+			*ptr++ = delim;
+		ptr = std::copy(tmp, tmp + size, ptr);
+	}
+
+	if (buf_sz)
+		*ptr = 0;
+	if (written)
+		*written = i;
+
+	return ptr - buf;
+}
+
+/* Разбор полей, разделённых символом delim, в массив out (как
+	my::num::parse_column; не более out_sz значений). Поле
+	разбирается get_iso. Значение ошибочного поля - not_a_date_time,
+	в status (если задан) - код: my::num::field_ok, field_empty,
+	field_invalid. Возврат: кол-во разобранных полей */
+std::size_t parse_many(const char *begin, const char *end, char delim,
+	posix_time::ptime *out, std::size_t out_sz, unsigned char *status = 0);
+
+
 }}
 
 #endif
@@ -0,0 +1,331 @@
+﻿#include "my_time.h"
+#include "my_bench.h"
+
+#include <cstddef> /* std::size_t */
+#include <algorithm> /* std::fill */
+#include <string>
+#include <vector>
+using namespace std;
+
+/* Кол-во подготовленных значений (степень двойки - для быстрого
+	перебора по маске) */
+#define DATA_SIZE 1024
+
+/* Вставка ключей в хэш-таблицу с открытой адресацией (размер -
+	степень двойки, линейное пробирование). Возврат: кол-во проб -
+	чем хуже распределение хэша, тем их больше */
+static size_t fill_table(vector<long long> &table,
+	const vector<long long> &keys, bool mix)
+{
+	const size_t mask = table.size() - 1;
+	size_t probes = 0;
+
+	std::fill(table.begin(), table.end(), -1LL);
+
+	for (size_t k = 0; k < keys.size(); k++)
+	{
+		size_t h = (mix ? my::time::hash_ticks(keys[k])
+			: static_cast<size_t>(keys[k]));
+
+		for (size_t pos = h & mask; ; pos = (pos + 1) & mask, probes++)
+			if (table[pos] == -1LL)
+			{
+				table[pos] = keys[k];
+				break;
+			}
+	}
+
+	return probes;
+}
+
+int main(int argc, char *argv[])
+{
+	my::bench::runner bench(argc, argv);
+	my::bench::random rnd;
+
+	vector<posix_time::ptime> times(DATA_SIZE);
+	vector<string> date_strs(DATA_SIZE);
+	vector<string> dur_strs(DATA_SIZE);
+	vector<string> time_strs(DATA_SIZE);
+	vector<wstring> time_wstrs(DATA_SIZE);
+
+	const posix_time::ptime start(gregorian::date(2010, 1, 1));
+
+	for (size_t i = 0; i < DATA_SIZE; i++)
+	{
+		/* Случайное время в пределах ~10 лет с точностью до мкс */
+		times[i] = start + posix_time::microseconds(
+			(long long)rnd(315360000000000ULL));
+		date_strs[i] = my::time::to_string(times[i].date());
+		dur_strs[i] = my::time::to_string(times[i].time_of_day());
+		time_strs[i] = my::time::to_string(times[i]);
+		time_wstrs[i] = my::time::to_wstring(times[i]);
+	}
+
+	char buf[64];
+	wchar_t wbuf[64];
+	size_t i = 0;
+
+	/*
+		Время -> строка
+	*/
+
+	for (my::bench::timer t(bench, "time", "put(date)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::time::put(buf, sizeof(buf),
+			times[i++ & (DATA_SIZE - 1)].date()) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "time", "put(time_duration)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::time::put(buf, sizeof(buf),
+			times[i++ & (DATA_SIZE - 1)].time_of_day()) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "time", "put(ptime)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::time::put(buf, sizeof(buf),
+			times[i++ & (DATA_SIZE - 1)]) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "time", "put(ptime,format)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::time::put(buf, sizeof(buf),
+			times[i++ & (DATA_SIZE - 1)], "%Y-%m-%d %H:%M:%S%f") );
+		my::bench::clobber_memory();
+	}
+
+	const my::time::format format("%Y-%m-%d %H:%M:%S%f");
+
+	for (my::bench::timer t(bench, "time", "put(ptime,time::format)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::time::put(buf, sizeof(buf),
+			times[i++ & (DATA_SIZE - 1)], format) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "time", "put<wchar_t>(ptime,format)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::time::put(wbuf,
+			sizeof(wbuf) / sizeof(*wbuf), times[i++ & (DATA_SIZE - 1)],
+			L"%Y-%m-%d %H:%M:%S%f") );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "time", "put_iso(ptime)"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::time::put_iso(buf, sizeof(buf),
+			times[i++ & (DATA_SIZE - 1)]) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "time", "to_string(ptime)"); t.next(); )
+	{
+		string str = my::time::to_string(times[i++ & (DATA_SIZE - 1)]);
+		my::bench::do_not_optimize(str);
+	}
+
+	/*
+		Строка -> время
+	*/
+
+	for (my::bench::timer t(bench, "time", "get(date)"); t.next(); )
+	{
+		gregorian::date date;
+		const string &str = date_strs[i++ & (DATA_SIZE - 1)];
+		my::bench::do_not_optimize( my::time::get(str.c_str(), str.size(), date) );
+		my::bench::do_not_optimize(date);
+	}
+
+	for (my::bench::timer t(bench, "time", "get(time_duration)"); t.next(); )
+	{
+		posix_time::time_duration dur;
+		const string &str = dur_strs[i++ & (DATA_SIZE - 1)];
+		my::bench::do_not_optimize( my::time::get(str.c_str(), str.size(), dur) );
+		my::bench::do_not_optimize(dur);
+	}
+
+	for (my::bench::timer t(bench, "time", "get(ptime)"); t.next(); )
+	{
+		posix_time::ptime time;
+		const string &str = time_strs[i++ & (DATA_SIZE - 1)];
+		my::bench::do_not_optimize( my::time::get(str.c_str(), str.size(), time) );
+		my::bench::do_not_optimize(time);
+	}
+
+	for (my::bench::timer t(bench, "time", "get_iso(ptime)"); t.next(); )
+	{
+		posix_time::ptime time;
+		const string &str = time_strs[i++ & (DATA_SIZE - 1)];
+		my::bench::do_not_optimize( my::time::get_iso(str.c_str(), str.size(), time) );
+		my::bench::do_not_optimize(time);
+	}
+
+	for (my::bench::timer t(bench, "time", "get<wchar_t>(ptime)"); t.next(); )
+	{
+		posix_time::ptime time;
+		const wstring &str = time_wstrs[i++ & (DATA_SIZE - 1)];
+		my::bench::do_not_optimize( my::time::get(str.c_str(), str.size(), time) );
+		my::bench::do_not_optimize(time);
+	}
+
+	for (my::bench::timer t(bench, "time", "to_time"); t.next(); )
+	{
+		my::bench::do_not_optimize(
+			my::time::to_time(time_strs[i++ & (DATA_SIZE - 1)]) );
+	}
+
+	/*
+		Округление
+	*/
+
+	const posix_time::time_duration sec(0, 0, 1);
+	const posix_time::time_duration min15(0, 15, 0);
+
+	for (my::bench::timer t(bench, "time", "floor(ptime,1s)"); t.next(); )
+	{
+		my::bench::do_not_optimize(
+			my::time::floor(times[i++ & (DATA_SIZE - 1)], sec) );
+	}
+
+	for (my::bench::timer t(bench, "time", "round(ptime,15min)"); t.next(); )
+	{
+		my::bench::do_not_optimize(
+			my::time::round(times[i++ & (DATA_SIZE - 1)], min15) );
+	}
+
+	vector<long long> ticks(DATA_SIZE);
+	for (size_t k = 0; k < DATA_SIZE; k++)
+		ticks[k] = my::time::to_ticks(times[k]);
+
+	const long long min15_ticks = min15.ticks();
+
+	for (my::bench::timer t(bench, "time", "to_ticks"); t.next(); )
+	{
+		my::bench::do_not_optimize(
+			my::time::to_ticks(times[i++ & (DATA_SIZE - 1)]) );
+	}
+
+	for (my::bench::timer t(bench, "time", "from_ticks"); t.next(); )
+	{
+		my::bench::do_not_optimize(
+			my::time::from_ticks(ticks[i++ & (DATA_SIZE - 1)]) );
+	}
+
+	for (my::bench::timer t(bench, "time", "floor_ticks(15min)"); t.next(); )
+	{
+		my::bench::do_not_optimize(
+			my::time::floor_ticks(ticks[i++ & (DATA_SIZE - 1)], min15_ticks) );
+	}
+
+	for (my::bench::timer t(bench, "time", "utc_to_local"); t.next(); )
+	{
+		my::bench::do_not_optimize(
+			my::time::utc_to_local(times[i++ & (DATA_SIZE - 1)]) );
+	}
+
+	for (my::bench::timer t(bench, "time", "local_to_utc"); t.next(); )
+	{
+		my::bench::do_not_optimize(
+			my::time::local_to_utc(times[i++ & (DATA_SIZE - 1)]) );
+	}
+
+	for (my::bench::timer t(bench, "time", "local_now"); t.next(); )
+		my::bench::do_not_optimize( my::time::local_now() );
+
+	/*
+		Временные ряды (на один вызов - DATA_SIZE значений)
+	*/
+
+	/* Упорядоченный ряд: отсчёты через ~1.5 с */
+	vector<posix_time::ptime> series(DATA_SIZE);
+	vector<posix_time::ptime> series_out(DATA_SIZE);
+	for (size_t k = 0; k < DATA_SIZE; k++)
+		series[k] = start + posix_time::microseconds(
+			(long long)k * 1500000 + (long long)rnd(1000000));
+
+	const my::time::format series_format("%Y-%m-%d %H:%M:%S%f");
+	vector<char> series_buf(DATA_SIZE * 32);
+	string series_csv;
+	for (size_t k = 0; k < DATA_SIZE; k++)
+	{
+		if (k)
+			series_csv += ',';
+		series_csv += my::time::to_string(series[k], series_format);
+	}
+
+	const posix_time::time_duration min1(0, 1, 0);
+
+	for (my::bench::timer t(bench, "time", "floor(ptime,1min) x1024"); t.next(); )
+	{
+		for (size_t k = 0; k < DATA_SIZE; k++)
+			series_out[k] = my::time::floor(series[k], min1);
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "time", "floor_many(1min) x1024"); t.next(); )
+	{
+		my::time::floor_many(&series[0], &series_out[0], DATA_SIZE, min1);
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "time", "put(ptime,time::format) x1024"); t.next(); )
+	{
+		char *ptr = &series_buf[0];
+		char *end = ptr + series_buf.size();
+		for (size_t k = 0; k < DATA_SIZE; k++)
+		{
+			ptr += my::time::put(ptr, end - ptr, series[k], series_format);
+			*ptr++ = ',';
+		}
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "time", "format_many x1024"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::time::format_many(&series_buf[0],
+			series_buf.size(), &series[0], DATA_SIZE, series_format, ',') );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "time", "parse_many x1024"); t.next(); )
+	{
+		my::bench::do_not_optimize( my::time::parse_many(series_csv.c_str(),
+			series_csv.c_str() + series_csv.size(), ',', &series_out[0],
+			series_out.size()) );
+		my::bench::clobber_memory();
+	}
+
+	/*
+		Хэш
+	*/
+
+	for (my::bench::timer t(bench, "time", "hash(ptime)"); t.next(); )
+	{
+		my::bench::do_not_optimize(
+			my::time::hash(times[i++ & (DATA_SIZE - 1)]) );
+	}
+
+	/* Ключи кэша по интервалам: время, кратное минуте */
+	vector<long long> minute_keys(DATA_SIZE);
+	vector<long long> table(DATA_SIZE * 2);
+	for (size_t k = 0; k < DATA_SIZE; k++)
+		minute_keys[k] = my::time::to_ticks(start + posix_time::minutes((long)k));
+
+	for (my::bench::timer t(bench, "time", "hash table(ticks) x1024"); t.next(); )
+	{
+		my::bench::do_not_optimize( fill_table(table, minute_keys, false) );
+		my::bench::clobber_memory();
+	}
+
+	for (my::bench::timer t(bench, "time", "hash table(hash_ticks) x1024"); t.next(); )
+	{
+		my::bench::do_not_optimize( fill_table(table, minute_keys, true) );
+		my::bench::clobber_memory();
+	}
+
+	return bench.report();
+}
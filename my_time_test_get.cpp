@@ -212,5 +212,53 @@ int main()
 	TEST("time",time,posix_time::ptime,"2010.06.09 12:00:00.123456 ",-1)
 	TEST("time",time,posix_time::ptime,"29 06 2010 09:30:00 ",-1)
 
+
+#define TEST_ISO(STR,SZ) {\
+	const char cstr[] = STR;\
+	const wchar_t wcstr[] = L##STR;\
+	cout << "string=\"" << STR << "\"" << endl;\
+	\
+	posix_time::ptime t;\
+	std::size_t n;\
+	n = my::time::get_iso(cstr, SZ, t);\
+	cout << "get_iso(cstr," << SZ << ")=" << n << " time=" << t << endl;\
+	n = my::time::get_iso(wcstr, SZ, t);\
+	cout << "get_iso(wcstr," << SZ << ")=" << n << " time=" << t << endl;\
+	char buf[64];\
+	my::time::put_iso(buf, sizeof(buf), t);\
+	cout << "put_iso=" << buf << endl;\
+	cout << endl; }
+
+	cout << "*** iso ***\n" << endl;
+
+	TEST_ISO("2010-06-09 23:59:34",-1)
+	TEST_ISO("2010-06-09T23:59:34.123456",-1)
+	TEST_ISO("2010-06-09 23:59:34.12",-1)
+	TEST_ISO("2010-06-09 23:59:34.123456789",-1)
+	TEST_ISO("2010-06-09 23:59:34.",-1)
+	TEST_ISO("2010-06-09 23:59:34.123456",22)
+	TEST_ISO("2010-02-29 12:00:00",-1)
+	TEST_ISO("2012-02-29 12:00:00",-1)
+	TEST_ISO("2010-06-09 24:00:00",-1)
+	TEST_ISO("2010-06-09 12:00:000",-1)
+	TEST_ISO("2010/06/09 12:00:00.5",-1)
+	TEST_ISO("1399-12-31 23:59:59",-1)
+
+	cout << "\n*** parse_many ***\n" << endl;
+
+	{
+		const char csv[] = "2010-06-09 23:59:34,,junk,"
+			"2010-06-09T23:59:34.5,2010-06-09 23:59:34x,2010-02-29 12:00:00,"
+			"2010-01-01 25:00:00,2010-01-01 23:59:60,2010-06-09 12:00";
+		posix_time::ptime times[10];
+		unsigned char status[10];
+
+		std::size_t n = my::time::parse_many(csv, csv + sizeof(csv) - 1, ',',
+			times, 10, status);
+		cout << "n=" << n << endl;
+		for (std::size_t i = 0; i < n; i++)
+			cout << times[i] << " status=" << (int)status[i] << endl;
+	}
+
 	return 0;
 }
\ No newline at end of file
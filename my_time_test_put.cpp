@@ -130,9 +130,100 @@ int main()
 	TEST_PT( 2010,6,10, 23,19,0,0)
 	TEST_PT_F(1992,6,12, 12,30,0,0, "%Y/%m/%d %H:%M:%S%F")
 	TEST_PT_F(1992,6,12, 12,30,0,0, "%H:%M:%S%F %d.%m.%Y")
+	TEST_PT_F(1992,6,12, 12,30,0,0, "%%H %%Y%% %H%%%M")
 	TEST_TD_F(0,0,0,0,"symbols test %% %Q%* %")
 	TEST_TD_F(0,0,0,123456,"big format <%f%f%f%f%f%f%f%f%f%f>")
 
+
+#define TEST_FMT(t,fmt) {\
+	my::time::format f(fmt);\
+	my::time::wformat wf(L##fmt);\
+	cout << "fmt  = " << fmt << endl;\
+	cout << "str  = " << my::time::to_string(t,f) << flush << endl;\
+	wcout << "wstr = " << my::time::to_wstring(t,wf) << flush << endl;\
+	cout << endl;}
+
+	cout << "\n*** precompiled format ***\n" << endl;
+
+	{
+		posix_time::ptime t(gregorian::date(1992,6,12),
+			posix_time::time_duration(12,30,0,0));
+		TEST_FMT(t, "%Y/%m/%d %H:%M:%S%F")
+		TEST_FMT(t, "%H:%M:%S%f %d.%m.%Y")
+		TEST_FMT(t, "symbols test %% %Q%* %")
+		TEST_FMT(t, "%%H %%Y%% %H%%%M")
+		TEST_FMT(t.date(), "%Y/%m/%d %H:%M:%S%F")
+		TEST_FMT(posix_time::time_duration(-1,2,3,456), "%+ %Hh %Mm %S%Fs")
+		TEST_FMT(posix_time::ptime(), "%Y-%m-%d")
+	}
+
+
+	cout << "*** ticks ***\n" << endl;
+
+	{
+		const long long sec = my::time::ticks_per_second();
+		posix_time::ptime t(gregorian::date(2009,12,31),
+			posix_time::time_duration(23,59,59,500000));
+		long long ticks = my::time::to_ticks(t);
+		cout << ticks << " = " << my::time::from_ticks(ticks) << endl;
+		cout << my::time::from_ticks(my::time::floor_ticks(ticks, 900 * sec)) << endl;
+		cout << my::time::from_ticks(my::time::ceil_ticks(ticks, 900 * sec)) << endl;
+		cout << my::time::from_ticks(my::time::round_ticks(ticks, sec)) << endl;
+
+		/* До 1970 года - тики отрицательные */
+		t = posix_time::ptime(gregorian::date(1969,12,31),
+			posix_time::time_duration(23,59,59,500000));
+		ticks = my::time::to_ticks(t);
+		cout << ticks << " = " << my::time::from_ticks(ticks) << endl;
+		cout << my::time::from_ticks(my::time::floor_ticks(ticks, sec)) << endl;
+		cout << my::time::from_ticks(my::time::ceil_ticks(ticks, sec)) << endl;
+		cout << my::time::from_ticks(my::time::round_ticks(ticks, sec)) << endl;
+
+		int y, m, d;
+		my::time::civil_from_days(my::time::ticks_to_days(ticks), y, m, d);
+		cout << y << "-" << m << "-" << d << " = "
+			<< my::time::days_from_civil(y, m, d) << endl;
+
+		/* Длительности больше 2^31 секунд - без потери точности */
+		cout << my::time::floor(posix_time::hours(1000000)
+			+ posix_time::time_duration(0,0,1,1), posix_time::seconds(1)) << endl;
+		cout << my::time::floor(posix_time::time_duration(0,0,-3,-500000),
+			posix_time::seconds(1)) << endl;
+	}
+
+	cout << "\n*** time series ***\n" << endl;
+
+	{
+		posix_time::ptime times[5] = {
+			posix_time::ptime(gregorian::date(2009,12,31),
+				posix_time::time_duration(23,59,30,250000)),
+			posix_time::ptime(gregorian::date(2009,12,31),
+				posix_time::time_duration(23,59,59,999999)),
+			posix_time::ptime(posix_time::not_a_date_time),
+			posix_time::ptime(gregorian::date(2010,1,1)),
+			posix_time::ptime(gregorian::date(2010,1,1),
+				posix_time::time_duration(0,1,0,500000))
+		};
+		posix_time::ptime floors[5];
+		char buf[128];
+		std::size_t written;
+
+		my::time::floor_many(times, floors, 5, posix_time::minutes(1));
+		for (int i = 0; i < 5; i++)
+			cout << floors[i] << endl;
+
+		const my::time::format fmt("%Y-%m-%d %H:%M:%S%F");
+		std::size_t n = my::time::format_many(buf, sizeof(buf),
+			times, 5, fmt, ';', &written);
+		cout << n << " " << written << " " << buf << endl;
+
+		/* Не поместившиеся значения не выводятся */
+		n = my::time::format_many(buf, 50, times, 5, fmt, ';', &written);
+		cout << n << " " << written << " " << buf << endl;
+	}
+
+	cout << endl;
+
 	cout << my::time::floor(posix_time::time_duration(0,0,3,500000),
 		posix_time::time_duration(0,0,1,000000)) << endl;
 	cout << my::time::ceil(posix_time::time_duration(0,0,3,500000),
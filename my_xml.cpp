@@ -1,127 +1,2122 @@
 ﻿#include "my_xml.h"
+#include "my_num.h" /* MY_NUM_SIMD, lowest_bit */
 #include "my_utf8.h"
 #include "my_str.h"
 #include "my_exception.h"
 
+#include <cstring> /* std::memchr, std::memcmp, std::memmove */
+#include <algorithm> /* std::count, std::lower_bound, std::stable_sort */
 #include <locale>
 #include <sstream>
 
 #include <boost/config.hpp>
 #include <boost/optional.hpp>
 #include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
 
-#include <boost/archive/codecvt_null.hpp>
+#include "fix/rapidxml.hpp"
 
-/* Прописать путь к boost! */
-#include <libs/serialization/src/codecvt_null.cpp>
+namespace {
 
-std::wstring xmlattr_to_str(const xml::wptree::value_type &v)
+/* Экранирование: номер сущности для символа (0 - выводится как есть) */
+const unsigned char escape_table[256] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 4, 0, 0, 0, 3, 5, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 2, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+const char* const escape_entities[] = { "", "&lt;", "&gt;", "&amp;", "&quot;", "&apos;" };
+const unsigned char escape_sizes[] = { 0, 4, 4, 5, 6, 6 };
+
+/* Экранирование <>&"' в конец строки (без перевода в UTF-8) */
+void append_escaped(std::wstring &out, const wchar_t *ptr, std::size_t size)
+{
+	const wchar_t *end = ptr + size;
+
+	while (true)
+	{
+		const wchar_t *run = ptr;
+		while (ptr != end && (static_cast<unsigned long>(*ptr) >= 0x80
+			|| !escape_table[*ptr]))
+			++ptr;
+
+		out.append(run, ptr);
+
+		if (ptr == end)
+			return;
+
+		const unsigned char e = escape_table[*ptr++];
+		out.append(escape_entities[e], escape_entities[e] + escape_sizes[e]);
+	}
+}
+
+template<class Tree>
+std::wstring xmlattr_string(const boost::basic_string_ref<wchar_t> &key,
+	const Tree &pt)
 {
-	std::wostringstream s;
+	std::wstring s;
 
-	s << L"<" << v.first;
+	s += L'<';
+	s.append(key.data(), key.size());
 
-	boost::optional<const xml::wptree&> opt
-		= v.second.get_child_optional(L"<xmlattr>");
+	boost::optional<const Tree&> opt = pt.get_child_optional(L"<xmlattr>");
 
 	if (opt)
 	{
-		BOOST_FOREACH(const xml::wptree::value_type &v, *opt)
-			/*TODO: не учитываю необходимость преобразования кавычек */
-			s << L" " << v.first << L"=\"" << v.second.data() << L"\"";
+		BOOST_FOREACH(const typename Tree::value_type &v, *opt)
+		{
+			s += L' ';
+			s.append(v.first.data(), v.first.size());
+			s += L"=\"";
+			append_escaped(s, v.second.data().data(), v.second.data().size());
+			s += L'"';
+		}
 	}
 
-	if (v.second.size() == 0)
-		s << L" />";
+	if (pt.size() == 0)
+		s += L" />";
 	else
-		s << L"...</" << v.first << ">";
+	{
+		s += L"...</";
+		s.append(key.data(), key.size());
+		s += L'>';
+	}
 
-	return s.str();
+	return s;
 }
 
-std::wstring xmlattr_to_str(const xml::wptree &pt)
+template<class Tree>
+std::wstring xmlattr_string(const Tree &pt)
 {
-	std::wostringstream s;
+	std::wstring s;
 	bool first = true;
 
-	boost::optional<const xml::wptree&> opt
-		= pt.get_child_optional(L"<xmlattr>");
+	boost::optional<const Tree&> opt = pt.get_child_optional(L"<xmlattr>");
 
 	if (opt)
 	{
-		BOOST_FOREACH(const xml::wptree::value_type &v, *opt)
+		BOOST_FOREACH(const typename Tree::value_type &v, *opt)
 		{
 			if (first)
 				first = false;
 			else
-				s << L" ";
+				s += L' ';
 
-			/*TODO: не учитываю необходимость преобразования кавычек */
-			s << v.first << L"=\"" << v.second.data() << L"\"";
+			s.append(v.first.data(), v.first.size());
+			s += L"=\"";
+			append_escaped(s, v.second.data().data(), v.second.data().size());
+			s += L'"';
 		}
 	}
 
 	if ( pt.size() > (size_t)(opt ? 1 : 0) )
-		s << L" ...";
+		s += L" ...";
 
-	return s.str();
+	return s;
 }
 
-void my::xml::load(const std::wstring &filename, ::xml::wptree &pt)
+}
+
+std::wstring xmlattr_to_str(const xml::wptree::value_type &v)
+{
+	return xmlattr_string(v.first, v.second);
+}
+
+std::wstring xmlattr_to_str(const xml::wptree &pt)
+{
+	return xmlattr_string(pt);
+}
+
+std::wstring xmlattr_to_str(const my::xml::frozen_value &v)
+{
+	return xmlattr_string(v.first, v.second);
+}
+
+std::wstring xmlattr_to_str(const my::xml::frozen_node &pt)
 {
-	int charset;
+	return xmlattr_string(pt);
+}
+
+/*
+	my::xml::frozen_tree
+*/
+
+/* Построение frozen_tree обходом в глубину: begin_node (ключ
+	дописан в chars), данные - в data(), дети, end_node.
+
+	Законченные узлы лежат на стеке, пока не закончится их родитель -
+	тогда все его дети одним блоком переносятся в общий массив. Так
+	дети любого узла оказываются рядом. Память итогового дерева
+	выделяется в finish - точно по размеру */
+class my::xml::frozen_builder : boost::noncopyable
+{
+public:
+	std::wstring chars; /* Ключи и данные всех узлов */
+
+	frozen_builder()
+		: stack_(1), levels_(1, 1), data_(1) {}
 
-	/* Чтение BOM - лучше способа не нашёл, чтобы считать BOM в char,
-		а дальше заново открыть файл в wchar_t */
+	/* Новый узел, ключ - chars с позиции key и до конца */
+	void begin_node(std::size_t key)
 	{
-		fs::ifstream fs(filename, ios_base::in | ios_base::binary);
+		record r = record();
+		r.key = key;
+		r.key_size = chars.size() - key;
+		stack_.push_back(r);
 
-		if (!fs)
-			throw my::exception(L"Не удалось открыть файл")
-				<< my::param(L"file", filename);
+		levels_.push_back(stack_.size());
+		if (data_.size() < levels_.size())
+			data_.resize(levels_.size());
+		else
+			data_[levels_.size() - 1].clear();
+	}
+
+	/* Данные текущего узла */
+	std::wstring& data()
+		{ return data_[levels_.size() - 1]; }
+
+	void end_node()
+	{
+		const std::size_t start = levels_.back();
+		record &node = stack_[start - 1];
+
+		node.children = nodes_.size();
+		node.size = stack_.size() - start;
+		nodes_.insert(nodes_.end(), stack_.begin() + start, stack_.end());
+		stack_.resize(start);
+
+		node.index = index_.size();
+		for (std::size_t i = 0; i < node.size; i++)
+			index_.push_back( static_cast<unsigned>(i) );
+
+		if (node.size > 1)
+			std::stable_sort(index_.begin() + node.index, index_.end(),
+				key_less(chars, &nodes_[node.children]));
+
+		std::wstring &text = data();
+		node.data = chars.size();
+		node.data_size = text.size();
+		chars += text;
+
+		levels_.pop_back();
+	}
+
+	void finish(frozen_tree &tree)
+	{
+		end_node();
+
+		tree.chars_.assign(chars.begin(), chars.end());
+		tree.index_.assign(index_.begin(), index_.end());
+		tree.nodes_.resize(nodes_.size());
+
+		for (std::size_t i = 0; i < nodes_.size(); i++)
+		{
+			tree.nodes_[i].first = boost::wstring_ref(
+				data_ptr(tree.chars_) + nodes_[i].key, nodes_[i].key_size);
+			set_node(tree, tree.nodes_[i].second, nodes_[i]);
+		}
+
+		set_node(tree, tree, stack_[0]);
+	}
+
+private:
+	struct record
+	{
+		std::size_t key;
+		std::size_t key_size;
+		std::size_t data;
+		std::size_t data_size;
+		std::size_t children;
+		std::size_t size;
+		std::size_t index;
+	};
+
+	/* Сравнение ключей детей (по индексам в блоке) */
+	struct key_less
+	{
+		const std::wstring &chars;
+		const record *block;
+
+		key_less(const std::wstring &c, const record *b)
+			: chars(c), block(b) {}
+
+		bool operator()(unsigned a, unsigned b) const
+		{
+			return chars.compare(block[a].key, block[a].key_size,
+				chars, block[b].key, block[b].key_size) < 0;
+		}
+	};
+
+	std::vector<record> stack_; /* Дети открытых узлов */
+	std::vector<std::size_t> levels_; /* Начало детей каждого открытого узла */
+	std::vector<std::wstring> data_; /* Данные открытых узлов */
+	std::vector<record> nodes_;
+	std::vector<unsigned> index_;
+
+	template<class T>
+	static T* data_ptr(std::vector<T> &v)
+		{ return v.empty() ? 0 : &v[0]; }
+
+	static void set_node(frozen_tree &tree, frozen_node &node, const record &r)
+	{
+		node.children_ = data_ptr(tree.nodes_) + r.children;
+		node.sorted_ = data_ptr(tree.index_) + r.index;
+		node.size_ = static_cast<unsigned>(r.size);
+		node.data_ = data_ptr(tree.chars_) + r.data;
+		node.data_size_ = static_cast<unsigned>(r.data_size);
+	}
+};
+
+namespace {
+
+/* Сравнение ключа ребёнка (по индексу из таблицы) с ключом */
+struct frozen_key_less
+{
+	const my::xml::frozen_value *children;
+
+	explicit frozen_key_less(const my::xml::frozen_value *c)
+		: children(c) {}
+
+	bool operator()(unsigned i, const boost::wstring_ref &key) const
+		{ return children[i].first.compare(key) < 0; }
+
+	bool operator()(const boost::wstring_ref &key, unsigned i) const
+		{ return key.compare(children[i].first) < 0; }
+};
+
+/* wptree - в frozen_tree */
+void freeze(const ::xml::wptree &pt, my::xml::frozen_builder &builder)
+{
+	BOOST_FOREACH(const ::xml::wptree::value_type &v, pt)
+	{
+		std::size_t key = builder.chars.size();
+		builder.chars += v.first;
+		builder.begin_node(key);
+		builder.data() = v.second.data();
+		freeze(v.second, builder);
+		builder.end_node();
+	}
+}
+
+}
+
+my::xml::frozen_node::const_iterator
+my::xml::frozen_node::find(const boost::wstring_ref &key) const
+{
+	const unsigned *it = std::lower_bound(sorted_, sorted_ + size_, key,
+		frozen_key_less(children_));
+
+	if (it == sorted_ + size_ || children_[*it].first != key)
+		return end();
+
+	return children_ + *it;
+}
+
+std::pair<my::xml::frozen_node::const_assoc_iterator,
+	my::xml::frozen_node::const_assoc_iterator>
+my::xml::frozen_node::equal_range(const boost::wstring_ref &key) const
+{
+	std::pair<const unsigned*, const unsigned*> range = std::equal_range(
+		sorted_, sorted_ + size_, key, frozen_key_less(children_));
+
+	return std::make_pair(
+		boost::make_permutation_iterator(children_, range.first),
+		boost::make_permutation_iterator(children_, range.second));
+}
+
+std::size_t my::xml::frozen_node::count(const boost::wstring_ref &key) const
+{
+	std::pair<const unsigned*, const unsigned*> range = std::equal_range(
+		sorted_, sorted_ + size_, key, frozen_key_less(children_));
+
+	return range.second - range.first;
+}
+
+const my::xml::frozen_node*
+my::xml::frozen_node::walk_path(path_type &path) const
+{
+	const frozen_node *node = this;
+
+	while (!path.empty())
+	{
+		const std::wstring key = path.reduce();
+		const_iterator it = node->find(key);
+
+		if (it == node->end())
+			return 0;
+
+		node = &it->second;
+	}
+
+	return node;
+}
+
+const my::xml::frozen_node&
+my::xml::frozen_node::get_child(const path_type &path) const
+{
+	path_type p(path);
+	const frozen_node *node = walk_path(p);
+
+	if (!node)
+		BOOST_PROPERTY_TREE_THROW( ::xml::ptree_bad_path("No such node", path) );
+
+	return *node;
+}
+
+boost::optional<const my::xml::frozen_node&>
+my::xml::frozen_node::get_child_optional(const path_type &path) const
+{
+	path_type p(path);
+	const frozen_node *node = walk_path(p);
+
+	if (!node)
+		return boost::optional<const frozen_node&>();
+
+	return *node;
+}
+
+my::xml::frozen_tree::frozen_tree(const ::xml::wptree &pt)
+{
+	frozen_builder builder;
+	builder.data() = pt.data();
+	freeze(pt, builder);
+	builder.finish(*this);
+}
+
+void my::xml::frozen_tree::swap(frozen_tree &other)
+{
+	/* Векторы меняются буферами - указатели в узлах остаются верными */
+	std::swap( static_cast<frozen_node&>(*this),
+		static_cast<frozen_node&>(other) );
+	nodes_.swap(other.nodes_);
+	chars_.swap(other.chars_);
+	index_.swap(other.index_);
+}
+
+std::size_t my::xml::frozen_tree::memory_size() const
+{
+	return nodes_.capacity() * sizeof(frozen_value)
+		+ chars_.capacity() * sizeof(wchar_t)
+		+ index_.capacity() * sizeof(unsigned);
+}
 
-		unsigned char ch = fs.get();
+namespace {
 
-		/* utf8 */
-		if (ch == 0xEF && fs.get() == 0xBB && fs.get() == 0xBF)
-			charset = 0;
-		/* unicode */
-		else if (ch == 0xFF && fs.get() == 0xFE)
-			charset = 1;
-		/* ansi */
+/* Ошибка в тексте - как ошибка rapidxml (строка считается по where) */
+inline void throw_parse_error(const char *what, const char *where)
+{
+	throw rapidxml::parse_error(what, const_cast<char*>(where));
+}
+
+/* Символ по коду - в UTF-8 (до 4 байт) */
+inline char* put_code(char *out, unsigned long code)
+{
+	if (code < 0x80)
+		*out++ = static_cast<char>(code);
+	else if (code < 0x800)
+	{
+		*out++ = static_cast<char>(0xC0 | (code >> 6));
+		*out++ = static_cast<char>(0x80 | (code & 0x3F));
+	}
+	else if (code < 0x10000)
+	{
+		*out++ = static_cast<char>(0xE0 | (code >> 12));
+		*out++ = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+		*out++ = static_cast<char>(0x80 | (code & 0x3F));
+	}
+	else
+	{
+		*out++ = static_cast<char>(0xF0 | (code >> 18));
+		*out++ = static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+		*out++ = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+		*out++ = static_cast<char>(0x80 | (code & 0x3F));
+	}
+
+	return out;
+}
+
+/* Символ по коду - в конец строки */
+inline void append_code(std::string &out, unsigned long code)
+{
+	char buf[4];
+	out.append(buf, put_code(buf, code));
+}
+
+inline wchar_t* put_code(wchar_t *out, unsigned long code)
+{
+	/* 16-битный wchar_t (Windows) - суррогатная пара */
+	if (sizeof(wchar_t) == 2 && code >= 0x10000)
+	{
+		code -= 0x10000;
+		*out++ = static_cast<wchar_t>(0xD800 + (code >> 10));
+		*out++ = static_cast<wchar_t>(0xDC00 + (code & 0x3FF));
+	}
+	else
+		*out++ = static_cast<wchar_t>(code);
+
+	return out;
+}
+
+inline void append_code(std::wstring &out, unsigned long code)
+{
+	wchar_t buf[2];
+	out.append(buf, put_code(buf, code));
+}
+
+/* Кусок текста без сущностей - как есть */
+inline void append_run(std::string &out, const char *ptr, const char *end)
+{
+	out.append(ptr, end);
+}
+
+/* Кусок текста без сущностей - с декодированием UTF-8. Правила -
+	те же, что и в my::utf8 (boost utf8_codecvt_facet), но ошибка
+	не обрезает строку, а прерывает разбор */
+static void append_run(std::wstring &out, const char *ptr, const char *end)
+{
+	/* Первый байт UTF-8: поправка по кол-ву продолжающих байт */
+	static const unsigned long lead_modifier[6] =
+		{ 0x00, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC };
+
+	/* Чаще всего - только ascii: без промежуточного resize */
+	const char *ascii_end = ptr;
+	while (ascii_end != end && static_cast<unsigned char>(*ascii_end) < 0x80)
+		++ascii_end;
+
+	out.append(ptr, ascii_end);
+	ptr = ascii_end;
+
+	if (ptr == end)
+		return;
+
+	/* Символов никогда не больше, чем байт (суррогатная пара -
+		из 4 байт) */
+	std::size_t size = out.size();
+	out.resize(size + (end - ptr));
+
+	wchar_t *begin_out = &out[0];
+	wchar_t *ptr_out = begin_out + size;
+
+	while (ptr != end)
+	{
+		unsigned char ch = static_cast<unsigned char>(*ptr);
+
+		if (ch < 0x80)
+		{
+			*ptr_out++ = ch;
+			++ptr;
+			continue;
+		}
+
+		if (ch < 0xC0 || ch > 0xFD)
+			throw_parse_error("invalid UTF-8", ptr);
+
+		int count = (ch < 0xE0 ? 1 : ch < 0xF0 ? 2 : ch < 0xF8 ? 3
+			: ch < 0xFC ? 4 : 5);
+
+		if (end - ptr <= count)
+			throw_parse_error("invalid UTF-8", ptr);
+
+		unsigned long code = ch - lead_modifier[count];
+
+		for (int i = 1; i <= count; i++)
+		{
+			ch = static_cast<unsigned char>(ptr[i]);
+			if ((ch & 0xC0) != 0x80)
+				throw_parse_error("invalid UTF-8", ptr + i);
+
+			code = (code << 6) + (ch - 0x80);
+		}
+
+		ptr += count + 1;
+		ptr_out = put_code(ptr_out, code);
+	}
+
+	out.resize(ptr_out - begin_out);
+}
+
+/* Значение цифры (hex = true - 16-ричной). Возврат: -1 - не цифра */
+inline int digit_value(char ch, bool hex)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+
+	if (hex)
+	{
+		ch |= 0x20;
+		if (ch >= 'a' && ch <= 'f')
+			return ch - 'a' + 10;
+	}
+
+	return -1;
+}
+
+/* Сущность в начале ptr (*ptr == '&'): &amp;, &lt;, &gt;, &quot;,
+	&apos;, &#...; (как в rapidxml). Возврат: длина сущности или 0 -
+	не сущность ('&' остаётся как есть). Ошибка в &#...; - исключение */
+std::size_t parse_entity(const char *ptr, const char *end, unsigned long &code)
+{
+	static const struct
+	{
+		const char *name;
+		std::size_t size;
+		char ch;
+	} names[] = {
+		{ "&amp;", 5, '&' }, { "&apos;", 6, '\'' }, { "&quot;", 6, '"' },
+		{ "&gt;", 4, '>' }, { "&lt;", 4, '<' } };
+
+	const std::size_t left = end - ptr;
+
+	for (std::size_t i = 0; i < sizeof(names) / sizeof(*names); i++)
+		if (left >= names[i].size
+			&& std::memcmp(ptr, names[i].name, names[i].size) == 0)
+		{
+			code = static_cast<unsigned char>(names[i].ch);
+			return names[i].size;
+		}
+
+	if (left < 2 || ptr[1] != '#')
+		return 0;
+
+	const char *p = ptr + 2;
+	const bool hex = (p != end && *p == 'x');
+	int digit;
+
+	if (hex)
+		++p;
+
+	code = 0;
+	for (; p != end && (digit = digit_value(*p, hex)) >= 0; ++p)
+		if (code < 0x110000)
+			code = code * (hex ? 16 : 10) + digit;
+
+	if (p == end || *p != ';')
+		throw_parse_error("expected ;", p);
+
+	if (code >= 0x110000)
+		throw_parse_error("invalid numeric character entity", ptr);
+
+	return p + 1 - ptr;
+}
+
+/* Текст xml - в конец строки ptree, с заменой сущностей */
+template<class Str>
+void append_text(Str &out, const char *ptr, std::size_t size, bool entities)
+{
+	const char *end = ptr + size;
+
+	if (!entities)
+	{
+		append_run(out, ptr, end);
+		return;
+	}
+
+	while (true)
+	{
+		const char *amp = static_cast<const char*>(
+			std::memchr(ptr, '&', end - ptr));
+
+		if (!amp)
+		{
+			append_run(out, ptr, end);
+			return;
+		}
+
+		append_run(out, ptr, amp);
+		ptr = amp;
+
+		unsigned long code;
+		std::size_t n = parse_entity(ptr, end, code);
+
+		if (n)
+		{
+			append_code(out, code);
+			ptr += n;
+		}
+		else
+		{
+			out += '&';
+			++ptr;
+		}
+	}
+}
+
+/* Замена сущностей на месте (результат никогда не длиннее).
+	Возврат: новая длина */
+std::size_t decode_entities(char *str, std::size_t size)
+{
+	char *end = str + size;
+	char *ptr = static_cast<char*>(std::memchr(str, '&', size));
+
+	if (!ptr)
+		return size;
+
+	char *out = ptr;
+
+	while (ptr != end)
+	{
+		unsigned long code;
+		std::size_t n = (*ptr == '&' ? parse_entity(ptr, end, code) : 0);
+
+		if (n)
+		{
+			out = put_code(out, code);
+			ptr += n;
+		}
 		else
-			charset = 2;
+			*out++ = *ptr++;
 	}
 
-	/* Открываем заново, пропускаем BOM */
-	fs::wifstream fs(filename);
+	return out - str;
+}
+
+/* Узел rapidxml - в ptree (как read_xml_node из boost) */
+template<class Ptree>
+void read_node(rapidxml::xml_node<char> *node, Ptree &pt)
+{
+	typedef typename Ptree::key_type Str;
+	typedef typename Ptree::value_type value_type;
 
-	switch (charset)
+	switch (node->type())
 	{
-		case 0:
-			fs.seekg(3);
-			fs.imbue( locale( fs.getloc(),
-				new boost::archive::detail::utf8_codecvt_facet) );
+		case rapidxml::node_element:
+		{
+			Str name;
+			append_text(name, node->name(), node->name_size(), false);
+
+			Ptree &pt_node = pt.push_back( value_type(name, Ptree()) )->second;
+
+			if (node->first_attribute())
+			{
+				Ptree &pt_attrs = pt_node.push_back( value_type(
+					::xml::xml_parser::xmlattr<Str>(), Ptree()) )->second;
+
+				for (rapidxml::xml_attribute<char> *attr = node->first_attribute();
+					attr; attr = attr->next_attribute())
+				{
+					name.clear();
+					append_text(name, attr->name(), attr->name_size(), false);
+
+					Ptree &pt_attr = pt_attrs.push_back(
+						value_type(name, Ptree()) )->second;
+					append_text(pt_attr.data(), attr->value(), attr->value_size(), true);
+				}
+			}
+
+			for (rapidxml::xml_node<char> *child = node->first_node();
+				child; child = child->next_sibling())
+				read_node(child, pt_node);
+
 			break;
+		}
 
-		case 1:
-			fs.seekg(2);
-			fs.imbue( locale( fs.getloc(),
-				new boost::archive::codecvt_null<wchar_t>) );
+		case rapidxml::node_data:
+			append_text(pt.data(), node->value(), node->value_size(), true);
 			break;
 
-		case 2:
-			fs.imbue( locale("") );
+		case rapidxml::node_cdata:
+			append_text(pt.data(), node->value(), node->value_size(), false);
 			break;
-	}
 
-	try
-	{
-		my::xml::parse(fs, pt);
+		case rapidxml::node_comment:
+		{
+			Str value;
+			append_text(value, node->value(), node->value_size(), false);
+			pt.push_back( value_type(
+				::xml::xml_parser::xmlcomment<Str>(), Ptree(value)) );
+			break;
+		}
+
+		default:
+			break;
 	}
-	catch(my::exception &e)
+}
+
+/* Узел rapidxml - в frozen_tree (так же, как в ptree) */
+void read_node(rapidxml::xml_node<char> *node, my::xml::frozen_builder &builder)
+{
+	std::size_t key = builder.chars.size();
+
+	switch (node->type())
+	{
+		case rapidxml::node_element:
+		{
+			append_text(builder.chars, node->name(), node->name_size(), false);
+			builder.begin_node(key);
+
+			if (node->first_attribute())
+			{
+				key = builder.chars.size();
+				builder.chars += ::xml::xml_parser::xmlattr<std::wstring>();
+				builder.begin_node(key);
+
+				for (rapidxml::xml_attribute<char> *attr = node->first_attribute();
+					attr; attr = attr->next_attribute())
+				{
+					key = builder.chars.size();
+					append_text(builder.chars, attr->name(), attr->name_size(), false);
+					builder.begin_node(key);
+					append_text(builder.data(), attr->value(), attr->value_size(), true);
+					builder.end_node();
+				}
+
+				builder.end_node();
+			}
+
+			for (rapidxml::xml_node<char> *child = node->first_node();
+				child; child = child->next_sibling())
+				read_node(child, builder);
+
+			builder.end_node();
+			break;
+		}
+
+		case rapidxml::node_data:
+			append_text(builder.data(), node->value(), node->value_size(), true);
+			break;
+
+		case rapidxml::node_cdata:
+			append_text(builder.data(), node->value(), node->value_size(), false);
+			break;
+
+		case rapidxml::node_comment:
+			builder.chars += ::xml::xml_parser::xmlcomment<std::wstring>();
+			builder.begin_node(key);
+			append_text(builder.data(), node->value(), node->value_size(), false);
+			builder.end_node();
+			break;
+
+		default:
+			break;
+	}
+}
+
+/* Документ rapidxml - в дерево */
+template<class Ptree>
+void read_document(rapidxml::xml_document<char> &doc, Ptree &pt)
+{
+	for (rapidxml::xml_node<char> *child = doc.first_node();
+		child; child = child->next_sibling())
+		read_node(child, pt);
+}
+
+void read_document(rapidxml::xml_document<char> &doc, my::xml::frozen_tree &tree)
+{
+	my::xml::frozen_builder builder;
+
+	for (rapidxml::xml_node<char> *child = doc.first_node();
+		child; child = child->next_sibling())
+		read_node(child, builder);
+
+	builder.finish(tree);
+}
+
+/* Разбор без изменения буфера (parse_non_destructive): имена
+	и значения - ссылки в буфер, сущности заменяются при переводе
+	в строки ptree */
+template<class Tree>
+void parse_buffer(const char *data, std::size_t size, Tree &pt)
+{
+	const int flags = rapidxml::parse_non_destructive
+		| rapidxml::parse_comment_nodes;
+
+	/* В документе - статический пул на 64 Кб, не для стека */
+	boost::scoped_ptr< rapidxml::xml_document<char> > doc(
+		new rapidxml::xml_document<char>);
+
+	try
+	{
+		doc->parse<flags>(const_cast<char*>(data));
+
+		Tree local;
+		read_document(*doc, local);
+		pt.swap(local);
+	}
+	catch (rapidxml::parse_error &e)
+	{
+		const char *where = e.where<char>();
+		if (where < data || where > data + size)
+			where = data + size;
+
+		throw my::exception(L"Ошибка разбора xml-данных")
+			<< my::param(L"line", std::count(data, where, '\n') + 1)
+			<< my::param(L"error", my::str::to_wstring(e.what()));
+	}
+}
+
+}
+
+void my::xml::parse_utf8(const char *data, std::size_t size, ::xml::ptree &pt)
+{
+	parse_buffer(data, size, pt);
+}
+
+void my::xml::parse_utf8(const char *data, std::size_t size, ::xml::wptree &pt)
+{
+	parse_buffer(data, size, pt);
+}
+
+void my::xml::parse_utf8(const char *data, std::size_t size, frozen_tree &tree)
+{
+	parse_buffer(data, size, tree);
+}
+
+/*
+	my::xml::reader
+*/
+
+namespace {
+
+inline bool is_space(char ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+/* Конец имени (элемента, атрибута) */
+inline bool is_name_end(char ch)
+{
+	return is_space(ch) || ch == '/' || ch == '>' || ch == '=';
+}
+
+inline const char* skip_spaces(const char *ptr, const char *end)
+{
+	while (ptr != end && is_space(*ptr))
+		++ptr;
+	return ptr;
+}
+
+}
+
+std::wstring my::xml::to_wstring(const boost::string_ref &text)
+{
+	std::wstring str;
+
+	try
+	{
+		append_run(str, text.data(), text.data() + text.size());
+	}
+	catch (rapidxml::parse_error &e)
+	{
+		throw my::exception(L"Ошибка преобразования UTF-8")
+			<< my::param(L"error", my::str::to_wstring(e.what()));
+	}
+
+	return str;
+}
+
+my::xml::reader::reader(std::istream &in, std::size_t buffer_size)
+	: in_(in)
+	, buf_(buffer_size ? buffer_size : 1)
+	, pos_(0)
+	, size_(0)
+	, eof_(false)
+	, started_(false)
+	, self_closing_(false)
+	, pop_(false)
+	, line_(1)
+	, event_line_(1)
+	, event_(end_document)
+{
+}
+
+boost::string_ref my::xml::reader::name() const
+{
+	if (name_offsets_.empty())
+		return boost::string_ref();
+
+	const std::size_t offset = name_offsets_.back();
+	return boost::string_ref(names_.data() + offset, names_.size() - offset);
+}
+
+/* Дочитывание данных в буфер. Прочитанное ранее сдвигается в начало
+	(смещения от pos_ сохраняются), заполненный буфер - растёт */
+bool my::xml::reader::fill()
+{
+	if (eof_)
+		return false;
+
+	if (pos_)
+	{
+		std::memmove(&buf_[0], &buf_[pos_], size_ - pos_);
+		size_ -= pos_;
+		pos_ = 0;
+	}
+
+	if (size_ == buf_.size())
+		buf_.resize(buf_.size() * 2);
+
+	in_.read(&buf_[size_], buf_.size() - size_);
+	const std::size_t count = static_cast<std::size_t>(in_.gcount());
+
+	if (count == 0)
+	{
+		eof_ = true;
+		return false;
+	}
+
+	size_ += count;
+	return true;
+}
+
+/* В буфере - не меньше size байт от pos_ */
+bool my::xml::reader::ensure(std::size_t size)
+{
+	while (size_ - pos_ < size)
+		if (!fill())
+			return false;
+	return true;
+}
+
+bool my::xml::reader::starts_with(const char *str, std::size_t size)
+{
+	return ensure(size) && std::memcmp(&buf_[pos_], str, size) == 0;
+}
+
+/* Поиск str от pos_ + from. Возврат: смещение от pos_ или npos,
+	если данные кончились */
+std::size_t my::xml::reader::find(const char *str, std::size_t size,
+	std::size_t from)
+{
+	while (true)
+	{
+		const char *begin = &buf_[0] + pos_;
+		const char *end = &buf_[0] + size_;
+
+		for (const char *ptr = begin + from;
+			end - ptr >= static_cast<std::ptrdiff_t>(size); ++ptr)
+		{
+			ptr = static_cast<const char*>(std::memchr(ptr, *str, end - ptr));
+
+			if (!ptr || end - ptr < static_cast<std::ptrdiff_t>(size))
+				break;
+
+			if (std::memcmp(ptr, str, size) == 0)
+				return ptr - begin;
+		}
+
+		/* Начало str может оказаться в конце буфера */
+		const std::size_t left = size_ - pos_;
+		if (left >= size && left - size + 1 > from)
+			from = left - size + 1;
+
+		if (!fill())
+			return std::string::npos;
+	}
+}
+
+/* Конец открывающего тега ('>' вне кавычек). Возврат: смещение от pos_ */
+std::size_t my::xml::reader::find_tag_end()
+{
+	std::size_t offset = 1;
+	char quote = 0;
+
+	while (true)
+	{
+		for (; pos_ + offset < size_; ++offset)
+		{
+			const char ch = buf_[pos_ + offset];
+
+			if (quote)
+			{
+				if (ch == quote)
+					quote = 0;
+			}
+			else if (ch == '"' || ch == '\'')
+				quote = ch;
+			else if (ch == '>')
+				return offset;
+		}
+
+		if (!fill())
+			throw_parse_error("unexpected end of data", &buf_[0] + size_);
+	}
+}
+
+/* Конец DOCTYPE - с учётом вложенных [] (как в rapidxml) */
+std::size_t my::xml::reader::find_doctype_end()
+{
+	std::size_t offset = 2;
+	int depth = 0;
+
+	while (true)
+	{
+		for (; pos_ + offset < size_; ++offset)
+		{
+			const char ch = buf_[pos_ + offset];
+
+			if (ch == '[')
+				++depth;
+			else if (ch == ']')
+				--depth;
+			else if (ch == '>' && depth <= 0)
+				return offset;
+		}
+
+		if (!fill())
+			throw_parse_error("unexpected end of data", &buf_[0] + size_);
+	}
+}
+
+/* Пропуск size байт (со счётом строк) */
+void my::xml::reader::skip(std::size_t size)
+{
+	const char *ptr = &buf_[0] + pos_;
+	line_ += std::count(ptr, ptr + size, '\n');
+	pos_ += size;
+}
+
+/* Разбор открывающего тега [pos_, pos_ + tag_end] */
+void my::xml::reader::parse_tag(std::size_t tag_end)
+{
+	char *begin = &buf_[0] + pos_;
+	char *ptr = begin + 1;
+	char *end = begin + tag_end;
+
+	char *name = ptr;
+	while (ptr != end && !is_name_end(*ptr))
+		++ptr;
+
+	if (ptr == name)
+		throw_parse_error("expected element name", ptr);
+
+	name_offsets_.push_back(names_.size());
+	names_.append(name, ptr);
+
+	while (true)
+	{
+		ptr = const_cast<char*>(skip_spaces(ptr, end));
+
+		if (ptr == end || *ptr == '/')
+			break;
+
+		attribute attr;
+		char *attr_name = ptr;
+
+		while (ptr != end && !is_name_end(*ptr))
+			++ptr;
+
+		if (ptr == attr_name)
+			throw_parse_error("expected >", ptr);
+
+		attr.name = boost::string_ref(attr_name, ptr - attr_name);
+
+		ptr = const_cast<char*>(skip_spaces(ptr, end));
+		if (ptr == end || *ptr != '=')
+			throw_parse_error("expected =", ptr);
+
+		ptr = const_cast<char*>(skip_spaces(ptr + 1, end));
+		if (ptr == end || (*ptr != '"' && *ptr != '\''))
+			throw_parse_error("expected ' or \"", ptr);
+
+		/* Закрывающая кавычка - до end (см. find_tag_end) */
+		char *value = ++ptr;
+		ptr = static_cast<char*>(std::memchr(value, ptr[-1], end - value));
+		if (!ptr)
+			throw_parse_error("expected ' or \"", end);
+
+		attr.value = boost::string_ref(value, decode_entities(value, ptr - value));
+		attributes_.push_back(attr);
+
+		++ptr;
+	}
+
+	self_closing_ = (ptr != end);
+	if (self_closing_ && ptr + 1 != end)
+		throw_parse_error("expected >", ptr + 1);
+}
+
+my::xml::reader::event_type my::xml::reader::next()
+{
+	try
+	{
+		return event_ = next_();
+	}
+	catch (rapidxml::parse_error &e)
+	{
+		const char *begin = &buf_[0] + pos_;
+		const char *where = e.where<char>();
+
+		if (where < begin || where > &buf_[0] + size_)
+			where = begin;
+
+		throw my::exception(L"Ошибка разбора xml-данных")
+			<< my::param(L"line", line_ + std::count(begin, where, '\n'))
+			<< my::param(L"error", my::str::to_wstring(e.what()));
+	}
+}
+
+my::xml::reader::event_type my::xml::reader::next_()
+{
+	if (self_closing_)
+	{
+		self_closing_ = false;
+		pop_ = true;
+		return end_element;
+	}
+
+	if (pop_)
+	{
+		names_.erase(name_offsets_.back());
+		name_offsets_.pop_back();
+		pop_ = false;
+	}
+
+	attributes_.clear();
+	value_ = boost::string_ref();
+
+	if (!started_)
+	{
+		started_ = true;
+		if (starts_with("\xEF\xBB\xBF", 3))
+			pos_ += 3;
+	}
+
+	while (true)
+	{
+		/* Текст до тега */
+		std::size_t size = find("<", 1, 0);
+		if (size == std::string::npos)
+			size = size_ - pos_;
+
+		if (size)
+		{
+			char *ptr = &buf_[0] + pos_;
+			char *end = ptr + size;
+
+			/* Вне элементов допустимы только пробелы, внутри пробельный
+				текст - такой же текст, как в read_xml */
+			if (name_offsets_.empty())
+			{
+				const char *text_begin = skip_spaces(ptr, end);
+				if (text_begin != end)
+					throw_parse_error("expected <", text_begin);
+			}
+			else if (pos_ + size == size_)
+				throw_parse_error("unexpected end of data", end);
+			else
+			{
+				const std::size_t lines = std::count(ptr, end, '\n');
+				value_ = boost::string_ref(ptr, decode_entities(ptr, size));
+				event_line_ = line_;
+				line_ += lines;
+				pos_ += size;
+				return text;
+			}
+
+			skip(size);
+		}
+
+		event_line_ = line_;
+
+		if (pos_ == size_)
+		{
+			if (!name_offsets_.empty())
+				throw_parse_error("unexpected end of data", &buf_[0] + pos_);
+			return end_document;
+		}
+
+		/* Тег */
+		if (starts_with("<?", 2))
+		{
+			size = find("?>", 2, 2);
+			if (size == std::string::npos)
+				throw_parse_error("unexpected end of data", &buf_[0] + size_);
+			skip(size + 2);
+		}
+		else if (starts_with("<!--", 4))
+		{
+			size = find("-->", 3, 4);
+			if (size == std::string::npos)
+				throw_parse_error("unexpected end of data", &buf_[0] + size_);
+			value_ = boost::string_ref(&buf_[0] + pos_ + 4, size - 4);
+			skip(size + 3);
+			return comment;
+		}
+		else if (starts_with("<![CDATA[", 9))
+		{
+			size = find("]]>", 3, 9);
+			if (size == std::string::npos)
+				throw_parse_error("unexpected end of data", &buf_[0] + size_);
+			value_ = boost::string_ref(&buf_[0] + pos_ + 9, size - 9);
+			skip(size + 3);
+			return cdata;
+		}
+		else if (starts_with("<!DOCTYPE", 9))
+			skip(find_doctype_end() + 1);
+		else if (starts_with("<!", 2))
+		{
+			size = find(">", 1, 2);
+			if (size == std::string::npos)
+				throw_parse_error("unexpected end of data", &buf_[0] + size_);
+			skip(size + 1);
+		}
+		else if (starts_with("</", 2))
+		{
+			if (name_offsets_.empty())
+				throw_parse_error("expected element name", &buf_[0] + pos_ + 1);
+
+			size = find(">", 1, 2);
+			if (size == std::string::npos)
+				throw_parse_error("unexpected end of data", &buf_[0] + size_);
+			skip(size + 1);
+			pop_ = true;
+			return end_element;
+		}
+		else
+		{
+			size = find_tag_end();
+			parse_tag(size);
+			skip(size + 1);
+			return start_element;
+		}
+	}
+}
+
+namespace {
+
+/* Атрибуты текущего элемента reader'а - в <xmlattr> */
+template<class Ptree>
+void read_attributes(my::xml::reader &r, Ptree &pt)
+{
+	typedef typename Ptree::key_type Str;
+	typedef typename Ptree::value_type value_type;
+
+	const std::vector<my::xml::attribute> &attrs = r.attributes();
+
+	if (attrs.empty())
+		return;
+
+	Ptree &pt_attrs = pt.push_back( value_type(
+		::xml::xml_parser::xmlattr<Str>(), Ptree()) )->second;
+
+	Str name;
+
+	for (std::size_t i = 0; i < attrs.size(); i++)
+	{
+		name.clear();
+		append_text(name, attrs[i].name.data(), attrs[i].name.size(), false);
+
+		Ptree &pt_attr = pt_attrs.push_back( value_type(name, Ptree()) )->second;
+		append_text(pt_attr.data(), attrs[i].value.data(), attrs[i].value.size(), false);
+	}
+}
+
+/* Элемент из reader'а - в ptree (как read_node). Сущности reader
+	уже заменил */
+template<class Ptree>
+void read_events(my::xml::reader &r, Ptree &pt)
+{
+	typedef typename Ptree::key_type Str;
+	typedef typename Ptree::value_type value_type;
+
+	read_attributes(r, pt);
+
+	if (r.next() == my::xml::reader::end_element)
+		return;
+
+	std::vector<Ptree*> stack(1, &pt);
+
+	do
+	{
+		Ptree &parent = *stack.back();
+
+		switch (r.event())
+		{
+			case my::xml::reader::start_element:
+			{
+				Str name;
+				boost::string_ref n = r.name();
+				append_text(name, n.data(), n.size(), false);
+
+				Ptree &pt_node = parent.push_back( value_type(name, Ptree()) )->second;
+				read_attributes(r, pt_node);
+				stack.push_back(&pt_node);
+				break;
+			}
+
+			case my::xml::reader::end_element:
+				stack.pop_back();
+				if (stack.empty())
+					return;
+				break;
+
+			case my::xml::reader::text:
+			case my::xml::reader::cdata:
+				append_text(parent.data(), r.value().data(), r.value().size(), false);
+				break;
+
+			case my::xml::reader::comment:
+			{
+				Str value;
+				append_text(value, r.value().data(), r.value().size(), false);
+				parent.push_back( value_type(
+					::xml::xml_parser::xmlcomment<Str>(), Ptree(value)) );
+				break;
+			}
+
+			default:
+				return;
+		}
+
+		r.next();
+	}
+	while (true);
+}
+
+/* Ошибки перевода имён и текста в ptree (после next() - только
+	неверный UTF-8) - с номером строки события */
+template<class Ptree>
+void read_element_impl(my::xml::reader &r, Ptree &pt)
+{
+	try
+	{
+		read_events(r, pt);
+	}
+	catch (rapidxml::parse_error &e)
+	{
+		throw my::exception(L"Ошибка разбора xml-данных")
+			<< my::param(L"line", r.line())
+			<< my::param(L"error", my::str::to_wstring(e.what()));
+	}
+}
+
+/* Путь ptree ("a.b.c") - в имена UTF-8 */
+void split_path(const std::string &path, std::vector<std::string> &names)
+{
+	std::size_t begin = 0;
+
+	while (true)
+	{
+		std::size_t end = path.find('.', begin);
+		names.push_back( path.substr(begin, end - begin) );
+
+		if (end == std::string::npos)
+			break;
+		begin = end + 1;
+	}
+}
+
+template<class Ptree, class Handler>
+std::size_t select_elements(my::xml::reader &r, const std::vector<std::string> &names,
+	const Handler &handler)
+{
+	std::size_t matched = 0; /* Открытые элементы, совпавшие с началом пути */
+	std::size_t count = 0;
+
+	while (true)
+	{
+		switch (r.next())
+		{
+			case my::xml::reader::start_element:
+			{
+				if (r.depth() != matched + 1)
+					break;
+
+				const std::string &name = names[matched];
+				if (name != "*" && r.name() != boost::string_ref(name))
+					break;
+
+				if (++matched < names.size())
+					break;
+
+				/* После чтения текущее событие - end_element
+					этого же элемента */
+				Ptree pt;
+				read_element_impl(r, pt);
+				handler(pt);
+				count++;
+				--matched;
+				break;
+			}
+
+			case my::xml::reader::end_element:
+				if (r.depth() == matched)
+					--matched;
+				break;
+
+			case my::xml::reader::end_document:
+				return count;
+
+			default:
+				break;
+		}
+	}
+}
+
+}
+
+void my::xml::read_element(reader &r, ::xml::ptree &pt)
+{
+	read_element_impl(r, pt);
+}
+
+void my::xml::read_element(reader &r, ::xml::wptree &pt)
+{
+	read_element_impl(r, pt);
+}
+
+std::size_t my::xml::select(reader &r, const std::string &path,
+	const ptree_handler &handler)
+{
+	std::vector<std::string> names;
+	split_path(path, names);
+
+	return select_elements< ::xml::ptree >(r, names, handler);
+}
+
+std::size_t my::xml::select(reader &r, const std::wstring &path,
+	const wptree_handler &handler)
+{
+	std::vector<std::string> names;
+	split_path(my::utf8::encode(path), names);
+
+	return select_elements< ::xml::wptree >(r, names, handler);
+}
+
+namespace {
+
+/* UTF-16LE (без BOM) -> UTF-8 */
+void utf16le_to_utf8(const char *ptr, std::size_t size, std::string &out)
+{
+	const unsigned char *p = reinterpret_cast<const unsigned char*>(ptr);
+	const unsigned char *end = p + (size & ~std::size_t(1));
+
+	out.clear();
+	out.reserve(size + size / 2);
+
+	while (p != end)
+	{
+		unsigned long code = p[0] | (p[1] << 8);
+		p += 2;
+
+		/* Суррогатная пара (непарный суррогат - как есть) */
+		if (code >= 0xD800 && code < 0xDC00 && p != end)
+		{
+			unsigned long low = p[0] | (p[1] << 8);
+			if (low >= 0xDC00 && low < 0xE000)
+			{
+				code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				p += 2;
+			}
+		}
+
+		append_code(out, code);
+	}
+}
+
+/* Однобайтовая (ansi) кодировка системы -> UTF-8 - одним вызовом
+	codecvt на весь текст. Текст только из ascii - без преобразования.
+	filename - только для сообщения об ошибке */
+void ansi_to_utf8(std::string &text, const std::wstring &filename)
+{
+	std::size_t i = 0;
+	while (i < text.size() && static_cast<unsigned char>(text[i]) < 0x80)
+		++i;
+
+	if (i == text.size())
+		return;
+
+	typedef std::codecvt<wchar_t, char, std::mbstate_t> codecvt_type;
+	const std::locale loc("");
+	const codecvt_type &cvt = std::use_facet<codecvt_type>(loc);
+
+	std::wstring wtext(text.size(), L' ');
+	std::mbstate_t st = std::mbstate_t();
+	const char *from_next;
+	wchar_t *to_next;
+
+	if (cvt.in(st, text.c_str(), text.c_str() + text.size(), from_next,
+			&wtext[0], &wtext[0] + wtext.size(), to_next) != codecvt_type::ok
+		|| from_next != text.c_str() + text.size())
+		throw my::exception(L"Не удалось перевести файл из ansi в UTF-8")
+			<< my::param(L"file", filename)
+			<< my::param(L"position", from_next - text.c_str());
+
+	wtext.resize(to_next - wtext.c_str());
+
+	text = my::utf8::encode(wtext);
+}
+
+/* Конец строки "\r\n" -> "\n" (как при чтении в текстовом режиме;
+	того же требует и стандарт xml) */
+void normalize_newlines(std::string &text)
+{
+	char *begin = &text[0];
+	char *end = begin + text.size();
+	char *cr = static_cast<char*>(std::memchr(begin, '\r', end - begin));
+
+	if (!cr)
+		return;
+
+	char *out = cr;
+	for (char *ptr = cr; ptr != end; ++ptr)
+		if (*ptr != '\r' || ptr + 1 == end || ptr[1] != '\n')
+			*out++ = *ptr;
+
+	text.resize(out - begin);
+}
+
+template<class Tree>
+void load_file(const std::wstring &filename, Tree &pt)
+{
+	/* Файл - целиком, одним чтением */
+	std::string text;
+	{
+		fs::ifstream fs(filename, ios_base::in | ios_base::binary);
+
+		if (!fs)
+			throw my::exception(L"Не удалось открыть файл")
+				<< my::param(L"file", filename);
+
+		fs.seekg(0, ios_base::end);
+		text.resize( static_cast<std::size_t>(fs.tellg()) );
+		fs.seekg(0, ios_base::beg);
+
+		if (!text.empty() && !fs.read(&text[0], text.size()))
+			throw my::exception(L"Не удалось прочитать файл")
+				<< my::param(L"file", filename);
+	}
+
+	std::size_t start = 0;
+
+	/* utf8 */
+	if (text.compare(0, 3, "\xEF\xBB\xBF") == 0)
+		start = 3;
+	/* unicode - в utf8 */
+	else if (text.compare(0, 2, "\xFF\xFE") == 0)
+	{
+		std::string utf8_text;
+		utf16le_to_utf8(text.c_str() + 2, text.size() - 2, utf8_text);
+		text.swap(utf8_text);
+	}
+	/* ansi - в utf8 */
+	else
+		ansi_to_utf8(text, filename);
+
+	normalize_newlines(text);
+
+	try
+	{
+		my::xml::parse_utf8(text.c_str() + start, text.size() - start, pt);
+	}
+	catch(my::exception &e)
 	{
 		e.message(L"Ошибка разбора xml-файла");
 		throw e << my::param(L"file", filename);
 	}
 }
+
+}
+
+void my::xml::load(const std::wstring &filename, ::xml::wptree &pt)
+{
+	load_file(filename, pt);
+}
+
+void my::xml::load(const std::wstring &filename, frozen_tree &tree)
+{
+	load_file(filename, tree);
+}
+
+/*
+	Запись xml
+*/
+
+namespace {
+
+/* Первый символ из <>&"' или end. '<' (3C) и '>' (3E) отличаются
+	одним битом, '&' (26) и '\'' (27) - тоже, поэтому в векторном
+	поиске сравнений три, а не пять */
+inline const char* find_escaped(const char *ptr, const char *end)
+{
+#if MY_NUM_SIMD == 32
+	const __m256i bit1 = _mm256_set1_epi8(2);
+	const __m256i bit0 = _mm256_set1_epi8(1);
+	const __m256i gt = _mm256_set1_epi8('>');
+	const __m256i apos = _mm256_set1_epi8('\'');
+	const __m256i quot = _mm256_set1_epi8('"');
+
+	for (; end - ptr >= 32; ptr += 32)
+	{
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+		__m256i found = _mm256_or_si256(
+			_mm256_cmpeq_epi8(_mm256_or_si256(x, bit1), gt),
+			_mm256_or_si256(
+				_mm256_cmpeq_epi8(_mm256_or_si256(x, bit0), apos),
+				_mm256_cmpeq_epi8(x, quot)));
+		unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(found));
+		if (mask)
+			return ptr + my::num::lowest_bit(mask);
+	}
+#elif MY_NUM_SIMD == 16
+	const __m128i bit1 = _mm_set1_epi8(2);
+	const __m128i bit0 = _mm_set1_epi8(1);
+	const __m128i gt = _mm_set1_epi8('>');
+	const __m128i apos = _mm_set1_epi8('\'');
+	const __m128i quot = _mm_set1_epi8('"');
+
+	for (; end - ptr >= 16; ptr += 16)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+		__m128i found = _mm_or_si128(
+			_mm_cmpeq_epi8(_mm_or_si128(x, bit1), gt),
+			_mm_or_si128(
+				_mm_cmpeq_epi8(_mm_or_si128(x, bit0), apos),
+				_mm_cmpeq_epi8(x, quot)));
+		unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(found));
+		if (mask)
+			return ptr + my::num::lowest_bit(mask);
+	}
+#endif
+
+	while (ptr != end && !escape_table[static_cast<unsigned char>(*ptr)])
+		++ptr;
+
+	return ptr;
+}
+
+/* Буфер записи: строка заранее растёт (вдвое), запись - прямо
+	по указателю, без проверок на каждый символ. Лишнее отрезается
+	в деструкторе */
+class out_buffer : boost::noncopyable
+{
+public:
+	explicit out_buffer(std::string &str)
+		: str_(str), size_(str.size()) {}
+
+	~out_buffer()
+		{ str_.resize(size_); }
+
+	/* Место под n байт. Запись - до commit */
+	char* reserve(std::size_t n)
+	{
+		if (str_.size() - size_ < n)
+			str_.resize( std::max(str_.size() * 2, size_ + n + 4096) );
+		return &str_[0] + size_;
+	}
+
+	void commit(const char *ptr)
+		{ size_ = ptr - str_.data(); }
+
+	void append(const char *data, std::size_t n)
+	{
+		std::memcpy(reserve(n), data, n);
+		size_ += n;
+	}
+
+	void append(const std::string &str)
+		{ append(str.data(), str.size()); }
+
+	template<std::size_t N>
+	void append(const char (&str)[N])
+		{ append(str, N - 1); }
+
+	void push_back(char ch)
+	{
+		*reserve(1) = ch;
+		size_++;
+	}
+
+private:
+	std::string &str_;
+	std::size_t size_;
+};
+
+/* Текст из одних пробелов (как в encode_char_entities из boost:
+	иначе при разборе он пропадёт) */
+template<class Ch>
+bool only_spaces(const Ch *ptr, std::size_t size)
+{
+	if (size == 0)
+		return false;
+
+	for (const Ch *end = ptr + size; ptr != end; ++ptr)
+		if (*ptr != Ch(' '))
+			return false;
+
+	return true;
+}
+
+/* Экранирование <>&"' - в std::string или out_buffer */
+template<class Out>
+void append_escaped(Out &out, const char *ptr, std::size_t size)
+{
+	const char *end = ptr + size;
+
+	while (true)
+	{
+		const char *run = ptr;
+		ptr = find_escaped(ptr, end);
+		out.append(run, ptr - run);
+
+		if (ptr == end)
+			return;
+
+		const unsigned char e = escape_table[static_cast<unsigned char>(*ptr++)];
+		out.append(escape_entities[e], escape_sizes[e]);
+	}
+}
+
+/* Текст (UTF-8) - в xml */
+template<class Out>
+void append_xml_text(Out &out, const char *ptr, std::size_t size)
+{
+	if (only_spaces(ptr, size))
+	{
+		out.append("&#32;", 5);
+		for (std::size_t i = 1; i < size; i++)
+			out.push_back(' ');
+	}
+	else
+		append_escaped(out, ptr, size);
+}
+
+/* wchar_t - в UTF-8, с экранированием (escape) или без */
+void append_utf8(out_buffer &out, const wchar_t *ptr, std::size_t size,
+	bool escape)
+{
+	if (escape && only_spaces(ptr, size))
+	{
+		out.append("&#32;", 5);
+		for (std::size_t i = 1; i < size; i++)
+			out.push_back(' ');
+		return;
+	}
+
+	/* На символ - не больше 6 байт ("&quot;") */
+	char *dest = out.reserve(size * 6);
+	const wchar_t *end = ptr + size;
+
+	while (ptr != end)
+	{
+		unsigned long code = static_cast<unsigned long>(*ptr++);
+
+		if (code < 0x80)
+		{
+			const unsigned char e = (escape ? escape_table[code] : 0);
+
+			if (e)
+			{
+				std::memcpy(dest, escape_entities[e], escape_sizes[e]);
+				dest += escape_sizes[e];
+			}
+			else
+				*dest++ = static_cast<char>(code);
+
+			continue;
+		}
+
+		/* 16-битный wchar_t (Windows) - суррогатная пара */
+		if (sizeof(wchar_t) == 2 && code >= 0xD800 && code < 0xDC00 && ptr != end
+			&& static_cast<unsigned long>(*ptr) >= 0xDC00
+			&& static_cast<unsigned long>(*ptr) < 0xE000)
+			code = 0x10000 + ((code - 0xD800) << 10)
+				+ (static_cast<unsigned long>(*ptr++) - 0xDC00);
+		else if (code > 0x10FFFF)
+			code = 0xFFFD;
+
+		dest = put_code(dest, code);
+	}
+
+	out.commit(dest);
+}
+
+/* Строки ptree, wptree и frozen_tree - в xml */
+inline void put_name(out_buffer &out, const std::string &str)
+{
+	out.append(str);
+}
+
+inline void put_text(out_buffer &out, const std::string &str)
+{
+	append_xml_text(out, str.data(), str.size());
+}
+
+inline void put_raw(out_buffer &out, const std::string &str)
+{
+	out.append(str);
+}
+
+template<class Str>
+void put_name(out_buffer &out, const Str &str)
+{
+	append_utf8(out, str.data(), str.size(), false);
+}
+
+template<class Str>
+void put_text(out_buffer &out, const Str &str)
+{
+	append_utf8(out, str.data(), str.size(), true);
+}
+
+template<class Str>
+void put_raw(out_buffer &out, const Str &str)
+{
+	append_utf8(out, str.data(), str.size(), false);
+}
+
+/* Сравнение ключа со служебным именем (<xmlattr> и т.п.) */
+template<class Str, std::size_t N>
+bool is_key(const Str &key, const char (&name)[N])
+{
+	if (key.size() != N - 1)
+		return false;
+
+	for (std::size_t i = 0; i < N - 1; i++)
+		if (key[i] != static_cast<typename Str::value_type>(name[i]))
+			return false;
+
+	return true;
+}
+
+/* Элемент - как write_xml_element из boost (без отступов). Корень
+	(key == 0) - только содержимое */
+template<class Ptree, class Key>
+void write_element(out_buffer &out, const Key *key, const Ptree &pt)
+{
+	typedef typename Ptree::const_iterator iterator;
+
+	/* Атрибуты (первый <xmlattr>, как у get_child_optional) и есть ли
+		что-то, кроме атрибутов. После разбора <xmlattr> - всегда первый,
+		так что второго прохода по детям обычно нет: узлы ptree
+		разбросаны по памяти, и каждый проход - это промахи кэша */
+	const Ptree *attrs = 0;
+	bool has_attrs_only = false;
+	iterator it = pt.begin();
+
+	if (it != pt.end() && is_key(it->first, "<xmlattr>"))
+	{
+		attrs = &it->second;
+		has_attrs_only = pt.data().empty();
+
+		while (has_attrs_only && ++it != pt.end())
+			has_attrs_only = is_key(it->first, "<xmlattr>");
+	}
+	else
+	{
+		for (; it != pt.end(); ++it)
+			if (is_key(it->first, "<xmlattr>"))
+			{
+				attrs = &it->second;
+				break;
+			}
+	}
+
+	if (pt.data().empty() && pt.empty())
+	{
+		if (key)
+		{
+			out.push_back('<');
+			put_name(out, *key);
+			out.append("/>");
+		}
+		return;
+	}
+
+	if (key)
+	{
+		out.push_back('<');
+		put_name(out, *key);
+
+		if (attrs)
+			for (iterator attr = attrs->begin(); attr != attrs->end(); ++attr)
+			{
+				out.push_back(' ');
+				put_name(out, attr->first);
+				out.append("=\"");
+				put_text(out, attr->second.data());
+				out.push_back('"');
+			}
+
+		if (has_attrs_only)
+			out.append("/>");
+		else
+			out.push_back('>');
+	}
+
+	if (!pt.data().empty())
+		put_text(out, pt.data());
+
+	for (it = pt.begin(); it != pt.end(); ++it)
+	{
+		if (is_key(it->first, "<xmlattr>"))
+			continue;
+		else if (is_key(it->first, "<xmlcomment>"))
+		{
+			out.append("<!--");
+			put_raw(out, it->second.data());
+			out.append("-->");
+		}
+		else if (is_key(it->first, "<xmltext>"))
+			put_text(out, it->second.data());
+		else
+			write_element(out, &it->first, it->second);
+	}
+
+	if (key && !has_attrs_only)
+	{
+		out.append("</");
+		put_name(out, *key);
+		out.push_back('>');
+	}
+}
+
+template<class Ptree>
+void write_document(std::string &str, const Ptree &pt)
+{
+	out_buffer out(str);
+	out.append("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+	write_element(out, static_cast<const typename Ptree::value_type::first_type*>(0), pt);
+}
+
+}
+
+void my::xml::append_escaped(std::string &out, const char *data, std::size_t size)
+{
+	::append_escaped(out, data, size);
+}
+
+void my::xml::write(std::string &out, const ::xml::ptree &pt)
+{
+	write_document(out, pt);
+}
+
+void my::xml::write(std::string &out, const ::xml::wptree &pt)
+{
+	write_document(out, pt);
+}
+
+void my::xml::write(std::string &out, const frozen_node &pt)
+{
+	write_document(out, pt);
+}
+
+my::xml::writer::writer(std::string &out, bool declaration)
+	: out_(out)
+	, open_(false)
+{
+	if (declaration)
+		out_ += "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n";
+}
+
+void my::xml::writer::close_tag()
+{
+	if (open_)
+	{
+		out_ += '>';
+		open_ = false;
+	}
+}
+
+void my::xml::writer::start_element(const boost::string_ref &name)
+{
+	close_tag();
+
+	out_ += '<';
+	out_.append(name.data(), name.size());
+	open_ = true;
+
+	name_offsets_.push_back(names_.size());
+	names_.append(name.data(), name.size());
+}
+
+void my::xml::writer::attribute(const boost::string_ref &name, const boost::string_ref &value)
+{
+	out_ += ' ';
+	out_.append(name.data(), name.size());
+	out_ += "=\"";
+	append_xml_text(out_, value.data(), value.size());
+	out_ += '"';
+}
+
+void my::xml::writer::end_element()
+{
+	const std::size_t offset = name_offsets_.back();
+
+	if (open_)
+	{
+		out_ += "/>";
+		open_ = false;
+	}
+	else
+	{
+		out_ += "</";
+		out_.append(names_, offset, std::string::npos);
+		out_ += '>';
+	}
+
+	names_.erase(offset);
+	name_offsets_.pop_back();
+}
+
+void my::xml::writer::text(const boost::string_ref &value)
+{
+	close_tag();
+	append_xml_text(out_, value.data(), value.size());
+}
+
+void my::xml::writer::cdata(const boost::string_ref &value)
+{
+	close_tag();
+	out_ += "<![CDATA[";
+	out_.append(value.data(), value.size());
+	out_ += "]]>";
+}
+
+void my::xml::writer::comment(const boost::string_ref &value)
+{
+	close_tag();
+	out_ += "<!--";
+	out_.append(value.data(), value.size());
+	out_ += "-->";
+}
+
+void my::xml::writer::write(const reader &r)
+{
+	switch (r.event())
+	{
+		case reader::start_element:
+		{
+			start_element(r.name());
+
+			const std::vector<my::xml::attribute> &attrs = r.attributes();
+			for (std::size_t i = 0; i < attrs.size(); i++)
+				attribute(attrs[i].name, attrs[i].value);
+
+			break;
+		}
+
+		case reader::end_element:
+			end_element();
+			break;
+
+		case reader::text:
+			text(r.value());
+			break;
+
+		case reader::cdata:
+			cdata(r.value());
+			break;
+
+		case reader::comment:
+			comment(r.value());
+			break;
+
+		default:
+			break;
+	}
+}
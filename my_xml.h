@@ -3,7 +3,17 @@
 
 #include "my_exception.h"
 
+#include <cstddef> /* std::size_t */
+#include <istream>
 #include <string>
+#include <typeinfo>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/optional.hpp>
+#include <boost/utility.hpp> /* boost::noncopyable */
+#include <boost/utility/string_ref.hpp>
+#include <boost/iterator/permutation_iterator.hpp>
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/ptree_fwd.hpp>
@@ -15,9 +25,14 @@ namespace xml=boost::property_tree;
 
 namespace my { namespace xml {
 
+class frozen_tree;
+
 /* Загрузка xml-файла. Автоматическое
-	преобразование ansi/utf8/unicode */
+	преобразование ansi/utf8/unicode. Для конфигов, которые только
+	читаются, быстрее load(filename, frozen_tree&): дерево строится
+	сразу из буфера, без промежуточного wptree */
 void load(const std::wstring &filename, ::xml::wptree &pt);
+void load(const std::wstring &filename, frozen_tree &tree);
 
 /* Загрузка xml из потока с отловом и преобразованием исключений */
 template<class Stream, class Ptree>
@@ -35,10 +50,378 @@ void parse(Stream &os, Ptree &pt)
 	}
 }
 
+/* Разбор xml прямо из буфера в UTF-8 - без потоков и промежуточных
+	строк, с декодированием UTF-8 на лету. Буфер не изменяется, но
+	должен заканчиваться нулём (data[size] == 0, как у c_str()).
+	Результат - как у parse (read_xml без флагов), в том числе
+	пробельный текст (<a> </a> - " ") сохраняется. Отличие одно:
+	числовые ссылки на не-ASCII символы (&#1087;, &#x1F600;) в wptree
+	дают сам символ, а read_xml - его байты UTF-8, по байту на wchar_t */
+void parse_utf8(const char *data, std::size_t size, ::xml::ptree &pt);
+void parse_utf8(const char *data, std::size_t size, ::xml::wptree &pt);
+
+inline void parse_utf8(const std::string &str, ::xml::ptree &pt)
+{
+	parse_utf8(str.c_str(), str.size(), pt);
+}
+
+inline void parse_utf8(const std::string &str, ::xml::wptree &pt)
+{
+	parse_utf8(str.c_str(), str.size(), pt);
+}
+
+struct frozen_value;
+class frozen_builder;
+
+/*
+	Узел неизменяемого дерева (frozen_tree) - замена const wptree&
+	для конфигураций, которые строятся один раз и дальше только
+	читаются.
+
+	Дети узла лежат подряд в одном общем массиве, ключи и значения -
+	в одной общей строке, поиск по имени - двоичный, по отсортированной
+	при построении таблице индексов. Ни одного выделения памяти на
+	узел, ни списков, ни деревьев поиска, как в multi_index у ptree.
+
+	Интерфейс - как у const wptree: итерация по детям (first, second),
+	data(), get_child, get_child_optional, get, get_optional, get_value,
+	count, find, equal_range. Ключи и данные - boost::wstring_ref
+	(ссылки в память frozen_tree)
+*/
+class frozen_node
+{
+public:
+	typedef std::wstring key_type;
+	typedef boost::wstring_ref data_type;
+	typedef ::xml::wptree::path_type path_type;
+	typedef frozen_value value_type;
+	typedef const frozen_value* const_iterator;
+	typedef const_iterator iterator;
+	/* По возрастанию ключа (равные - в порядке документа) */
+	typedef boost::permutation_iterator<const_iterator, const unsigned*>
+		const_assoc_iterator;
+
+	frozen_node()
+		: children_(0), sorted_(0), data_(0), size_(0), data_size_(0) {}
+
+	const_iterator begin() const
+		{ return children_; }
+
+	const_iterator end() const;
+
+	std::size_t size() const
+		{ return size_; }
+
+	bool empty() const
+		{ return size_ == 0; }
+
+	data_type data() const
+		{ return data_type(data_, data_size_); }
+
+	/* Первый ребёнок с ключом key (как find у ptree) или end() */
+	const_iterator find(const boost::wstring_ref &key) const;
+
+	std::pair<const_assoc_iterator, const_assoc_iterator>
+		equal_range(const boost::wstring_ref &key) const;
+
+	std::size_t count(const boost::wstring_ref &key) const;
+
+	/* Ошибка - ptree_bad_path, как у ptree */
+	const frozen_node& get_child(const path_type &path) const;
+	boost::optional<const frozen_node&>
+		get_child_optional(const path_type &path) const;
+
+	/* Перевод значения - через тот же translator_between, что и у
+		wptree. Ошибка - ptree_bad_data */
+	template<class T>
+	boost::optional<T> get_value_optional() const
+	{
+		return typename ::xml::translator_between<std::wstring, T>::type()
+			.get_value( std::wstring(data_, data_size_) );
+	}
+
+	template<class T>
+	T get_value() const
+	{
+		boost::optional<T> value = get_value_optional<T>();
+
+		if (!value)
+			BOOST_PROPERTY_TREE_THROW( ::xml::ptree_bad_data(
+				std::string("conversion of data to type \"")
+				+ typeid(T).name() + "\" failed",
+				std::wstring(data_, data_size_)) );
+
+		return *value;
+	}
+
+	template<class T>
+	T get_value(const T &default_value) const
+		{ return get_value_optional<T>().get_value_or(default_value); }
+
+	std::wstring get_value(const wchar_t *default_value) const
+		{ return get_value<std::wstring>(default_value); }
+
+	template<class T>
+	boost::optional<T> get_optional(const path_type &path) const
+	{
+		boost::optional<const frozen_node&> child = get_child_optional(path);
+		return child ? child->get_value_optional<T>() : boost::optional<T>();
+	}
+
+	template<class T>
+	T get(const path_type &path) const
+		{ return get_child(path).get_value<T>(); }
+
+	template<class T>
+	T get(const path_type &path, const T &default_value) const
+		{ return get_optional<T>(path).get_value_or(default_value); }
+
+	std::wstring get(const path_type &path, const wchar_t *default_value) const
+		{ return get<std::wstring>(path, default_value); }
+
+private:
+	friend class frozen_builder;
+
+	const frozen_value *children_;
+	const unsigned *sorted_; /* Индексы детей, отсортированные по ключу */
+	const wchar_t *data_;
+	unsigned size_;
+	unsigned data_size_;
+
+	const frozen_node* walk_path(path_type &path) const;
+};
+
+/* Ребёнок узла - как value_type у ptree */
+struct frozen_value
+{
+	typedef boost::wstring_ref first_type;
+	typedef frozen_node second_type;
+
+	boost::wstring_ref first;
+	frozen_node second;
+};
+
+inline frozen_node::const_iterator frozen_node::end() const
+{
+	return children_ + size_;
+}
+
+/*
+	Неизменяемое дерево: корневой узел вместе с памятью всех узлов.
+	Строится из wptree, сразу из xml (parse_utf8, load) - без
+	промежуточного wptree
+
+		my::xml::frozen_tree config;
+		my::xml::load(L"config.xml", config);
+		int port = config.get<int>(L"config.server.port", 80);
+*/
+class frozen_tree : public frozen_node, boost::noncopyable
+{
+public:
+	frozen_tree() {}
+	explicit frozen_tree(const ::xml::wptree &pt);
+
+	void swap(frozen_tree &other);
+
+	/* Память: узлы, строки, таблица поиска */
+	std::size_t memory_size() const;
+
+private:
+	friend class frozen_builder;
+
+	std::vector<frozen_value> nodes_;
+	std::vector<wchar_t> chars_;
+	std::vector<unsigned> index_;
+};
+
+void parse_utf8(const char *data, std::size_t size, frozen_tree &tree);
+
+inline void parse_utf8(const std::string &str, frozen_tree &tree)
+{
+	parse_utf8(str.c_str(), str.size(), tree);
+}
+
+/* Текст reader'а (UTF-8) - в wstring, с проверкой UTF-8 */
+std::wstring to_wstring(const boost::string_ref &text);
+
+/* Атрибут элемента */
+struct attribute
+{
+	boost::string_ref name;
+	boost::string_ref value; /* Сущности уже заменены */
+};
+
+/*
+	Потоковый (pull) разбор xml в UTF-8 - без построения дерева.
+
+	Документ читается из потока кусками в буфер, next() возвращает
+	очередное событие: начало элемента (с атрибутами), конец элемента,
+	текст, CDATA, комментарий. Имена, атрибуты и текст - ссылки в буфер
+	(сущности заменяются на месте), действительны до следующего next().
+	Буфер растёт только до размера самого большого тега или текста,
+	поэтому память не зависит от размера документа.
+
+	Разбирается то же, что и в parse_utf8: пробелы вне корневого
+	элемента, <?...?>, DOCTYPE и прочие <!...> пропускаются, пробельный
+	текст внутри элементов - обычный текст (как в read_xml). Закрывающий
+	тег, как и в rapidxml, не сверяется с открывающим. <a/> - это начало
+	и сразу конец элемента. Ошибки - исключения my::exception
+	(line, error), как у parse
+
+		my::xml::reader r(fs);
+		while (r.next() != my::xml::reader::end_document)
+			if (r.event() == my::xml::reader::start_element
+				&& r.name() == "item")
+				...
+*/
+class reader : boost::noncopyable
+{
+public:
+	enum event_type
+	{
+		start_element, /* name(), attributes() */
+		end_element,   /* name() */
+		text,          /* value() */
+		cdata,         /* value() */
+		comment,       /* value() */
+		end_document
+	};
+
+	explicit reader(std::istream &in, std::size_t buffer_size = 65536);
+
+	/* Следующее событие */
+	event_type next();
+
+	event_type event() const
+		{ return event_; }
+
+	/* Имя элемента (start_element, end_element) */
+	boost::string_ref name() const;
+
+	/* Текст, CDATA, комментарий */
+	boost::string_ref value() const
+		{ return value_; }
+
+	/* Атрибуты (start_element) */
+	const std::vector<attribute>& attributes() const
+		{ return attributes_; }
+
+	/* Кол-во открытых элементов: для start_element и end_element
+		учитывается и сам элемент (у корневого - 1) */
+	std::size_t depth() const
+		{ return name_offsets_.size(); }
+
+	/* Строка, на которой начинается текущее событие */
+	std::size_t line() const
+		{ return event_line_; }
+
+private:
+	std::istream &in_;
+	std::vector<char> buf_;
+	std::size_t pos_;  /* Начало неразобранных данных */
+	std::size_t size_; /* Конец прочитанных данных */
+	bool eof_;
+	bool started_;
+	bool self_closing_; /* <a/>: следующее событие - end_element */
+	bool pop_;          /* После end_element - снять имя со стека */
+	std::size_t line_;
+	std::size_t event_line_;
+	event_type event_;
+	boost::string_ref value_;
+	std::vector<attribute> attributes_;
+	std::string names_; /* Стек имён открытых элементов */
+	std::vector<std::size_t> name_offsets_;
+
+	event_type next_();
+	bool fill();
+	bool ensure(std::size_t size);
+	bool starts_with(const char *str, std::size_t size);
+	std::size_t find(const char *str, std::size_t size, std::size_t from);
+	std::size_t find_tag_end();
+	std::size_t find_doctype_end();
+	void parse_tag(std::size_t tag_end);
+	void skip(std::size_t size);
+};
+
+/* Чтение в ptree элемента, на начале которого (start_element) стоит
+	reader - целиком, до его end_element. Результат - как у поддерева
+	из parse_utf8: атрибуты в <xmlattr>, текст в data(), комментарии
+	в <xmlcomment> */
+void read_element(reader &r, ::xml::ptree &pt);
+void read_element(reader &r, ::xml::wptree &pt);
+
+/*
+	Выборка из потока элементов по пути (как у ptree: "items.item",
+	"*" - любое имя). Каждый подходящий элемент читается в ptree
+	(read_element) и передаётся в handler, остальное пропускается -
+	в памяти только одно поддерево. Возврат: кол-во элементов
+
+		my::xml::reader r(fs);
+		my::xml::select(r, L"items.item", on_item);
+*/
+typedef boost::function<void (::xml::ptree &pt)> ptree_handler;
+typedef boost::function<void (::xml::wptree &pt)> wptree_handler;
+
+std::size_t select(reader &r, const std::string &path,
+	const ptree_handler &handler);
+std::size_t select(reader &r, const std::wstring &path,
+	const wptree_handler &handler);
+
+/*
+	Запись дерева в xml (UTF-8) - в конец out. Результат тот же, что
+	у write_xml без настроек (<?xml ...?>, без отступов), но без потоков:
+	ключи и данные wptree переводятся в UTF-8 сразу в буфер, символы
+	<>&"' ищутся векторно (SSE2/AVX2, если включены при компиляции)
+	и заменяются по таблице
+*/
+void write(std::string &out, const ::xml::ptree &pt);
+void write(std::string &out, const ::xml::wptree &pt);
+void write(std::string &out, const frozen_node &pt);
+
+/* Экранирование <>&"' (текст или значение атрибута) - в конец out */
+void append_escaped(std::string &out, const char *data, std::size_t size);
+
+/*
+	Запись xml по событиям - например, из reader'а:
+
+		my::xml::writer w(out);
+		while (r.next() != my::xml::reader::end_document)
+			w.write(r);
+
+	Элемент без содержимого записывается как <a/>
+*/
+class writer : boost::noncopyable
+{
+public:
+	/* declaration - начать с <?xml version="1.0" encoding="utf-8"?> */
+	explicit writer(std::string &out, bool declaration = true);
+
+	void start_element(const boost::string_ref &name);
+	/* Только сразу после start_element */
+	void attribute(const boost::string_ref &name, const boost::string_ref &value);
+	void end_element();
+	void text(const boost::string_ref &value);
+	void cdata(const boost::string_ref &value);
+	void comment(const boost::string_ref &value);
+
+	/* Текущее событие reader'а */
+	void write(const reader &r);
+
+private:
+	std::string &out_;
+	bool open_; /* Открывающий тег ещё не закрыт '>' */
+	std::string names_;
+	std::vector<std::size_t> name_offsets_;
+
+	void close_tag();
+};
+
 } }
 
 /* Преобразование xmlattr в строку (depricated) */
 std::wstring xmlattr_to_str(const xml::wptree::value_type &v);
 std::wstring xmlattr_to_str(const xml::wptree &pt);
+std::wstring xmlattr_to_str(const my::xml::frozen_value &v);
+std::wstring xmlattr_to_str(const my::xml::frozen_node &pt);
 
 #endif
@@ -0,0 +1,230 @@
+﻿#include "my_xml.h"
+#include "my_utf8.h"
+#include "my_num.h"
+#include "my_bench.h"
+#include "my_fs.h"
+
+#include <cstddef> /* std::size_t */
+#include <sstream>
+#include <string>
+using namespace std;
+
+/* Документ из count записей: атрибуты, текст, сущности, кириллица */
+static string make_document(size_t count)
+{
+	string doc = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<items>\n";
+
+	for (size_t i = 0; i < count; i++)
+	{
+		string n = my::num::to_string((int)i);
+
+		doc += "\t<item id=\"" + n + "\" type=\"&quot;t" + n + "&quot;\">\n"
+			"\t\t<name>\xD0\xB8\xD0\xBC\xD1\x8F " + n + "</name>\n"
+			"\t\t<value>" + n + " &lt; " + n + "0 &amp;&amp; ok</value>\n"
+			"\t</item>\n";
+	}
+
+	doc += "</items>\n";
+	return doc;
+}
+
+int main(int argc, char *argv[])
+{
+	my::bench::runner bench(argc, argv);
+
+	/* ~1 Мб */
+	const string doc = make_document(10000);
+
+	/*
+		Разбор в ptree: через поток (как раньше в message::to_xml)
+		и прямо из буфера
+	*/
+
+	for (my::bench::timer t(bench, "xml", "parse(wistringstream) 1M"); t.next(); )
+	{
+		::xml::wptree pt;
+		wistringstream ss( my::utf8::decode(doc) );
+		my::xml::parse(ss, pt);
+		my::bench::do_not_optimize(pt);
+	}
+
+	for (my::bench::timer t(bench, "xml", "parse_utf8(wptree) 1M"); t.next(); )
+	{
+		::xml::wptree pt;
+		my::xml::parse_utf8(doc, pt);
+		my::bench::do_not_optimize(pt);
+	}
+
+	for (my::bench::timer t(bench, "xml", "parse(istringstream) 1M"); t.next(); )
+	{
+		::xml::ptree pt;
+		istringstream ss(doc);
+		my::xml::parse(ss, pt);
+		my::bench::do_not_optimize(pt);
+	}
+
+	for (my::bench::timer t(bench, "xml", "parse_utf8(ptree) 1M"); t.next(); )
+	{
+		::xml::ptree pt;
+		my::xml::parse_utf8(doc, pt);
+		my::bench::do_not_optimize(pt);
+	}
+
+	/*
+		Потоковый разбор: только события и выборка записей по пути
+		(в памяти - одна запись)
+	*/
+
+	for (my::bench::timer t(bench, "xml", "reader 1M"); t.next(); )
+	{
+		istringstream ss(doc);
+		my::xml::reader r(ss);
+		size_t count = 0;
+
+		while (r.next() != my::xml::reader::end_document)
+			count++;
+
+		my::bench::do_not_optimize(count);
+	}
+
+	for (my::bench::timer t(bench, "xml", "select(wptree) 1M"); t.next(); )
+	{
+		istringstream ss(doc);
+		my::xml::reader r(ss);
+		my::bench::do_not_optimize( my::xml::select(r, L"items.item",
+			my::bench::do_not_optimize< ::xml::wptree >) );
+	}
+
+	/*
+		Неизменяемое дерево: построение и поиск по пути
+	*/
+
+	for (my::bench::timer t(bench, "xml", "parse_utf8(frozen_tree) 1M"); t.next(); )
+	{
+		my::xml::frozen_tree tree;
+		my::xml::parse_utf8(doc, tree);
+		my::bench::do_not_optimize(tree);
+	}
+
+	::xml::wptree doc_pt;
+	my::xml::parse_utf8(doc, doc_pt);
+
+	for (my::bench::timer t(bench, "xml", "frozen_tree(wptree) 1M"); t.next(); )
+	{
+		my::xml::frozen_tree tree(doc_pt);
+		my::bench::do_not_optimize(tree);
+	}
+
+	my::xml::frozen_tree doc_tree(doc_pt);
+	const ::xml::wptree &items_pt = doc_pt.get_child(L"items");
+	const my::xml::frozen_node &items_tree = doc_tree.get_child(L"items");
+
+	for (my::bench::timer t(bench, "xml", "wptree::get<int>"); t.next(); )
+	{
+		my::bench::do_not_optimize( items_pt.get<int>(L"item.<xmlattr>.id") );
+	}
+
+	for (my::bench::timer t(bench, "xml", "frozen_node::get<int>"); t.next(); )
+	{
+		my::bench::do_not_optimize( items_tree.get<int>(L"item.<xmlattr>.id") );
+	}
+
+	for (my::bench::timer t(bench, "xml", "wptree::find"); t.next(); )
+	{
+		my::bench::do_not_optimize( items_pt.find(L"item") );
+	}
+
+	for (my::bench::timer t(bench, "xml", "frozen_node::find"); t.next(); )
+	{
+		my::bench::do_not_optimize( items_tree.find(L"item") );
+	}
+
+	/*
+		Запись: write_xml (в поток) и my::xml::write (в строку)
+	*/
+
+	::xml::ptree doc_npt;
+	my::xml::parse_utf8(doc, doc_npt);
+
+	for (my::bench::timer t(bench, "xml", "write_xml(wptree) 1M"); t.next(); )
+	{
+		wostringstream ss;
+		::xml::write_xml(ss, doc_pt);
+		string out = my::utf8::encode(ss.str());
+		my::bench::do_not_optimize(out);
+	}
+
+	for (my::bench::timer t(bench, "xml", "write(wptree) 1M"); t.next(); )
+	{
+		string out;
+		my::xml::write(out, doc_pt);
+		my::bench::do_not_optimize(out);
+	}
+
+	for (my::bench::timer t(bench, "xml", "write(frozen_tree) 1M"); t.next(); )
+	{
+		string out;
+		my::xml::write(out, doc_tree);
+		my::bench::do_not_optimize(out);
+	}
+
+	for (my::bench::timer t(bench, "xml", "write_xml(ptree) 1M"); t.next(); )
+	{
+		ostringstream ss;
+		::xml::write_xml(ss, doc_npt);
+		my::bench::do_not_optimize(ss);
+	}
+
+	for (my::bench::timer t(bench, "xml", "write(ptree) 1M"); t.next(); )
+	{
+		string out;
+		my::xml::write(out, doc_npt);
+		my::bench::do_not_optimize(out);
+	}
+
+	for (my::bench::timer t(bench, "xml", "reader -> writer 1M"); t.next(); )
+	{
+		istringstream ss(doc);
+		my::xml::reader r(ss);
+		string out;
+		my::xml::writer w(out);
+
+		while (r.next() != my::xml::reader::end_document)
+			w.write(r);
+
+		my::bench::do_not_optimize(out);
+	}
+
+	/*
+		Загрузка файла (4 Мб, utf8 с BOM): через wifstream с utf8-фасетом
+		(как раньше в my::xml::load) и my::xml::load
+	*/
+
+	const wstring filename = (fs::temp_directory_path()
+		/ "my_xml_bench.xml").wstring();
+	{
+		fs::ofstream fs(filename, std::ios::binary);
+		fs << "\xEF\xBB\xBF" << make_document(40000);
+	}
+
+	for (my::bench::timer t(bench, "xml", "parse(wifstream) 4M"); t.next(); )
+	{
+		::xml::wptree pt;
+		fs::wifstream fs(filename);
+		fs.imbue( locale(fs.getloc(), new my::utf8) );
+		fs.seekg(3);
+		my::xml::parse(fs, pt);
+		my::bench::do_not_optimize(pt);
+	}
+
+	for (my::bench::timer t(bench, "xml", "load 4M"); t.next(); )
+	{
+		::xml::wptree pt;
+		my::xml::load(filename, pt);
+		my::bench::do_not_optimize(pt);
+	}
+
+	fs::remove(filename);
+
+	return bench.report();
+}
@@ -0,0 +1,115 @@
+﻿#include "my_xml.h"
+#include "my_utf8.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+using namespace std;
+
+/* Эталон - write_xml (wptree - через wostream, затем в UTF-8) */
+string ref_write(const ::xml::ptree &pt)
+{
+	ostringstream out;
+	::xml::write_xml(out, pt);
+	return out.str();
+}
+
+string ref_write(const ::xml::wptree &pt)
+{
+	wostringstream out;
+	::xml::write_xml(out, pt);
+	return my::utf8::encode(out.str());
+}
+
+template<class Tree>
+void check(const char *type, const Tree &pt, const string &ref)
+{
+	string out;
+	my::xml::write(out, pt);
+
+	cout << type << ": ";
+	if (out == ref)
+		cout << "same" << endl;
+	else
+		cout << "FAILED" << endl << out << endl;
+}
+
+void test(const string &name, const ::xml::ptree &npt, const ::xml::wptree &wpt)
+{
+	string ref = ref_write(wpt);
+
+	cout << "test=" << name << endl;
+	cout << ref << endl;
+
+	check("ptree", npt, ref_write(npt));
+	check("wptree", wpt, ref);
+	check("frozen_tree", my::xml::frozen_tree(wpt), ref);
+	cout << endl;
+}
+
+void test(const string &name, const string &xml)
+{
+	::xml::ptree npt;
+	my::xml::parse_utf8(xml, npt);
+
+	::xml::wptree wpt;
+	my::xml::parse_utf8(xml, wpt);
+
+	test(name, npt, wpt);
+}
+
+int main()
+{
+	test("empty", "<a/>");
+
+	test("escape",
+		"<r a='&lt;&gt;&amp;&quot;&apos;'>&lt;&gt;&amp;&quot;&apos;"
+		"<b c=\"'\" d='\"'>a &amp;&amp; b &lt; c</b></r>");
+
+	test("non-ascii",
+		"<r \xD0\xB0\xD1\x82\xD1\x80=\"\xD0\xB7\xD0\xBD\xD0\xB0\xD1\x87\">"
+		"\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82, \xE2\x82\xAC"
+		" \xF0\x9F\x98\x80<\xD0\xB8\xD0\xBC\xD1\x8F>"
+		"\xD1\x82\xD0\xB5\xD0\xBA\xD1\x81\xD1\x82 &lt; 1</\xD0\xB8\xD0\xBC\xD1\x8F></r>");
+
+	test("cdata-comment",
+		"<!-- top --><r>text<!-- in <r> & --><![CDATA[raw <&> \"q\" 'a']]>"
+		"tail<c/></r>");
+
+	test("long",
+		"<r>a long text with no special characters at all, longer than"
+		" 32 bytes; then one &amp; at the end of the second block &lt;"
+		" and more text after it, to the end of the buffer &gt;</r>");
+
+	test("children",
+		"<r><z>3</z><a>1</a><m/><a>2</a><b><a>x</a></b><a>3</a></r>");
+
+	{
+		/* Атрибуты - не первым ребёнком, текст и дети вперемешку */
+		::xml::wptree wpt;
+		::xml::wptree &wr = wpt.put(L"r", L"");
+		wr.put(L"first", L"1");
+		wr.put(L"<xmlattr>.k", L"<\"'&>");
+		wr.put(L"<xmlattr>.n", L"\x0437\x043D\x0430\x0447");
+		wr.put(L"second", L"a & b");
+		wr.put(L"<xmlcomment>", L"c < d");
+		wr.add(L"empty", L"");
+		wpt.put(L"s.<xmlattr>.only", L"1");
+		wpt.put(L"t", L"\x0442\x0435\x043A\x0441\x0442");
+
+		::xml::ptree npt;
+		::xml::ptree &nr = npt.put("r", "");
+		nr.put("first", "1");
+		nr.put("<xmlattr>.k", "<\"'&>");
+		nr.put("<xmlattr>.n", "\xD0\xB7\xD0\xBD\xD0\xB0\xD1\x87");
+		nr.put("second", "a & b");
+		nr.put("<xmlcomment>", "c < d");
+		nr.add("empty", "");
+		npt.put("s.<xmlattr>.only", "1");
+		npt.put("t", "\xD1\x82\xD0\xB5\xD0\xBA\xD1\x81\xD1\x82");
+
+		test("attributes-not-first", npt, wpt);
+	}
+
+	return 0;
+}